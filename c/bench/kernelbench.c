@@ -0,0 +1,211 @@
+// kernelbench : throughput of the bulk platter operations on a program
+// image (data/codex.umz by default): loading it, from memory and from the
+// file, read or mapped, duplicating the loaded machine and converting the program array to the native order with
+// every kernel the CPU supports
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../um_priv.h"
+#include "../kernels.h"
+
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char * name, double best, size_t bytes)
+{
+  printf ("%-18s %10.1f us %10.1f MB/s\n"
+	  , name
+	  , best * 1e6
+	  , best > 0 ? bytes / best / 1e6 : 0);
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-r repeat] [image]\n", name);
+}
+
+int main (int argc, char ** argv)
+{
+  const char * path = "../data/codex.umz";
+  int repeat = 20;
+  byte * image = NULL;
+  size_t size = 0;
+  platter_t * native = NULL;
+  um_t machine;
+  double best = -1;
+  int i = 0;
+
+  for (i = 1; i < argc; ++i)
+    {
+      if (0 == strcmp (argv[i], "-r") && i + 1 < argc)
+	{
+	  repeat = atoi (argv[++i]);
+	}
+      else if ('-' == argv[i][0])
+	{
+	  usage (argv[0]);
+	  return 1;
+	}
+      else
+	{
+	  path = argv[i];
+	}
+    }
+
+  if (repeat < 1)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  if (EOK != um_load_image (path, &image, &size))
+    {
+      printf ("Could not read %s\n", path);
+      return 1;
+    }
+
+  printf ("%s: %zu bytes, best of %d runs, %s kernel selected\n"
+	  , path
+	  , size
+	  , repeat
+	  , um_kernels_name (um_kernels_selected ()));
+
+  // image copied to the program array
+  for (i = 0; i < repeat; ++i)
+    {
+      double start = 0;
+      double elapsed = 0;
+
+      memset (&machine, 0, sizeof(machine));
+
+      start = now ();
+      um_load (&machine, image, size);
+      elapsed = now () - start;
+
+      if (best < 0 || elapsed < best)
+	{
+	  best = elapsed;
+	}
+
+      if (i + 1 < repeat)
+	{
+	  um_release (&machine);
+	}
+    }
+  report ("load", best, size);
+
+  // image file read then copied, as um_load_file does for small images,
+  // against the file mapped as the program array
+  {
+    int mapped = 0;
+    
+    for (mapped = 0; mapped < 2; ++mapped)
+      {
+	best = -1;
+	for (i = 0; i < repeat; ++i)
+	  {
+	    um_t loaded;
+	    byte * content = NULL;
+	    size_t fs = 0;
+	    double start = 0;
+	    double elapsed = 0;
+	    
+	    memset (&loaded, 0, sizeof(loaded));
+	    
+	    start = now ();
+	    if (mapped)
+	      {
+		um_load_file (&loaded, path);
+	      }
+	    else if (EOK == um_load_image (path, &content, &fs))
+	      {
+		um_load (&loaded, content, fs);
+		free (content);
+	      }
+	    elapsed = now () - start;
+	    
+	    um_release (&loaded);
+	    
+	    if (best < 0 || elapsed < best)
+	      {
+		best = elapsed;
+	      }
+	  }
+	report (mapped ? "load file/mapped" : "load file/read", best, size);
+      }
+  }
+  
+  // arrays of a booted machine duplicated
+  best = -1;
+  for (i = 0; i < repeat; ++i)
+    {
+      um_t clone;
+      double start = now ();
+      double elapsed = 0;
+
+      um_clone (&clone, &machine);
+      elapsed = now () - start;
+      um_release (&clone);
+
+      if (best < 0 || elapsed < best)
+	{
+	  best = elapsed;
+	}
+    }
+  report ("clone", best, size);
+
+  // program array converted to the native order
+  native = (platter_t *) malloc (size);
+  if (NULL == native)
+    {
+      return 1;
+    }
+
+  {
+    um_kernel_t k;
+
+    for (k = 0; k < UM_KERNEL_COUNT; ++k)
+      {
+	char name [32];
+
+	if (EOK != um_kernels_select (k))
+	  {
+	    continue;
+	  }
+
+	best = -1;
+	for (i = 0; i < repeat; ++i)
+	  {
+	    double start = now ();
+	    double elapsed = 0;
+
+	    um_array_read (&machine, 0, 0, size / sizeof(platter_t), native);
+	    elapsed = now () - start;
+
+	    if (best < 0 || elapsed < best)
+	      {
+		best = elapsed;
+	      }
+	  }
+
+	snprintf (name, sizeof(name), "swap/%s", um_kernels_name (k));
+	report (name, best, size);
+      }
+  }
+
+  um_release (&machine);
+  free (native);
+  free (image);
+
+  return 0;
+}
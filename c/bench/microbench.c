@@ -0,0 +1,582 @@
+// microbench : measures the cost of every operator handler in isolation,
+// with synthetic UM programs generated in memory
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../umasm.h"
+#include "../deferred.h"
+
+
+// register usage of the generated programs: r0 is always 0 (program
+// array id), r1 is the loop counter, r2 and r3 are used by the loop
+// control, the benchmarked instructions use r4 to r7
+enum
+  {
+    R_ZERO = 0,
+    R_COUNTER = 1,
+    R_T0 = 2,
+    R_T1 = 3,
+    R4 = 4,
+    R5 = 5,
+    R6 = 6,
+    R7 = 7,
+  };
+
+
+typedef struct micro_t micro_t;
+
+typedef void (* emit_func) (umasm_t * a, const micro_t * m);
+
+struct micro_t
+{
+  const char * name;
+
+  emit_func setup;
+  emit_func body;
+
+  // copies of the body in the loop
+  unsigned int unroll;
+
+  // loop iterations, scaled by the -s option
+  platter_t iterations;
+
+  // parameter of the setup (array size, ...)
+  platter_t param;
+
+  // program size in platters, 0 to leave it as generated
+  size_t pad;
+};
+
+
+/////////////////////////
+// setups and bodies
+/////////////////////////
+
+static void setup_operands (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R4, 0));
+  umasm_emit (a, umasm_ortho (R5, 0x1FFFFFF));
+  umasm_emit (a, umasm_ortho (R6, 7));
+  umasm_emit (a, umasm_ortho (R7, 0x12345));
+}
+
+static void setup_array (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R6, m->param));
+  umasm_emit (a, umasm_op (OP_ALLOCATION, 0, R7, R6));
+  umasm_emit (a, umasm_ortho (R5, m->param / 2));
+  umasm_emit (a, umasm_ortho (R6, 42));
+}
+
+// the benchmarked array is allocated after m->param other live arrays
+static void setup_array_after_others (umasm_t * a, const micro_t * m)
+{
+  platter_t i = 0;
+
+  umasm_emit (a, umasm_ortho (R6, 1));
+  for (i = 0; i < m->param; ++i)
+    {
+      umasm_emit (a, umasm_op (OP_ALLOCATION, 0, R4, R6));
+    }
+  umasm_emit (a, umasm_op (OP_ALLOCATION, 0, R7, R6));
+  umasm_emit (a, umasm_ortho (R5, 0));
+}
+
+static void setup_allocation_size (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R6, m->param));
+}
+
+// r7 = copy of the whole program, m->pad platters
+static void setup_program_copy (umasm_t * a, const micro_t * m)
+{
+  address_t loop = 0;
+  address_t exit_patch = 0;
+
+  umasm_emit (a, umasm_ortho (R6, m->pad));
+  umasm_emit (a, umasm_op (OP_ALLOCATION, 0, R7, R6));
+  umasm_emit (a, umasm_ortho (R4, 0));
+
+  loop = umasm_emit (a, umasm_op (OP_ARRAY_INDEX, R5, R_ZERO, R4));
+  umasm_emit (a, umasm_op (OP_ARRAY_AMEND, R7, R4, R5));
+  umasm_emit (a, umasm_ortho (R_T0, 1));
+  umasm_emit (a, umasm_op (OP_ADDITION, R4, R4, R_T0));
+  umasm_emit (a, umasm_op (OP_NOT_AND, R_T0, R_ZERO, R_ZERO));
+  umasm_emit (a, umasm_op (OP_ADDITION, R6, R6, R_T0));
+  exit_patch = umasm_emit (a, 0);
+  umasm_emit (a, umasm_ortho (R_T1, loop));
+  umasm_emit (a, umasm_op (OP_COND_MOVE, R_T0, R_T1, R6));
+  umasm_emit (a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R_T0));
+
+  umasm_patch (a, exit_patch, umasm_ortho (R_T0, umasm_here (a)));
+}
+
+// r7 = copy of the program, m->param platters (m->pad too), r4 = m->param,
+// r5 = 0 and r6 = 0, the source array and offset of the bulk operators
+static void setup_bulk (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R4, m->param));
+  umasm_emit (a, umasm_op (OP_ALLOCATION, 0, R7, R4));
+  umasm_emit (a, umasm_ortho (R5, 0));
+  umasm_emit (a, umasm_ortho (R6, 0));
+  umasm_emit (a, umasm_bulk (OP_BULK_STORE, BULK_COPY, R7, R5, R4));
+}
+
+/**
+ * Emits the loop that runs the amend of R7[R4] m->param times, R4 going
+ * from 0, after the instructions emitted by before.
+ */
+static void emit_array_loop (umasm_t * a, const micro_t * m, emit_func before)
+{
+  address_t loop = 0;
+  address_t exit_patch = 0;
+
+  umasm_emit (a, umasm_ortho (R6, m->param));
+  umasm_emit (a, umasm_ortho (R4, 0));
+
+  loop = umasm_here (a);
+  if (NULL != before)
+    {
+      before (a, m);
+    }
+  umasm_emit (a, umasm_op (OP_ARRAY_AMEND, R7, R4, R5));
+  umasm_emit (a, umasm_ortho (R_T0, 1));
+  umasm_emit (a, umasm_op (OP_ADDITION, R4, R4, R_T0));
+  umasm_emit (a, umasm_op (OP_NOT_AND, R_T0, R_ZERO, R_ZERO));
+  umasm_emit (a, umasm_op (OP_ADDITION, R6, R6, R_T0));
+  exit_patch = umasm_emit (a, 0);
+  umasm_emit (a, umasm_ortho (R_T1, loop));
+  umasm_emit (a, umasm_op (OP_COND_MOVE, R_T0, R_T1, R6));
+  umasm_emit (a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R_T0));
+
+  umasm_patch (a, exit_patch, umasm_ortho (R_T0, umasm_here (a)));
+}
+
+static void emit_copy_read (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_ARRAY_INDEX, R5, R_ZERO, R4));
+}
+
+static void body_empty (umasm_t * a, const micro_t * m)
+{
+}
+
+static void body_cond_move (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_COND_MOVE, R4, R5, R6));
+}
+
+static void body_array_index (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_ARRAY_INDEX, R4, R7, R5));
+}
+
+static void body_array_amend (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_ARRAY_AMEND, R7, R5, R6));
+}
+
+static void body_addition (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_ADDITION, R4, R5, R6));
+}
+
+static void body_multiplication (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_MULTIPLICATION, R4, R5, R6));
+}
+
+static void body_division (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_DIVISION, R4, R5, R6));
+}
+
+static void body_not_and (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_NOT_AND, R4, R5, R6));
+}
+
+static void body_allocation_abandonment (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_ALLOCATION, 0, R4, R6));
+  umasm_emit (a, umasm_op (OP_ABANDONMENT, 0, 0, R4));
+}
+
+static void body_output (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_OUTPUT, 0, 0, R6));
+}
+
+static void body_input (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_op (OP_INPUT, 0, 0, R4));
+}
+
+// the orthography that sets the target is part of the measure
+static void body_load_program (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R5, umasm_here (a) + 2));
+  umasm_emit (a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R5));
+}
+
+static void body_load_program_copy (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R5, umasm_here (a) + 2));
+  umasm_emit (a, umasm_op (OP_LOAD_PROGRAM, 0, R7, R5));
+}
+
+static void body_orthography (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R4, 0x12345));
+}
+
+// the programs below copy, fill, compare and search m->param platters,
+// with a guest loop or with one extension operator
+
+static void body_copy_loop (umasm_t * a, const micro_t * m)
+{
+  emit_array_loop (a, m, emit_copy_read);
+}
+
+static void body_copy_bulk (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_bulk (OP_BULK_STORE, BULK_COPY, R7, R5, R4));
+}
+
+static void body_fill_loop (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R5, 42));
+  emit_array_loop (a, m, NULL);
+}
+
+static void body_fill_bulk (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R_T0, 42));
+  umasm_emit (a, umasm_bulk (OP_BULK_STORE, BULK_FILL, R7, R_T0, R4));
+}
+
+// r7 is equal to the program, the whole range is compared
+static void body_compare_bulk (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R4, m->param));
+  umasm_emit (a, umasm_bulk (OP_BULK_SCAN, BULK_COMPARE, R7, R5, R4));
+}
+
+// no platter of the program has that value, the whole range is searched
+static void body_search_bulk (umasm_t * a, const micro_t * m)
+{
+  umasm_emit (a, umasm_ortho (R4, m->param));
+  umasm_emit (a, umasm_ortho (R_T0, 0x1FFFFFF));
+  umasm_emit (a, umasm_bulk (OP_BULK_SCAN, BULK_SEARCH, R7, R_T0, R4));
+}
+
+
+static const micro_t g_micros [] = {
+  { "cond_move", setup_operands, body_cond_move, 16, 1000000 },
+  { "addition", setup_operands, body_addition, 16, 1000000 },
+  { "multiplication", setup_operands, body_multiplication, 16, 1000000 },
+  { "division", setup_operands, body_division, 16, 1000000 },
+  { "not_and", setup_operands, body_not_and, 16, 1000000 },
+  { "orthography", NULL, body_orthography, 16, 1000000 },
+  { "array_index/16", setup_array, body_array_index, 16, 1000000, 16 },
+  { "array_index/1M", setup_array, body_array_index, 16, 1000000, 1 << 20 },
+  { "array_index/after-1000", setup_array_after_others, body_array_index, 16, 100000, 1000 },
+  { "array_amend/16", setup_array, body_array_amend, 16, 1000000, 16 },
+  { "array_amend/1M", setup_array, body_array_amend, 16, 1000000, 1 << 20 },
+  { "array_amend/after-1000", setup_array_after_others, body_array_amend, 16, 100000, 1000 },
+  { "alloc+abandon/1", setup_allocation_size, body_allocation_abandonment, 16, 100000, 1 },
+  { "alloc+abandon/64", setup_allocation_size, body_allocation_abandonment, 16, 100000, 64 },
+  { "alloc+abandon/4K", setup_allocation_size, body_allocation_abandonment, 4, 100000, 4096 },
+  { "alloc+abandon/256K", setup_allocation_size, body_allocation_abandonment, 1, 2000, 1 << 18 },
+  { "alloc+abandon/16M", setup_allocation_size, body_allocation_abandonment, 1, 200, 1 << 22 },
+  { "output", setup_operands, body_output, 16, 1000000 },
+  { "input", NULL, body_input, 16, 1000000 },
+  { "load_program", NULL, body_load_program, 16, 1000000 },
+  { "load_program/copy-1K", setup_program_copy, body_load_program_copy, 1, 100000, 0, 1 << 10 },
+  { "load_program/copy-64K", setup_program_copy, body_load_program_copy, 1, 5000, 0, 1 << 16 },
+  { "load_program/copy-1M", setup_program_copy, body_load_program_copy, 1, 200, 0, 1 << 20 },
+  { "copy/loop-4K", setup_bulk, body_copy_loop, 1, 500, 1 << 12, 1 << 12 },
+  { "copy/bulk-4K", setup_bulk, body_copy_bulk, 16, 20000, 1 << 12, 1 << 12 },
+  { "copy/loop-256K", setup_bulk, body_copy_loop, 1, 10, 1 << 18, 1 << 18 },
+  { "copy/bulk-256K", setup_bulk, body_copy_bulk, 1, 2000, 1 << 18, 1 << 18 },
+  { "fill/loop-4K", setup_bulk, body_fill_loop, 1, 500, 1 << 12, 1 << 12 },
+  { "fill/bulk-4K", setup_bulk, body_fill_bulk, 16, 20000, 1 << 12, 1 << 12 },
+  { "compare/bulk-4K", setup_bulk, body_compare_bulk, 16, 20000, 1 << 12, 1 << 12 },
+  { "search/bulk-4K", setup_bulk, body_search_bulk, 16, 20000, 1 << 12, 1 << 12 },
+};
+
+// -G runs the programs with guard pages instead of explicit checks
+static um_checking_t g_checking = UM_CHECKING_EXPLICIT;
+
+// -D releases the large arrays on a helper thread
+static um_deferred_t * g_deferred = NULL;
+
+static const micro_t g_empty = { "empty", NULL, body_empty, 1, 1000000 };
+
+
+/////////////////////////
+// measures
+/////////////////////////
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static byte * build (const micro_t * m, platter_t iterations, size_t * size)
+{
+  umasm_t a;
+  byte * image = NULL;
+
+  umasm_init (&a);
+
+  if (NULL != m->setup)
+    {
+      m->setup (&a, m);
+    }
+
+  if (0 != iterations)
+    {
+      address_t loop = 0;
+      address_t exit_patch = 0;
+      unsigned int i = 0;
+
+      umasm_load_constant (&a, R_COUNTER, R_T0, iterations);
+
+      loop = umasm_here (&a);
+      for (i = 0; i < m->unroll; ++i)
+	{
+	  m->body (&a, m);
+	}
+
+      umasm_emit (&a, umasm_op (OP_NOT_AND, R_T0, R_ZERO, R_ZERO));
+      umasm_emit (&a, umasm_op (OP_ADDITION, R_COUNTER, R_COUNTER, R_T0));
+      exit_patch = umasm_emit (&a, 0);
+      umasm_emit (&a, umasm_ortho (R_T1, loop));
+      umasm_emit (&a, umasm_op (OP_COND_MOVE, R_T0, R_T1, R_COUNTER));
+      umasm_emit (&a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R_T0));
+
+      umasm_patch (&a, exit_patch, umasm_ortho (R_T0, umasm_here (&a)));
+    }
+
+  umasm_emit (&a, umasm_op (OP_HALT, 0, 0, 0));
+  umasm_pad (&a, m->pad);
+
+  image = umasm_image (&a, size);
+  umasm_free (&a);
+
+  return image;
+}
+
+/**
+ * @return best time of repeat runs of the program
+ */
+static double measure (const micro_t * m
+		       , um_engine_t engine
+		       , platter_t iterations
+		       , int repeat
+		       , unsigned long long * instructions)
+{
+  size_t size = 0;
+  byte * image = build (m, iterations, &size);
+  double best = -1;
+  int i = 0;
+
+  for (i = 0; i < repeat; ++i)
+    {
+      um_t machine;
+      double start = 0;
+      double elapsed = 0;
+
+      memset (&machine, 0, sizeof(machine));
+      um_set_checking (&machine, g_checking);
+      um_set_extensions (&machine, 1);
+      um_deferred_attach (g_deferred, &machine);
+
+      start = now ();
+      um_run_with_engine (&machine, engine, image, size);
+      elapsed = now () - start;
+
+      fflush (stdout);
+
+      if (best < 0 || elapsed < best)
+	{
+	  best = elapsed;
+	}
+
+      if (NULL != instructions)
+	{
+	  *instructions = machine.stats.instructions;
+	}
+
+      um_release (&machine);
+    }
+
+  free (image);
+
+  return best;
+}
+
+/**
+ * @return time of one iteration of the loop, setup excluded
+ */
+static double measure_iteration (const micro_t * m
+				 , um_engine_t engine
+				 , platter_t iterations
+				 , int repeat)
+{
+  double full = measure (m, engine, iterations, repeat, NULL);
+  double setup = measure (m, engine, 0, repeat, NULL);
+
+  return (full - setup) / iterations;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-e engine] [-G] [-D depth] [-r repeat] [-s scale] [name-filter ...]\n", name);
+}
+
+int main (int argc, char ** argv)
+{
+  const char * filters [32];
+  size_t filter_count = 0;
+  const char * only_engine = NULL;
+  int repeat = 3;
+  double scale = 1;
+  FILE * report = NULL;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-e") && i + 1 < argc)
+	  {
+	    only_engine = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-G"))
+	  {
+	    g_checking = UM_CHECKING_GUARD_PAGES;
+	  }
+	else if (0 == strcmp (argv[i], "-D") && i + 1 < argc && NULL == g_deferred)
+	  {
+	    if (0 != um_deferred_start (&g_deferred
+					  , strtoul (argv[++i], NULL, 0)
+					  , UM_DEFERRED_THRESHOLD))
+	      {
+		usage (argv[0]);
+		return 1;
+	      }
+	  }
+	else if (0 == strcmp (argv[i], "-r") && i + 1 < argc)
+	  {
+	    repeat = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-s") && i + 1 < argc)
+	  {
+	    scale = atof (argv[++i]);
+	  }
+	else if ('-' == argv[i][0])
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+	else if (filter_count < sizeof(filters) / sizeof(filters[0]))
+	  {
+	    filters[filter_count++] = argv[i];
+	  }
+      }
+  }
+
+  if (repeat < 1 || scale <= 0)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  // the output operator writes on stdout, the report goes on the
+  // original one
+  {
+    int fd = dup (STDOUT_FILENO);
+    int devnull = open ("/dev/null", O_RDWR);
+
+    report = fdopen (fd, "w");
+
+    dup2 (devnull, STDIN_FILENO);
+    dup2 (devnull, STDOUT_FILENO);
+  }
+
+  {
+    um_engine_t engine;
+
+    for (engine = 0; engine < UM_ENGINE_COUNT; ++engine)
+      {
+	size_t i = 0;
+	const platter_t empty_iterations = (platter_t) (g_empty.iterations * scale) + 1;
+	double loop = 0;
+
+	if (NULL != only_engine && 0 != strcmp (only_engine, um_engine_name (engine)))
+	  {
+	    continue;
+	  }
+
+	loop = measure_iteration (&g_empty, engine, empty_iterations, repeat);
+
+	fprintf (report, "engine %s%s%s, loop overhead %.1fns per iteration\n"
+		 , um_engine_name (engine)
+		 , UM_CHECKING_GUARD_PAGES == g_checking ? " with guard pages" : ""
+		 , NULL != g_deferred ? " with deferred frees" : ""
+		 , loop * 1e9);
+	fprintf (report, "%-26s %12s %12s %14s\n", "operation", "ns/op", "Mops/s", "instructions");
+
+	for (i = 0; i < sizeof(g_micros) / sizeof(g_micros[0]); ++i)
+	  {
+	    const micro_t * m = &g_micros[i];
+	    const platter_t iterations = (platter_t) (m->iterations * scale) + 1;
+	    unsigned long long instructions = 0;
+	    double op = 0;
+
+	    if (0 != filter_count)
+	      {
+		size_t f = 0;
+		while (f < filter_count && NULL == strstr (m->name, filters[f]))
+		  {
+		    f++;
+		  }
+		if (f == filter_count)
+		  {
+		    continue;
+		  }
+	      }
+
+	    measure (m, engine, iterations, 1, &instructions);
+	    op = (measure_iteration (m, engine, iterations, repeat) - loop) / m->unroll;
+
+	    fprintf (report, "%-26s %12.2f %12.2f %14llu\n"
+		     , m->name
+		     , op * 1e9
+		     , op > 0 ? 1e-6 / op : 0
+		     , instructions);
+	    fflush (report);
+	  }
+      }
+  }
+
+  if (NULL != g_deferred)
+    {
+      um_deferred_report (report, g_deferred);
+      um_deferred_stop (g_deferred);
+    }
+
+  fclose (report);
+
+  return 0;
+}
@@ -0,0 +1,335 @@
+// schedbench : runs many generated machines on a few scheduler workers,
+// with runaway machines that never stop and an echo machine whose
+// response time is measured, and reports how the CPU time was shared
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../umasm.h"
+#include "../sched.h"
+
+
+enum
+  {
+    R_ZERO = 0,
+    R_COUNTER = 1,
+    R_T0 = 2,
+    R_T1 = 3,
+    R_BYTE = 4,
+  };
+
+
+// the echo machine, fed one byte at a time by the main thread
+typedef struct echo_t
+{
+  int pending;
+  int echoed;
+
+} echo_t;
+
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @param iterations 0 to loop forever
+ */
+static byte * build_loop (platter_t iterations, size_t * size)
+{
+  umasm_t a;
+  byte * image = NULL;
+  address_t loop = 0;
+
+  umasm_init (&a);
+
+  umasm_load_constant (&a, R_COUNTER, R_T0, iterations);
+  loop = umasm_here (&a);
+
+  if (0 == iterations)
+    {
+      umasm_emit (&a, umasm_ortho (R_T0, loop));
+      umasm_emit (&a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R_T0));
+    }
+  else
+    {
+      address_t exit_patch = 0;
+
+      umasm_emit (&a, umasm_op (OP_NOT_AND, R_T0, R_ZERO, R_ZERO));
+      umasm_emit (&a, umasm_op (OP_ADDITION, R_COUNTER, R_COUNTER, R_T0));
+      exit_patch = umasm_emit (&a, 0);
+      umasm_emit (&a, umasm_ortho (R_T1, loop));
+      umasm_emit (&a, umasm_op (OP_COND_MOVE, R_T0, R_T1, R_COUNTER));
+      umasm_emit (&a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R_T0));
+
+      umasm_patch (&a, exit_patch, umasm_ortho (R_T0, umasm_here (&a)));
+    }
+
+  umasm_emit (&a, umasm_op (OP_HALT, 0, 0, 0));
+
+  image = umasm_image (&a, size);
+  umasm_free (&a);
+
+  return image;
+}
+
+static byte * build_echo (size_t * size)
+{
+  umasm_t a;
+  byte * image = NULL;
+
+  umasm_init (&a);
+
+  umasm_emit (&a, umasm_op (OP_INPUT, 0, 0, R_BYTE));
+  umasm_emit (&a, umasm_op (OP_OUTPUT, 0, 0, R_BYTE));
+  umasm_emit (&a, umasm_ortho (R_T0, 0));
+  umasm_emit (&a, umasm_op (OP_LOAD_PROGRAM, 0, R_ZERO, R_T0));
+
+  image = umasm_image (&a, size);
+  umasm_free (&a);
+
+  return image;
+}
+
+static int echo_input (void * context)
+{
+  echo_t * e = (echo_t *) context;
+
+  if ( ! __atomic_exchange_n (&e->pending, 0, __ATOMIC_ACQUIRE))
+    {
+      return UM_INPUT_WOULD_BLOCK;
+    }
+
+  return 'e';
+}
+
+static int echo_output (void * context, byte c)
+{
+  echo_t * e = (echo_t *) context;
+
+  __atomic_store_n (&e->echoed, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+static int discard_output (void * context, byte c)
+{
+  return 0;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-w workers] [-m machines] [-n iterations] [-r runaways]"
+	  " [-s slice] [-p pings]\n", name);
+}
+
+int main (int argc, char ** argv)
+{
+  unsigned int workers = 2;
+  size_t machine_count = 200;
+  platter_t iterations = 1000000;
+  size_t runaway_count = 4;
+  unsigned long long slice = 100000;
+  int pings = 50;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-w") && i + 1 < argc)
+	  {
+	    workers = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-m") && i + 1 < argc)
+	  {
+	    machine_count = strtoul (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-n") && i + 1 < argc)
+	  {
+	    iterations = strtoul (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-r") && i + 1 < argc)
+	  {
+	    runaway_count = strtoul (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-s") && i + 1 < argc)
+	  {
+	    slice = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-p") && i + 1 < argc)
+	  {
+	    pings = atoi (argv[++i]);
+	  }
+	else
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+      }
+  }
+
+  if (0 == workers || 0 == slice || 0 == iterations)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  {
+    const size_t total = machine_count + runaway_count + 1;
+    um_t * machines = (um_t *) calloc (total, sizeof(um_t));
+    size_t * ids = (size_t *) calloc (total, sizeof(size_t));
+    um_sched_t * sched = NULL;
+    echo_t echo = { 0, 0 };
+    size_t loop_size = 0;
+    size_t runaway_size = 0;
+    size_t echo_size = 0;
+    byte * loop_image = build_loop (iterations, &loop_size);
+    byte * runaway_image = build_loop (0, &runaway_size);
+    byte * echo_image = build_echo (&echo_size);
+    double start = 0;
+    double latency_total = 0;
+    double latency_max = 0;
+    size_t i = 0;
+    int err = 0;
+
+    if (NULL == machines || NULL == ids)
+      {
+	printf ("Out of memory\n");
+	return 1;
+      }
+
+    err = um_sched_create (&sched, workers, slice);
+    if (EOK != err)
+      {
+	printf ("Could not start the scheduler: %d\n", err);
+	return 1;
+      }
+
+    start = now ();
+
+    for (i = 0; i < total; ++i)
+      {
+	um_t * m = &machines[i];
+	const size_t echo_index = total - 1;
+
+	m->io.output = discard_output;
+
+	if (i < runaway_count)
+	  {
+	    um_load (m, runaway_image, runaway_size);
+	  }
+	else if (i < echo_index)
+	  {
+	    um_load (m, loop_image, loop_size);
+	  }
+	else
+	  {
+	    m->io.input = echo_input;
+	    m->io.output = echo_output;
+	    m->io.context = &echo;
+	    um_load (m, echo_image, echo_size);
+	  }
+
+	um_sched_add (sched, m, UM_ENGINE_DEFAULT, &ids[i]);
+      }
+
+    // response time of the echo machine while the others run
+    for (i = 0; i < (size_t) pings; ++i)
+      {
+	double sent = 0;
+	double latency = 0;
+
+	usleep (10000);
+
+	__atomic_store_n (&echo.echoed, 0, __ATOMIC_RELAXED);
+	__atomic_store_n (&echo.pending, 1, __ATOMIC_RELEASE);
+	sent = now ();
+	um_sched_wake (sched, ids[total - 1]);
+
+	while ( ! __atomic_load_n (&echo.echoed, __ATOMIC_ACQUIRE))
+	  {
+	    usleep (50);
+	  }
+
+	latency = now () - sent;
+	latency_total += latency;
+	if (latency > latency_max)
+	  {
+	    latency_max = latency;
+	  }
+      }
+
+    // the finite machines are done when the queue only holds runaways
+    for (i = 0; i < runaway_count; ++i)
+      {
+	um_sched_remove (sched, ids[i]);
+      }
+
+    um_sched_wait (sched);
+
+    {
+      const double elapsed = now () - start;
+      unsigned long long min_cpu = ~0ULL;
+      unsigned long long max_cpu = 0;
+      unsigned long long total_cpu = 0;
+      size_t halted = 0;
+
+      for (i = runaway_count; i < total - 1; ++i)
+	{
+	  um_sched_stats_t stats;
+
+	  um_sched_get_stats (sched, ids[i], &stats);
+
+	  halted += UM_STATUS_HALTED == stats.status;
+	  total_cpu += stats.cpu_ns;
+	  if (stats.cpu_ns < min_cpu)
+	    {
+	      min_cpu = stats.cpu_ns;
+	    }
+	  if (stats.cpu_ns > max_cpu)
+	    {
+	      max_cpu = stats.cpu_ns;
+	    }
+	}
+
+      printf ("%u workers, %lu machines (%lu halted), %lu runaways, slice %llu instructions\n"
+	      , workers
+	      , (unsigned long) machine_count
+	      , (unsigned long) halted
+	      , (unsigned long) runaway_count
+	      , slice);
+      printf ("finished in %.3fs, CPU per machine min %.3fms avg %.3fms max %.3fms\n"
+	      , elapsed
+	      , min_cpu / 1e6
+	      , 0 != machine_count ? total_cpu / 1e6 / machine_count : 0
+	      , max_cpu / 1e6);
+      printf ("echo response over %d pings: avg %.3fms max %.3fms\n"
+	      , pings
+	      , 0 != pings ? latency_total * 1e3 / pings : 0
+	      , latency_max * 1e3);
+    }
+
+    um_sched_destroy (sched);
+
+    for (i = 0; i < total; ++i)
+      {
+	um_release (&machines[i]);
+      }
+
+    free (echo_image);
+    free (runaway_image);
+    free (loop_image);
+    free (ids);
+    free (machines);
+  }
+
+  return 0;
+}
@@ -0,0 +1,516 @@
+// soak : long running codex.umz / UMIX session, records throughput and
+// heap growth over time as a CSV time series
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../um.h"
+#include "../gc.h"
+
+#if ! defined(EOK)
+#define EOK 0
+#endif
+
+
+typedef enum SOAK_CONSTANTS
+  {
+    // instructions run between two clock checks
+    SOAK_SLICE = 100000,
+
+  } SOAK_CONSTANTS;
+
+
+typedef struct buffer_t
+{
+  byte * data;
+  size_t size;
+  size_t capacity;
+
+} buffer_t;
+
+
+typedef struct session_t
+{
+  um_t machine;
+  um_engine_t engine;
+
+  // bytes sent once, then script sent repeats times (forever when 0)
+  buffer_t prologue;
+  buffer_t script;
+  unsigned int repeats;
+
+  size_t position;
+  unsigned int sent;
+
+  // whole output when capture is set
+  int capture;
+  buffer_t output;
+
+  FILE * transcript;
+
+} session_t;
+
+
+typedef struct sampler_t
+{
+  FILE * csv;
+
+  double start;
+  double interval;
+  double duration;
+
+  double last_time;
+  unsigned long long last_instructions;
+
+} sampler_t;
+
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long rss_kb (void)
+{
+  FILE * f = fopen ("/proc/self/statm", "r");
+  long size = 0;
+  long resident = 0;
+
+  if (NULL == f)
+    {
+      return 0;
+    }
+
+  if (2 != fscanf (f, "%ld %ld", &size, &resident))
+    {
+      resident = 0;
+    }
+  fclose (f);
+
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static int buffer_append (buffer_t * b, const byte * data, size_t size)
+{
+  if (b->size + size > b->capacity)
+    {
+      size_t capacity = 0 == b->capacity ? 4096 : b->capacity;
+      byte * p = NULL;
+
+      while (capacity < b->size + size)
+	{
+	  capacity *= 2;
+	}
+
+      p = (byte *) realloc (b->data, capacity);
+      if (NULL == p)
+	{
+	  return ENOMEM;
+	}
+      b->data = p;
+      b->capacity = capacity;
+    }
+
+  memcpy (b->data + b->size, data, size);
+  b->size += size;
+
+  return EOK;
+}
+
+static int session_output (void * context, byte c)
+{
+  session_t * s = (session_t *) context;
+
+  if (NULL != s->transcript)
+    {
+      fputc (c, s->transcript);
+    }
+
+  if (s->capture)
+    {
+      return buffer_append (&s->output, &c, 1);
+    }
+
+  return EOK;
+}
+
+static int session_input (void * context)
+{
+  session_t * s = (session_t *) context;
+  int c = EOF;
+
+  if (s->position < s->prologue.size)
+    {
+      c = s->prologue.data[s->position++];
+    }
+  else if (0 != s->script.size && (0 == s->repeats || s->sent < s->repeats))
+    {
+      const size_t at = s->position - s->prologue.size;
+
+      c = s->script.data[at];
+      s->position++;
+
+      if (at + 1 == s->script.size)
+	{
+	  // next round of the script
+	  s->position = s->prologue.size;
+	  s->sent++;
+	}
+    }
+
+  if (EOF != c && NULL != s->transcript)
+    {
+      fputc (c, s->transcript);
+    }
+
+  return c;
+}
+
+static void sample (sampler_t * sampler, const char * phase, um_t * machine)
+{
+  const double t = now ();
+  const double elapsed = t - sampler->last_time;
+  const unsigned long long executed = machine->stats.instructions - sampler->last_instructions;
+
+  fprintf (sampler->csv
+	   , "%.3f,%s,%llu,%.3f,%llu,%llu,%llu,%llu,%ld,%llu,%llu,%.3f\n"
+	   , t - sampler->start
+	   , phase
+	   , machine->stats.instructions
+	   , elapsed > 0 ? executed / elapsed / 1e6 : 0.0
+	   , machine->stats.live_arrays
+	   , machine->stats.heap_bytes
+	   , machine->stats.allocations
+	   , machine->stats.abandonments
+	   , rss_kb ()
+	   , machine->stats.gc_collections
+	   , machine->stats.gc_reclaimed_bytes
+	   , machine->stats.gc_max_pause_ns / 1e6);
+  fflush (sampler->csv);
+
+  sampler->last_time = t;
+  sampler->last_instructions = machine->stats.instructions;
+}
+
+/**
+ * Runs the session until the machine stops or the soak duration is
+ * reached, sampling every interval.
+ *
+ * @return the status of the machine
+ */
+static um_status_t soak (session_t * s, sampler_t * sampler, const char * phase)
+{
+  um_status_t status = UM_STATUS_RUNNING;
+
+  sampler->last_time = now ();
+  sampler->last_instructions = 0;
+
+  while (UM_STATUS_RUNNING == status)
+    {
+      double t = 0;
+
+      status = um_run_for (&s->machine, s->engine, SOAK_SLICE);
+
+      t = now ();
+      if (t - sampler->last_time >= sampler->interval || UM_STATUS_RUNNING != status)
+	{
+	  sample (sampler, phase, &s->machine);
+	}
+
+      if (0 != sampler->duration && t - sampler->start >= sampler->duration)
+	{
+	  break;
+	}
+    }
+
+  return status;
+}
+
+static int read_file (const char * path, buffer_t * b)
+{
+  byte * data = NULL;
+  size_t size = 0;
+  int err = um_load_image (path, &data, &size);
+
+  if (EOK != err)
+    {
+      return err;
+    }
+
+  b->size = 0;
+  err = buffer_append (b, data, size);
+  free (data);
+
+  return err;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-e engine] [-k key] [-L login] [-c commands-file] [-R repeats]\n"
+	  "\t[-d seconds] [-i interval] [-o csv] [-t transcript] [-g gc-threshold-MB]\n"
+	  "\t[-u umix-image] [-S save-umix-image] [codex.umz]\n"
+	  , name);
+}
+
+int main (int argc, char ** argv)
+{
+  const char * codex_path = "../data/codex.umz";
+  const char * key = "(\\b.bb)(\\v.vv)06FHPVboundvarHRAk";
+  const char * login = "guest";
+  const char * commands_path = NULL;
+  const char * csv_path = "soak.csv";
+  const char * transcript_path = NULL;
+  const char * umix_path = NULL;
+  const char * save_path = NULL;
+  const char * engine_name = NULL;
+  unsigned int repeats = 0;
+  unsigned long long gc_threshold = 0;
+
+  sampler_t sampler;
+  session_t s;
+  buffer_t umix = { 0 };
+  um_status_t status = UM_STATUS_HALTED;
+
+  memset (&sampler, 0, sizeof(sampler));
+  sampler.interval = 1.0;
+  sampler.duration = 600;
+
+  memset (&s, 0, sizeof(s));
+  s.engine = UM_ENGINE_DEFAULT;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	const int has_value = i + 1 < argc;
+
+	if (0 == strcmp (argv[i], "-e") && has_value)
+	  {
+	    engine_name = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-k") && has_value)
+	  {
+	    key = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-L") && has_value)
+	  {
+	    login = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-c") && has_value)
+	  {
+	    commands_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-R") && has_value)
+	  {
+	    repeats = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-d") && has_value)
+	  {
+	    sampler.duration = atof (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-i") && has_value)
+	  {
+	    sampler.interval = atof (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-o") && has_value)
+	  {
+	    csv_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-t") && has_value)
+	  {
+	    transcript_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-g") && has_value)
+	  {
+	    gc_threshold = strtoull (argv[++i], NULL, 0) << 20;
+	  }
+	else if (0 == strcmp (argv[i], "-u") && has_value)
+	  {
+	    umix_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-S") && has_value)
+	  {
+	    save_path = argv[++i];
+	  }
+	else if ('-' == argv[i][0])
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+	else
+	  {
+	    codex_path = argv[i];
+	  }
+      }
+  }
+
+  if (NULL != engine_name)
+    {
+      um_engine_t e;
+      for (e = 0; e < UM_ENGINE_COUNT; ++e)
+	{
+	  if (0 == strcmp (engine_name, um_engine_name (e)))
+	    {
+	      break;
+	    }
+	}
+      if (UM_ENGINE_COUNT == e)
+	{
+	  printf ("Unknown engine %s\n", engine_name);
+	  return 1;
+	}
+      s.engine = e;
+    }
+
+  if (NULL != commands_path)
+    {
+      if (EOK != read_file (commands_path, &s.script))
+	{
+	  printf ("Could not read the commands file %s\n", commands_path);
+	  return 1;
+	}
+    }
+  else
+    {
+      static const char default_commands [] = "help\nls\ncd code\nls\ncd ..\nls /home\n";
+      buffer_append (&s.script, (const byte *) default_commands, strlen (default_commands));
+    }
+
+  sampler.csv = fopen (csv_path, "w");
+  if (NULL == sampler.csv)
+    {
+      printf ("Could not write %s\n", csv_path);
+      return 1;
+    }
+  fprintf (sampler.csv
+	   , "seconds,phase,instructions,minstr_per_second,live_arrays"
+	   ",heap_bytes,allocations,abandonments,rss_kb"
+	   ",gc_collections,gc_reclaimed_bytes,gc_max_pause_ms\n");
+
+  if (NULL != transcript_path)
+    {
+      s.transcript = fopen (transcript_path, "w");
+    }
+
+  s.machine.io.output = session_output;
+  s.machine.io.input = session_input;
+  s.machine.io.context = &s;
+
+  sampler.start = now ();
+
+  if (NULL != umix_path)
+    {
+      if (EOK != read_file (umix_path, &umix))
+	{
+	  printf ("Could not open the UMIX image %s\n", umix_path);
+	  return 1;
+	}
+    }
+  else
+    {
+      // the codex dumps the UMIX image once decrypted
+      static const char marker [] = "UM program follows colon:";
+      buffer_t codex = { 0 };
+      session_t boot = s;
+      byte * start = NULL;
+
+      if (EOK != read_file (codex_path, &codex))
+	{
+	  printf ("Could not open the codex file %s\n", codex_path);
+	  return 1;
+	}
+
+      boot.script.size = 0;
+      boot.capture = 1;
+      buffer_append (&boot.prologue, (const byte *) key, strlen (key));
+      buffer_append (&boot.prologue, (const byte *) "\np\n", 3);
+      boot.machine.io.context = &boot;
+
+      printf ("decrypting %s\n", codex_path);
+
+      um_load (&boot.machine, codex.data, codex.size);
+      status = soak (&boot, &sampler, "codex");
+      um_release (&boot.machine);
+      free (codex.data);
+      free (boot.prologue.data);
+
+      if (UM_STATUS_HALTED == status)
+	{
+	  buffer_append (&boot.output, (const byte *) "", 1);
+	  start = (byte *) strstr ((const char *) boot.output.data, marker);
+	}
+
+      if (NULL == start)
+	{
+	  printf ("The codex did not dump the UMIX image (wrong key?)\n");
+	  free (boot.output.data);
+	  fclose (sampler.csv);
+	  return 1;
+	}
+
+      start += strlen (marker);
+      buffer_append (&umix
+		     , start
+		     , (boot.output.size - 1 - (start - boot.output.data)) & ~(size_t) 3);
+      free (boot.output.data);
+
+      if (NULL != save_path)
+	{
+	  FILE * f = fopen (save_path, "wb");
+	  if (NULL != f)
+	    {
+	      fwrite (umix.data, 1, umix.size, f);
+	      fclose (f);
+	    }
+	}
+    }
+
+  if (0 == sampler.duration || now () - sampler.start < sampler.duration)
+    {
+      s.repeats = repeats;
+      buffer_append (&s.prologue, (const byte *) login, strlen (login));
+      buffer_append (&s.prologue, (const byte *) "\n", 1);
+
+      printf ("running UMIX, %lu byte image\n", (unsigned long) umix.size);
+
+      if (0 != gc_threshold)
+	{
+	  um_gc_enable (&s.machine, gc_threshold);
+	}
+
+      um_load (&s.machine, umix.data, umix.size);
+      status = soak (&s, &sampler, "umix");
+    }
+
+  printf ("%llu instructions, %llu script rounds, %llu live arrays, peak heap %llu bytes\n"
+	  , s.machine.stats.instructions
+	  , (unsigned long long) s.sent
+	  , s.machine.stats.live_arrays
+	  , s.machine.stats.peak_heap_bytes);
+
+  if (NULL != s.machine.gc)
+    {
+      um_gc_report (stdout, &s.machine);
+      um_gc_disable (&s.machine);
+    }
+
+  um_release (&s.machine);
+  free (umix.data);
+  free (s.prologue.data);
+  free (s.script.data);
+
+  if (NULL != s.transcript)
+    {
+      fclose (s.transcript);
+    }
+  fclose (sampler.csv);
+
+  return UM_STATUS_FAILED == status ? 2 : 0;
+}
@@ -0,0 +1,506 @@
+// umbench : runs UM images (sandmark.umz by default) under every
+// execution engine and reports throughput, memory and allocation counts
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../um.h"
+
+#if ! defined(EOK)
+#define EOK 0
+#endif
+
+
+typedef enum BENCH_CONSTANTS
+  {
+    BENCH_MAX_TRIALS = 64,
+    BENCH_MAX_BASELINES = 128,
+    BENCH_NAME_SIZE = 64,
+
+  } BENCH_CONSTANTS;
+
+
+typedef struct trial_t
+{
+  int ok;
+  double seconds;
+  long peak_rss_kb;
+  um_stats_t stats;
+
+} trial_t;
+
+
+typedef struct result_t
+{
+  char image [BENCH_NAME_SIZE];
+  char engine [BENCH_NAME_SIZE];
+
+  double median_seconds;
+  double min_seconds;
+  double minstr_per_second;
+  long peak_rss_kb;
+  unsigned long long allocations;
+  unsigned long long abandonments;
+
+} result_t;
+
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char * basename_of (const char * path)
+{
+  const char * s = strrchr (path, '/');
+  return NULL == s ? path : s + 1;
+}
+
+/**
+ * Runs the image once in a child process, so that every trial starts
+ * from a fresh heap and gets its own peak RSS.
+ */
+static trial_t run_trial (um_engine_t engine, byte * image, size_t size)
+{
+  trial_t t = { 0 };
+  int fds [2];
+  pid_t pid;
+
+  if (0 != pipe (fds))
+    {
+      return t;
+    }
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      close (fds[0]);
+      close (fds[1]);
+      return t;
+    }
+
+  if (0 == pid)
+    {
+      um_t machine;
+      double start = 0;
+      int devnull = open ("/dev/null", O_RDWR);
+
+      memset (&machine, 0, sizeof(machine));
+
+      close (fds[0]);
+      dup2 (devnull, STDIN_FILENO);
+      dup2 (devnull, STDOUT_FILENO);
+
+      start = now ();
+      um_run_with_engine (&machine, engine, image, size);
+      t.seconds = now () - start;
+      t.stats = machine.stats;
+      t.ok = 1;
+
+      write (fds[1], &t, sizeof(t));
+      _exit (0);
+    }
+
+  close (fds[1]);
+
+  {
+    int status = 0;
+    struct rusage usage;
+    trial_t r = { 0 };
+
+    if (sizeof(r) == read (fds[0], &r, sizeof(r)))
+      {
+	t = r;
+      }
+    close (fds[0]);
+
+    if (pid == wait4 (pid, &status, 0, &usage))
+      {
+	t.peak_rss_kb = usage.ru_maxrss;
+	t.ok = t.ok && WIFEXITED (status) && 0 == WEXITSTATUS (status);
+      }
+    else
+      {
+	t.ok = 0;
+      }
+  }
+
+  return t;
+}
+
+static int compare_trials (const void * a, const void * b)
+{
+  double x = ((const trial_t *) a)->seconds;
+  double y = ((const trial_t *) b)->seconds;
+  return x < y ? -1 : x > y;
+}
+
+static int run_engine (result_t * result
+		       , const char * path
+		       , um_engine_t engine
+		       , byte * image
+		       , size_t size
+		       , int warmups
+		       , int trials)
+{
+  trial_t runs [BENCH_MAX_TRIALS];
+  int i = 0;
+
+  memset (result, 0, sizeof(*result));
+  snprintf (result->image, sizeof(result->image), "%s", basename_of (path));
+  snprintf (result->engine, sizeof(result->engine), "%s", um_engine_name (engine));
+
+  for (i = 0; i < warmups; ++i)
+    {
+      run_trial (engine, image, size);
+    }
+
+  for (i = 0; i < trials; ++i)
+    {
+      runs[i] = run_trial (engine, image, size);
+      if ( ! runs[i].ok)
+	{
+	  printf ("%s/%s: trial %d failed\n", result->image, result->engine, i);
+	  return EINVAL;
+	}
+
+      printf ("%s/%s: trial %d: %.3fs, %llu instructions\n"
+	      , result->image
+	      , result->engine
+	      , i
+	      , runs[i].seconds
+	      , runs[i].stats.instructions);
+    }
+
+  qsort (runs, trials, sizeof(runs[0]), compare_trials);
+
+  result->min_seconds = runs[0].seconds;
+  result->median_seconds = runs[trials / 2].seconds;
+  result->minstr_per_second = runs[trials / 2].stats.instructions / result->median_seconds / 1e6;
+  result->allocations = runs[trials / 2].stats.allocations;
+  result->abandonments = runs[trials / 2].stats.abandonments;
+
+  for (i = 0; i < trials; ++i)
+    {
+      if (runs[i].peak_rss_kb > result->peak_rss_kb)
+	{
+	  result->peak_rss_kb = runs[i].peak_rss_kb;
+	}
+    }
+
+  return EOK;
+}
+
+static int load_baseline (const char * path, result_t * baselines, size_t * count)
+{
+  FILE * f = fopen (path, "r");
+  char line [256];
+
+  *count = 0;
+
+  if (NULL == f)
+    {
+      return errno;
+    }
+
+  while (*count < BENCH_MAX_BASELINES && fgets (line, sizeof(line), f))
+    {
+      result_t * r = &baselines[*count];
+
+      if ('#' == line[0])
+	{
+	  continue;
+	}
+
+      if (7 == sscanf (line
+		       , "%63s %63s %lf %lf %ld %llu %llu"
+		       , r->image
+		       , r->engine
+		       , &r->median_seconds
+		       , &r->minstr_per_second
+		       , &r->peak_rss_kb
+		       , &r->allocations
+		       , &r->abandonments))
+	{
+	  (*count)++;
+	}
+    }
+
+  fclose (f);
+
+  return EOK;
+}
+
+static int save_baseline (const char * path, const result_t * results, size_t count)
+{
+  FILE * f = fopen (path, "w");
+  size_t i = 0;
+
+  if (NULL == f)
+    {
+      return errno;
+    }
+
+  fprintf (f, "# image engine median_seconds minstr_per_second peak_rss_kb allocations abandonments\n");
+  for (i = 0; i < count; ++i)
+    {
+      fprintf (f
+	       , "%s %s %.6f %.3f %ld %llu %llu\n"
+	       , results[i].image
+	       , results[i].engine
+	       , results[i].median_seconds
+	       , results[i].minstr_per_second
+	       , results[i].peak_rss_kb
+	       , results[i].allocations
+	       , results[i].abandonments);
+    }
+
+  fclose (f);
+
+  return EOK;
+}
+
+/**
+ * @return 1 when the count exceeds the baseline by more than the tolerance
+ */
+static int count_regressed (const result_t * r
+			    , const char * what
+			    , unsigned long long count
+			    , unsigned long long baseline
+			    , double tolerance)
+{
+  if (count <= baseline * (1 + tolerance))
+    {
+      return 0;
+    }
+
+  printf ("REGRESSION %s/%s: %llu %s, baseline %llu\n"
+	  , r->image, r->engine, count, what, baseline);
+
+  return 1;
+}
+
+/**
+ *
+ * @param tolerance of the allocation and abandonment counts, which
+ * should not change from a run to the next
+ * @return the number of regressions
+ */
+static int compare_with_baseline (const result_t * r
+				  , const result_t * baselines
+				  , size_t count
+				  , double threshold
+				  , double tolerance)
+{
+  size_t i = 0;
+
+  for (i = 0; i < count; ++i)
+    {
+      const result_t * b = &baselines[i];
+      int regressions = 0;
+
+      if (0 != strcmp (b->image, r->image) || 0 != strcmp (b->engine, r->engine))
+	{
+	  continue;
+	}
+
+      if (r->median_seconds > b->median_seconds * (1 + threshold))
+	{
+	  printf ("REGRESSION %s/%s: time %.3fs, baseline %.3fs (+%.1f%%)\n"
+		  , r->image, r->engine, r->median_seconds, b->median_seconds
+		  , 100 * (r->median_seconds / b->median_seconds - 1));
+	  regressions++;
+	}
+
+      if (r->peak_rss_kb > b->peak_rss_kb * (1 + threshold))
+	{
+	  printf ("REGRESSION %s/%s: peak RSS %ldkB, baseline %ldkB\n"
+		  , r->image, r->engine, r->peak_rss_kb, b->peak_rss_kb);
+	  regressions++;
+	}
+
+      regressions += count_regressed (r, "allocations", r->allocations, b->allocations, tolerance);
+      regressions += count_regressed (r, "abandonments", r->abandonments, b->abandonments, tolerance);
+
+      return regressions;
+    }
+
+  printf ("%s/%s: no baseline\n", r->image, r->engine);
+
+  return 0;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-w warmups] [-n trials] [-e engine] [-b baseline]\n"
+	  "\t[-s save-baseline] [-t threshold-percent] [-a allocation-percent]\n"
+	  "\t[image ...]\n"
+	  , name);
+}
+
+int main (int argc, char ** argv)
+{
+  const char * images [BENCH_MAX_BASELINES];
+  size_t image_count = 0;
+  const char * baseline = NULL;
+  const char * save = NULL;
+  const char * only_engine = NULL;
+  int warmups = 1;
+  int trials = 3;
+  double threshold = 0.10;
+  double tolerance = 0.01;
+
+  result_t results [BENCH_MAX_BASELINES];
+  size_t result_count = 0;
+  int regressions = 0;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-w") && i + 1 < argc)
+	  {
+	    warmups = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-n") && i + 1 < argc)
+	  {
+	    trials = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-e") && i + 1 < argc)
+	  {
+	    only_engine = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-b") && i + 1 < argc)
+	  {
+	    baseline = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-s") && i + 1 < argc)
+	  {
+	    save = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-t") && i + 1 < argc)
+	  {
+	    threshold = atof (argv[++i]) / 100;
+	  }
+	else if (0 == strcmp (argv[i], "-a") && i + 1 < argc)
+	  {
+	    tolerance = atof (argv[++i]) / 100;
+	  }
+	else if ('-' == argv[i][0])
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+	else if (image_count < BENCH_MAX_BASELINES)
+	  {
+	    images[image_count++] = argv[i];
+	  }
+      }
+  }
+
+  if (0 == image_count)
+    {
+      images[image_count++] = "../data/sandmark.umz";
+    }
+
+  if (trials < 1 || trials > BENCH_MAX_TRIALS)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  {
+    size_t i = 0;
+    for (i = 0; i < image_count; ++i)
+      {
+	byte * image = NULL;
+	size_t size = 0;
+	um_engine_t engine;
+
+	if (EOK != um_load_image (images[i], &image, &size))
+	  {
+	    printf ("Could not open the codex file %s\n", images[i]);
+	    return 1;
+	  }
+
+	for (engine = 0; engine < UM_ENGINE_COUNT && result_count < BENCH_MAX_BASELINES; ++engine)
+	  {
+	    if (NULL != only_engine && 0 != strcmp (only_engine, um_engine_name (engine)))
+	      {
+		continue;
+	      }
+
+	    if (EOK == run_engine (&results[result_count]
+				   , images[i]
+				   , engine
+				   , image
+				   , size
+				   , warmups
+				   , trials))
+	      {
+		result_count++;
+	      }
+	  }
+
+	free (image);
+      }
+  }
+
+  printf ("\n%-16s %-16s %10s %10s %12s %12s %12s %12s\n"
+	  , "image", "engine", "median(s)", "min(s)", "Minstr/s", "peak RSS kB", "allocations"
+	  , "abandonments");
+
+  {
+    size_t i = 0;
+    for (i = 0; i < result_count; ++i)
+      {
+	printf ("%-16s %-16s %10.3f %10.3f %12.2f %12ld %12llu %12llu\n"
+		, results[i].image
+		, results[i].engine
+		, results[i].median_seconds
+		, results[i].min_seconds
+		, results[i].minstr_per_second
+		, results[i].peak_rss_kb
+		, results[i].allocations
+		, results[i].abandonments);
+      }
+  }
+
+  if (NULL != baseline)
+    {
+      result_t baselines [BENCH_MAX_BASELINES];
+      size_t count = 0;
+      size_t i = 0;
+
+      if (EOK != load_baseline (baseline, baselines, &count))
+	{
+	  printf ("Could not read the baseline %s\n", baseline);
+	  return 1;
+	}
+
+      for (i = 0; i < result_count; ++i)
+	{
+	  regressions += compare_with_baseline (&results[i], baselines, count, threshold, tolerance);
+	}
+    }
+
+  if (NULL != save && EOK != save_baseline (save, results, result_count))
+    {
+      printf ("Could not write the baseline %s\n", save);
+      return 1;
+    }
+
+  return 0 == regressions ? 0 : 2;
+}
@@ -0,0 +1,895 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "um_priv.h"
+#include "intrinsic.h"
+#include "checkpoint.h"
+
+
+typedef enum CHECKPOINT_CONSTANTS
+  {
+    CHECKPOINT_VERSION = 2,
+
+    // arrays from that many platters get a bit per page (dirty_pages)
+    CHECKPOINT_PAGED_ARRAY = 16 << DIRTY_PAGE_SHIFT,
+
+    // the log is compacted once it is that many times the size of its
+    // full checkpoint
+    CHECKPOINT_COMPACTION_FACTOR = 4,
+
+    // bytes hashed at once when the log is validated
+    CHECKPOINT_CHUNK = 1 << 18,
+
+  } CHECKPOINT_CONSTANTS;
+
+
+static const char CHECKPOINT_MAGIC [4] = { 'U', 'M', 'C', 'K' };
+
+
+typedef struct checkpoint_header_t
+{
+  char magic[4];
+  unsigned int version;
+
+} checkpoint_header_t;
+
+typedef enum checkpoint_kind_t
+  {
+    CHECKPOINT_FULL = 1,
+    CHECKPOINT_DELTA = 2,
+
+  } checkpoint_kind_t;
+
+// every checkpoint is a frame, whose header is written again once the
+// rest is: the machine, then records up to RECORD_END
+typedef struct checkpoint_frame_t
+{
+  unsigned int kind;
+  unsigned int reserved;
+
+  // bytes after the header, and their hash
+  unsigned long long size;
+  unsigned long long hash;
+
+} checkpoint_frame_t;
+
+typedef struct checkpoint_machine_t
+{
+  platter_t registers[UM_REGISTER_COUNT];
+  address_t ip;
+  platter_t next_array_id;
+  unsigned long long instructions;
+
+} checkpoint_machine_t;
+
+typedef enum checkpoint_record_kind_t
+  {
+    RECORD_END,
+
+    // the size platters of the array follow
+    RECORD_ARRAY,
+
+    // count pages of the array follow, each one its index then its
+    // platters
+    RECORD_PAGES,
+
+    RECORD_RELEASE,
+
+    // the count free ids follow, in the order they are given again
+    RECORD_FREE_IDS,
+
+  } checkpoint_record_kind_t;
+
+typedef struct checkpoint_record_t
+{
+  unsigned int kind;
+  ArrayCellId id;
+  platter_t size;
+  platter_t count;
+
+} checkpoint_record_t;
+
+
+struct um_checkpoint_t
+{
+  struct um_t * machine;
+  char * path;
+  FILE * file;
+
+  // frame being written: where its header is, size and hash of the rest
+  long frame_at;
+  unsigned long long frame_size;
+  unsigned long long hash;
+
+  // ids of the arrays of the log released since the previous checkpoint,
+  // at most one per array of the log
+  platter_t * released;
+  size_t released_count;
+  size_t released_capacity;
+
+  // size of the full checkpoint the log starts with
+  unsigned long long full_bytes;
+
+  // a checkpoint could not be written, the next one is a full one
+  int broken;
+
+  um_checkpoint_stats_t stats;
+};
+
+
+static unsigned long long checkpoint_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static platter_t checkpoint_priv_page_count (const ArrayCell * cell)
+{
+  return ((unsigned long long) cell->datasize + (1 << DIRTY_PAGE_SHIFT) - 1) >> DIRTY_PAGE_SHIFT;
+}
+
+static platter_t checkpoint_priv_page_size (const ArrayCell * cell, platter_t page)
+{
+  const platter_t offset = page << DIRTY_PAGE_SHIFT;
+  const platter_t left = cell->datasize - offset;
+
+  return left < (1 << DIRTY_PAGE_SHIFT) ? left : (1 << DIRTY_PAGE_SHIFT);
+}
+
+
+//////////////////////////////////////
+// writing
+//////////////////////////////////////
+
+static void checkpoint_priv_write (um_checkpoint_t * c, const void * data, size_t size)
+{
+  // the errors are checked once, at the end of the frame
+  fwrite (data, 1, size, c->file);
+
+  c->hash = um_priv_fnv1a (c->hash, data, size);
+  c->frame_size += size;
+}
+
+static void checkpoint_priv_begin (um_checkpoint_t * c, checkpoint_kind_t kind)
+{
+  const struct um_t * machine = c->machine;
+  checkpoint_frame_t frame;
+  checkpoint_machine_t m;
+
+  memset (&frame, 0, sizeof(frame));
+  frame.kind = kind;
+
+  c->frame_at = ftell (c->file);
+  fwrite (&frame, sizeof(frame), 1, c->file);
+
+  c->frame_size = 0;
+  c->hash = UM_PRIV_FNV1A_BASIS;
+
+  memset (&m, 0, sizeof(m));
+  memcpy (m.registers, machine->registers, sizeof(m.registers));
+  m.ip = machine->ip;
+  m.next_array_id = machine->next_array_id;
+  m.instructions = machine->stats.instructions;
+
+  checkpoint_priv_write (c, &m, sizeof(m));
+}
+
+/**
+ * Writes the free ids of the machine, which a restored machine gives in
+ * the same order.
+ */
+static void checkpoint_priv_write_free_ids (um_checkpoint_t * c)
+{
+  const ArrayTable * t = (const ArrayTable *) c->machine->arrays;
+  checkpoint_record_t r;
+  ArrayCellId id = 0;
+
+  memset (&r, 0, sizeof(r));
+  r.kind = RECORD_FREE_IDS;
+
+  for (id = t->free_ids; 0 != id; id = t->slots[id].next_free)
+    {
+      r.count++;
+    }
+
+  checkpoint_priv_write (c, &r, sizeof(r));
+
+  for (id = t->free_ids; 0 != id; id = t->slots[id].next_free)
+    {
+      checkpoint_priv_write (c, &id, sizeof(id));
+    }
+}
+
+static int checkpoint_priv_end (um_checkpoint_t * c, checkpoint_kind_t kind)
+{
+  checkpoint_record_t end;
+  checkpoint_frame_t frame;
+
+  checkpoint_priv_write_free_ids (c);
+
+  memset (&end, 0, sizeof(end));
+  end.kind = RECORD_END;
+  checkpoint_priv_write (c, &end, sizeof(end));
+
+  memset (&frame, 0, sizeof(frame));
+  frame.kind = kind;
+  frame.size = c->frame_size;
+  frame.hash = c->hash;
+
+  // the frame is complete once its header is, on disk
+  if (0 != fflush (c->file)
+      || 0 != fseek (c->file, c->frame_at, SEEK_SET)
+      || 1 != fwrite (&frame, sizeof(frame), 1, c->file)
+      || 0 != fseek (c->file, 0, SEEK_END)
+      || 0 != fflush (c->file)
+      || 0 != fdatasync (fileno (c->file))
+      || ferror (c->file))
+    {
+      return 0 != errno ? errno : EIO;
+    }
+
+  c->stats.bytes += sizeof(frame) + c->frame_size;
+  c->stats.log_bytes = ftell (c->file);
+
+  return EOK;
+}
+
+static void checkpoint_priv_write_array (um_checkpoint_t * c, ArrayCell * cell)
+{
+  checkpoint_record_t r;
+
+  memset (&r, 0, sizeof(r));
+  r.kind = RECORD_ARRAY;
+  r.id = cell->id;
+  r.size = cell->datasize;
+
+  checkpoint_priv_write (c, &r, sizeof(r));
+  checkpoint_priv_write (c, cell->data, (size_t) cell->datasize * sizeof(platter_t));
+
+  c->stats.arrays++;
+
+  // from now on, only the pages written of a large array are
+  if (NULL != cell->dirty_pages)
+    {
+      memset (cell->dirty_pages, 0, (checkpoint_priv_page_count (cell) + 7) / 8);
+    }
+  else if (cell->datasize >= CHECKPOINT_PAGED_ARRAY)
+    {
+      cell->dirty_pages = (byte *) calloc ((checkpoint_priv_page_count (cell) + 7) / 8, 1);
+    }
+
+  cell->dirty = DIRTY_NONE;
+  cell->checkpointed = 1;
+}
+
+static void checkpoint_priv_write_pages (um_checkpoint_t * c, ArrayCell * cell)
+{
+  const size_t bytes = (checkpoint_priv_page_count (cell) + 7) / 8;
+  checkpoint_record_t r;
+  size_t i = 0;
+
+  memset (&r, 0, sizeof(r));
+  r.kind = RECORD_PAGES;
+  r.id = cell->id;
+  r.size = cell->datasize;
+
+  for (i = 0; i < bytes; ++i)
+    {
+      r.count += __builtin_popcount (cell->dirty_pages [i]);
+    }
+
+  checkpoint_priv_write (c, &r, sizeof(r));
+
+  for (i = 0; i < bytes; ++i)
+    {
+      byte bits = cell->dirty_pages [i];
+
+      while (0 != bits)
+	{
+	  const platter_t page = i * 8 + __builtin_ctz (bits);
+
+	  checkpoint_priv_write (c, &page, sizeof(page));
+	  checkpoint_priv_write (c
+				 , cell->data + ((size_t) page << DIRTY_PAGE_SHIFT)
+				 , (size_t) checkpoint_priv_page_size (cell, page) * sizeof(platter_t));
+
+	  bits &= bits - 1;
+	}
+
+      cell->dirty_pages [i] = 0;
+    }
+
+  c->stats.pages += r.count;
+  cell->dirty = DIRTY_NONE;
+}
+
+static int checkpoint_priv_write_delta (um_checkpoint_t * c)
+{
+  ArrayCell * cell = NULL;
+  checkpoint_record_t r;
+  size_t i = 0;
+
+  checkpoint_priv_begin (c, CHECKPOINT_DELTA);
+
+  // released first, an id may be given again to an array created since
+  memset (&r, 0, sizeof(r));
+  r.kind = RECORD_RELEASE;
+  for (i = 0; i < c->released_count; ++i)
+    {
+      r.id = c->released [i];
+      checkpoint_priv_write (c, &r, sizeof(r));
+    }
+  c->stats.releases += c->released_count;
+
+  for (cell = um_priv_cell_from (c->machine, 0); NULL != cell; cell = um_priv_cell_from (c->machine, cell->id + 1))
+    {
+      if (DIRTY_ALL == cell->dirty)
+	{
+	  checkpoint_priv_write_array (c, cell);
+	}
+      else if (DIRTY_PAGES == cell->dirty)
+	{
+	  checkpoint_priv_write_pages (c, cell);
+	}
+    }
+
+  c->released_count = 0;
+
+  return checkpoint_priv_end (c, CHECKPOINT_DELTA);
+}
+
+
+//////////////////////////////////////
+// restoring
+//////////////////////////////////////
+
+/**
+ * @return the offset of the end of the last complete frame, 0 when the
+ * first frame is not a complete full checkpoint
+ */
+static long checkpoint_priv_validate (FILE * f)
+{
+  long valid = 0;
+  byte * chunk = (byte *) malloc (CHECKPOINT_CHUNK);
+
+  if (NULL == chunk)
+    {
+      return 0;
+    }
+
+  for (;;)
+    {
+      checkpoint_frame_t frame;
+      unsigned long long left = 0;
+      unsigned long long h = UM_PRIV_FNV1A_BASIS;
+
+      if (1 != fread (&frame, sizeof(frame), 1, f)
+	  || (CHECKPOINT_FULL != frame.kind && CHECKPOINT_DELTA != frame.kind)
+	  || (0 == valid && CHECKPOINT_FULL != frame.kind)
+	  || 0 != frame.size % sizeof(platter_t))
+	{
+	  break;
+	}
+
+      for (left = frame.size; left > 0; )
+	{
+	  const size_t n = left < CHECKPOINT_CHUNK ? left : CHECKPOINT_CHUNK;
+
+	  if (n != fread (chunk, 1, n, f))
+	    {
+	      break;
+	    }
+
+	  h = um_priv_fnv1a (h, chunk, n);
+	  left -= n;
+	}
+
+      if (0 != left || h != frame.hash)
+	{
+	  break;
+	}
+
+      valid = ftell (f);
+    }
+
+  free (chunk);
+
+  return valid;
+}
+
+/**
+ * Reads count platters to a new array, which keeps the pages of zeros it
+ * is mapped with.
+ */
+static int checkpoint_priv_read_sparse (FILE * f, platter_t * to, platter_t count)
+{
+  platter_t page [1 << DIRTY_PAGE_SHIFT];
+  platter_t i = 0;
+
+  for (i = 0; i < count; i += 1 << DIRTY_PAGE_SHIFT)
+    {
+      const platter_t n = count - i < (1 << DIRTY_PAGE_SHIFT) ? count - i : (1 << DIRTY_PAGE_SHIFT);
+
+      if (n != fread (page, sizeof(platter_t), n, f))
+	{
+	  return EIO;
+	}
+
+      um_priv_copy_nonzero (to + i, page, n);
+    }
+
+  return EOK;
+}
+
+static void checkpoint_priv_unlink (struct um_t * machine, ArrayCellId id)
+{
+  ArrayCell * cell = um_priv_search_for_cell_id (machine, id);
+
+  if (NULL != cell)
+    {
+      um_priv_remove_array_cell (machine, cell);
+      um_priv_release_array_cell (machine, cell);
+    }
+}
+
+/**
+ * Replaces the free ids of the machine with the count ones that follow,
+ * the ids released or created while the frame is applied leave them
+ * inconsistent until then.
+ */
+static int checkpoint_priv_read_free_ids (FILE * f, struct um_t * machine, platter_t count)
+{
+  ArrayTable * t = (ArrayTable *) machine->arrays;
+  platter_t * ids = NULL;
+  platter_t i = 0;
+  int err = EOK;
+
+  if (NULL == t)
+    {
+      return EINVAL;
+    }
+
+  ids = (platter_t *) malloc (((size_t) count + 1) * sizeof(platter_t));
+  if (NULL == ids)
+    {
+      return ENOMEM;
+    }
+
+  if (count != fread (ids, sizeof(platter_t), count, f))
+    {
+      free (ids);
+      return EIO;
+    }
+
+  // pushed from the last one given
+  t->free_ids = 0;
+  for (i = count; i > 0 && EOK == err; --i)
+    {
+      err = um_priv_release_array_id (machine, ids [i - 1]);
+    }
+
+  free (ids);
+
+  return err;
+}
+
+static int checkpoint_priv_apply (FILE * f, struct um_t * machine)
+{
+  checkpoint_frame_t frame;
+  checkpoint_machine_t m;
+
+  if (1 != fread (&frame, sizeof(frame), 1, f)
+      || 1 != fread (&m, sizeof(m), 1, f))
+    {
+      return EIO;
+    }
+
+  if (CHECKPOINT_FULL == frame.kind)
+    {
+      um_release (machine);
+    }
+
+  memcpy (machine->registers, m.registers, sizeof(machine->registers));
+  machine->ip = m.ip;
+  machine->next_array_id = m.next_array_id;
+  machine->stats.instructions = m.instructions;
+
+  for (;;)
+    {
+      checkpoint_record_t r;
+      ArrayCell * cell = NULL;
+
+      if (1 != fread (&r, sizeof(r), 1, f))
+	{
+	  return EIO;
+	}
+
+      switch (r.kind)
+	{
+	case RECORD_END:
+	  return EOK;
+
+	case RECORD_RELEASE:
+	  checkpoint_priv_unlink (machine, r.id);
+	  break;
+
+	case RECORD_FREE_IDS:
+	  if (EOK != checkpoint_priv_read_free_ids (f, machine, r.count))
+	    {
+	      return EINVAL;
+	    }
+	  break;
+
+	case RECORD_ARRAY:
+	  // a full checkpoint starts from no array
+	  if (CHECKPOINT_DELTA == frame.kind)
+	    {
+	      cell = um_priv_search_for_cell_id (machine, r.id);
+	    }
+
+	  if (NULL != cell && cell->datasize != r.size)
+	    {
+	      checkpoint_priv_unlink (machine, r.id);
+	      cell = NULL;
+	    }
+
+	  if (NULL == cell)
+	    {
+	      cell = um_priv_create_array_cell (machine, r.id, r.size);
+	      if (NULL == cell)
+		{
+		  return ENOMEM;
+		}
+	      if (EOK != um_priv_insert_array_cell (machine, cell))
+		{
+		  um_priv_release_array_cell (machine, cell);
+		  return ENOMEM;
+		}
+
+	      if (EOK != checkpoint_priv_read_sparse (f, cell->data, r.size))
+		{
+		  return EIO;
+		}
+	    }
+	  else if (r.size != fread (cell->data, sizeof(platter_t), r.size, f))
+	    {
+	      return EIO;
+	    }
+	  break;
+
+	case RECORD_PAGES:
+	  cell = um_priv_search_for_cell_id (machine, r.id);
+	  if (NULL == cell || cell->datasize != r.size)
+	    {
+	      return EINVAL;
+	    }
+
+	  for (; r.count > 0; --r.count)
+	    {
+	      platter_t page = 0;
+	      platter_t n = 0;
+
+	      if (1 != fread (&page, sizeof(page), 1, f))
+		{
+		  return EIO;
+		}
+	      if (page >= checkpoint_priv_page_count (cell))
+		{
+		  return EINVAL;
+		}
+
+	      n = checkpoint_priv_page_size (cell, page);
+	      if (n != fread (cell->data + ((size_t) page << DIRTY_PAGE_SHIFT), sizeof(platter_t), n, f))
+		{
+		  return EIO;
+		}
+	    }
+	  break;
+
+	default:
+	  return EINVAL;
+	}
+    }
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_checkpoint_open (um_checkpoint_t ** checkpoint
+			, const char * path
+			, struct um_t * machine)
+{
+  um_checkpoint_t * c = NULL;
+  int err = EOK;
+
+  if (NULL == checkpoint || NULL == path || NULL == machine || NULL == machine->arrays)
+    {
+      return EINVAL;
+    }
+
+  if (NULL != machine->checkpoint)
+    {
+      return EBUSY;
+    }
+
+  c = (um_checkpoint_t *) calloc (1, sizeof(um_checkpoint_t));
+  if (NULL == c || NULL == (c->path = strdup (path)))
+    {
+      free (c);
+      return ENOMEM;
+    }
+
+  c->machine = machine;
+
+  // the arrays are flagged from the base on
+  err = um_checkpoint_compact (c);
+  if (EOK != err)
+    {
+      free (c->path);
+      free (c);
+      return err;
+    }
+
+  machine->checkpoint = c;
+
+  *checkpoint = c;
+
+  return EOK;
+}
+
+int um_checkpoint_compact (um_checkpoint_t * checkpoint)
+{
+  const size_t length = NULL != checkpoint ? strlen (checkpoint->path) : 0;
+  FILE * previous = NULL;
+  char * tmp = NULL;
+  ArrayCell * cell = NULL;
+  checkpoint_header_t h;
+  int err = EOK;
+
+  if (NULL == checkpoint)
+    {
+      return EINVAL;
+    }
+
+  // written aside, the log is replaced once it is complete
+  tmp = (char *) malloc (length + sizeof(".tmp"));
+  if (NULL == tmp)
+    {
+      return ENOMEM;
+    }
+  memcpy (tmp, checkpoint->path, length);
+  memcpy (tmp + length, ".tmp", sizeof(".tmp"));
+
+  previous = checkpoint->file;
+  checkpoint->file = fopen (tmp, "wb");
+  if (NULL == checkpoint->file)
+    {
+      err = errno;
+      checkpoint->file = previous;
+      free (tmp);
+      return err;
+    }
+
+  memset (&h, 0, sizeof(h));
+  memcpy (h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.version = CHECKPOINT_VERSION;
+  fwrite (&h, sizeof(h), 1, checkpoint->file);
+
+  checkpoint_priv_begin (checkpoint, CHECKPOINT_FULL);
+  for (cell = um_priv_cell_from (checkpoint->machine, 0); NULL != cell; cell = um_priv_cell_from (checkpoint->machine, cell->id + 1))
+    {
+      checkpoint_priv_write_array (checkpoint, cell);
+    }
+  err = checkpoint_priv_end (checkpoint, CHECKPOINT_FULL);
+
+  if (EOK == err && 0 != rename (tmp, checkpoint->path))
+    {
+      err = errno;
+    }
+
+  if (EOK != err)
+    {
+      fclose (checkpoint->file);
+      remove (tmp);
+      checkpoint->file = previous;
+      checkpoint->broken = 1;
+      free (tmp);
+      return err;
+    }
+
+  if (NULL != previous)
+    {
+      fclose (previous);
+    }
+  free (tmp);
+
+  checkpoint->released_count = 0;
+  checkpoint->broken = 0;
+  checkpoint->full_bytes = checkpoint->stats.log_bytes;
+  checkpoint->stats.compactions++;
+
+  return EOK;
+}
+
+int um_checkpoint_take (um_checkpoint_t * checkpoint)
+{
+  const unsigned long long start = checkpoint_now_ns ();
+  unsigned long long pause = 0;
+  int err = EOK;
+
+  if (NULL == checkpoint)
+    {
+      return EINVAL;
+    }
+
+  if (checkpoint->broken)
+    {
+      err = um_checkpoint_compact (checkpoint);
+    }
+  else
+    {
+      err = checkpoint_priv_write_delta (checkpoint);
+
+      if (EOK != err)
+	{
+	  // the flags were cleared, what was not written is lost
+	  checkpoint->broken = 1;
+	}
+      else
+	{
+	  checkpoint->stats.checkpoints++;
+
+	  if (checkpoint->stats.log_bytes > CHECKPOINT_COMPACTION_FACTOR * checkpoint->full_bytes)
+	    {
+	      err = um_checkpoint_compact (checkpoint);
+	    }
+	}
+    }
+
+  pause = checkpoint_now_ns () - start;
+  checkpoint->stats.pause_ns += pause;
+  if (pause > checkpoint->stats.max_pause_ns)
+    {
+      checkpoint->stats.max_pause_ns = pause;
+    }
+
+  return err;
+}
+
+int um_checkpoint_close (um_checkpoint_t * checkpoint)
+{
+  if (NULL == checkpoint)
+    {
+      return EINVAL;
+    }
+
+  checkpoint->machine->checkpoint = NULL;
+
+  if (NULL != checkpoint->file)
+    {
+      fclose (checkpoint->file);
+    }
+
+  free (checkpoint->released);
+  free (checkpoint->path);
+  free (checkpoint);
+
+  return EOK;
+}
+
+int um_checkpoint_restore (const char * path
+			   , struct um_t * machine)
+{
+  checkpoint_header_t h;
+  FILE * f = NULL;
+  long valid = 0;
+  int err = EOK;
+
+  if (NULL == path || NULL == machine)
+    {
+      return EINVAL;
+    }
+
+  if (NULL != machine->arrays)
+    {
+      return EBUSY;
+    }
+
+  f = fopen (path, "rb");
+  if (NULL == f)
+    {
+      return errno;
+    }
+
+  if (1 != fread (&h, sizeof(h), 1, f)
+      || 0 != memcmp (h.magic, CHECKPOINT_MAGIC, sizeof(h.magic))
+      || CHECKPOINT_VERSION != h.version
+      || 0 == (valid = checkpoint_priv_validate (f)))
+    {
+      fclose (f);
+      return EINVAL;
+    }
+
+  memset (&machine->stats, 0, sizeof(machine->stats));
+
+  fseek (f, sizeof(h), SEEK_SET);
+  while (EOK == err && ftell (f) < valid)
+    {
+      err = checkpoint_priv_apply (f, machine);
+    }
+
+  fclose (f);
+
+  if (EOK != err)
+    {
+      um_release (machine);
+      return err;
+    }
+
+  machine->status = UM_STATUS_RUNNING;
+  machine->failure = NULL;
+
+  if (NULL != machine->intrinsics)
+    {
+      um_intrinsics_reload (machine->intrinsics);
+    }
+
+  return EOK;
+}
+
+void um_checkpoint_released (void * checkpoint
+			     , struct um_t * machine
+			     , platter_t id)
+{
+  um_checkpoint_t * c = (um_checkpoint_t *) checkpoint;
+
+  if (c->released_count == c->released_capacity)
+    {
+      const size_t capacity = 0 == c->released_capacity ? 1024 : 2 * c->released_capacity;
+      platter_t * released = (platter_t *) realloc (c->released, capacity * sizeof(platter_t));
+
+      if (NULL == released)
+	{
+	  // not recorded, the next checkpoint is a full one
+	  c->broken = 1;
+	  return;
+	}
+
+      c->released = released;
+      c->released_capacity = capacity;
+    }
+
+  c->released [c->released_count++] = id;
+}
+
+void um_checkpoint_get_stats (um_checkpoint_t * checkpoint
+			      , um_checkpoint_stats_t * stats)
+{
+  *stats = checkpoint->stats;
+}
+
+void um_checkpoint_report (FILE * out
+			   , um_checkpoint_t * checkpoint)
+{
+  const um_checkpoint_stats_t * s = &checkpoint->stats;
+
+  fprintf (out
+	   , "checkpoint: %llu deltas, %llu full, %llu arrays / %llu pages / %llu releases"
+	   ", %llu bytes written, log %llu bytes, pauses %.3fms total, %.3fms max\n"
+	   , s->checkpoints
+	   , s->compactions
+	   , s->arrays
+	   , s->pages
+	   , s->releases
+	   , s->bytes
+	   , s->log_bytes
+	   , s->pause_ns / 1e6
+	   , s->max_pause_ns / 1e6);
+}
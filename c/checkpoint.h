@@ -0,0 +1,100 @@
+#if ! defined (CHECKPOINT_H)
+#define CHECKPOINT_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Incremental checkpoints of a long session.
+ *
+ * The log starts with a full checkpoint of the machine (registers and
+ * every array), then each um_checkpoint_take appends the delta since the
+ * previous one: the arrays released, the arrays created or written
+ * since, and only the pages written for the large ones. The VM flags the
+ * arrays from its write paths while a log is attached, so that a
+ * checkpoint does not compare anything. Once the deltas outgrow the full
+ * checkpoint, the log is compacted: a new one with a single full
+ * checkpoint replaces it.
+ *
+ * Every checkpoint is framed with its size and a hash, written then
+ * synced, so that um_checkpoint_restore ignores the one a crash
+ * interrupted and restores the last complete one.
+ */
+
+typedef struct um_checkpoint_t um_checkpoint_t;
+
+typedef struct um_checkpoint_stats_t
+{
+  // deltas appended, full checkpoints (the first one included)
+  unsigned long long checkpoints;
+  unsigned long long compactions;
+
+  // arrays written whole, pages of the large arrays written, releases
+  unsigned long long arrays;
+  unsigned long long pages;
+  unsigned long long releases;
+
+  // bytes written (compactions included), size of the log
+  unsigned long long bytes;
+  unsigned long long log_bytes;
+
+  // time the machine waited for the checkpoints, in nanoseconds
+  unsigned long long pause_ns;
+  unsigned long long max_pause_ns;
+
+} um_checkpoint_stats_t;
+
+/**
+ * Creates the log at path (replacing the file once the first full
+ * checkpoint is written) and attaches it to the machine, which must be
+ * loaded or restored.
+ */
+int um_checkpoint_open (um_checkpoint_t ** checkpoint
+			, const char * path
+			, struct um_t * machine);
+
+/**
+ * Appends the changes since the previous checkpoint, between two runs of
+ * the machine (um_run_for).
+ *
+ * @return EOK or the errno of the failed write, the next checkpoint is
+ * then a full one
+ */
+int um_checkpoint_take (um_checkpoint_t * checkpoint);
+
+/**
+ * Replaces the log with a full checkpoint of the machine.
+ */
+int um_checkpoint_compact (um_checkpoint_t * checkpoint);
+
+/**
+ * Detaches the log from its machine.
+ */
+int um_checkpoint_close (um_checkpoint_t * checkpoint);
+
+/**
+ * Initializes a machine that is not loaded with the last complete
+ * checkpoint of the log.
+ *
+ * @return EOK, an errno value if the file cannot be read, EBUSY if the
+ * machine is loaded or EINVAL if the log has no complete checkpoint
+ */
+int um_checkpoint_restore (const char * path
+			   , struct um_t * machine);
+
+void um_checkpoint_get_stats (um_checkpoint_t * checkpoint
+			      , um_checkpoint_stats_t * stats);
+
+void um_checkpoint_report (FILE * out
+			   , um_checkpoint_t * checkpoint);
+
+/**
+ * Called by the VM when an array written in a checkpoint of the log is
+ * released (abandonment, program replacement, collection).
+ */
+void um_checkpoint_released (void * checkpoint
+			     , struct um_t * machine
+			     , platter_t id);
+
+#endif // CHECKPOINT_H
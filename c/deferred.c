@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "um_priv.h"
+#include "deferred.h"
+
+
+typedef struct deferred_slot_t
+{
+  // the slot can be written by the producer that reserved position p
+  // when sequence == p, and read by the consumer when sequence == p + 1
+  size_t sequence;
+
+  platter_t * data;
+  platter_t count;
+  byte guarded;
+
+} deferred_slot_t;
+
+
+struct um_deferred_t
+{
+  deferred_slot_t * slots;
+  size_t mask;
+  platter_t threshold;
+
+  size_t enqueue_position;
+  size_t dequeue_position;
+
+  // one post per queued payload, and one to stop
+  sem_t pending;
+  int stopping;
+  pthread_t thread;
+
+  unsigned long long queued;
+  unsigned long long released;
+  unsigned long long fallbacks;
+  unsigned long long queued_bytes;
+  unsigned long long max_depth;
+};
+
+
+/**
+ * Reserves a slot and fills it.
+ *
+ * @return 0 if the queue is full
+ */
+static int deferred_push (um_deferred_t * d, platter_t * data, platter_t count, byte guarded)
+{
+  size_t position = __atomic_load_n (&d->enqueue_position, __ATOMIC_RELAXED);
+  deferred_slot_t * slot = NULL;
+
+  while (1)
+    {
+      size_t sequence = 0;
+      long difference = 0;
+
+      slot = &d->slots [position & d->mask];
+      sequence = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+      difference = (long) sequence - (long) position;
+
+      if (0 == difference)
+	{
+	  if (__atomic_compare_exchange_n (&d->enqueue_position
+					   , &position
+					   , position + 1
+					   , 1
+					   , __ATOMIC_RELAXED
+					   , __ATOMIC_RELAXED))
+	    {
+	      break;
+	    }
+	}
+      else if (difference < 0)
+	{
+	  return 0;
+	}
+      else
+	{
+	  position = __atomic_load_n (&d->enqueue_position, __ATOMIC_RELAXED);
+	}
+    }
+
+  slot->data = data;
+  slot->count = count;
+  slot->guarded = guarded;
+
+  __atomic_store_n (&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+  {
+    const unsigned long long depth =
+      position + 1 - __atomic_load_n (&d->dequeue_position, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n (&d->max_depth, __ATOMIC_RELAXED);
+
+    while (depth > max
+	   && ! __atomic_compare_exchange_n (&d->max_depth, &max, depth, 1
+					     , __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+  }
+
+  return 1;
+}
+
+/**
+ * Only called by the helper thread.
+ *
+ * @return 0 if the queue is empty
+ */
+static int deferred_pop (um_deferred_t * d, deferred_slot_t * out)
+{
+  const size_t position = d->dequeue_position;
+  deferred_slot_t * slot = &d->slots [position & d->mask];
+
+  if (__atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) != position + 1)
+    {
+      return 0;
+    }
+
+  *out = *slot;
+
+  __atomic_store_n (&d->dequeue_position, position + 1, __ATOMIC_RELAXED);
+  __atomic_store_n (&slot->sequence, position + d->mask + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+static void * deferred_thread (void * argument)
+{
+  um_deferred_t * d = (um_deferred_t *) argument;
+
+  while (1)
+    {
+      deferred_slot_t slot;
+
+      while (0 != sem_wait (&d->pending))
+	;
+
+      // a post may precede the publication of its slot by a few
+      // instructions of the producer
+      while ( ! deferred_pop (d, &slot))
+	{
+	  if (__atomic_load_n (&d->stopping, __ATOMIC_ACQUIRE)
+	      && d->dequeue_position == __atomic_load_n (&d->enqueue_position, __ATOMIC_ACQUIRE))
+	    {
+	      return NULL;
+	    }
+	}
+
+      um_priv_free_platters (slot.data, slot.count, slot.guarded);
+      __atomic_add_fetch (&d->released, 1, __ATOMIC_RELAXED);
+    }
+
+  return NULL;
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_deferred_start (um_deferred_t ** deferred
+		       , size_t depth
+		       , platter_t threshold)
+{
+  um_deferred_t * d = NULL;
+  size_t capacity = 2;
+  size_t i = 0;
+
+  if (NULL == deferred || 0 == depth)
+    {
+      return EINVAL;
+    }
+
+  while (capacity < depth)
+    {
+      capacity *= 2;
+    }
+
+  d = (um_deferred_t *) calloc (1, sizeof(um_deferred_t));
+  if (NULL == d)
+    {
+      return ENOMEM;
+    }
+
+  d->slots = (deferred_slot_t *) calloc (capacity, sizeof(deferred_slot_t));
+  if (NULL == d->slots)
+    {
+      free (d);
+      return ENOMEM;
+    }
+
+  for (i = 0; i < capacity; ++i)
+    {
+      d->slots[i].sequence = i;
+    }
+
+  d->mask = capacity - 1;
+  d->threshold = threshold;
+
+  if (0 != sem_init (&d->pending, 0, 0))
+    {
+      free (d->slots);
+      free (d);
+      return errno;
+    }
+
+  {
+    int err = pthread_create (&d->thread, NULL, deferred_thread, d);
+    if (0 != err)
+      {
+	sem_destroy (&d->pending);
+	free (d->slots);
+	free (d);
+	return err;
+      }
+  }
+
+  *deferred = d;
+
+  return EOK;
+}
+
+int um_deferred_stop (um_deferred_t * deferred)
+{
+  if (NULL == deferred)
+    {
+      return EINVAL;
+    }
+
+  __atomic_store_n (&deferred->stopping, 1, __ATOMIC_RELEASE);
+  sem_post (&deferred->pending);
+
+  pthread_join (deferred->thread, NULL);
+
+  sem_destroy (&deferred->pending);
+  free (deferred->slots);
+  free (deferred);
+
+  return EOK;
+}
+
+int um_deferred_attach (um_deferred_t * deferred
+			, struct um_t * machine)
+{
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+
+  machine->deferred = deferred;
+
+  return EOK;
+}
+
+int um_deferred_release (void * deferred
+			 , platter_t * data
+			 , platter_t count
+			 , byte guarded)
+{
+  um_deferred_t * d = (um_deferred_t *) deferred;
+
+  if (count < d->threshold)
+    {
+      return EAGAIN;
+    }
+
+  if ( ! deferred_push (d, data, count, guarded))
+    {
+      __atomic_add_fetch (&d->fallbacks, 1, __ATOMIC_RELAXED);
+      return EAGAIN;
+    }
+
+  __atomic_add_fetch (&d->queued, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&d->queued_bytes
+		      , (unsigned long long) count * sizeof(platter_t)
+		      , __ATOMIC_RELAXED);
+
+  sem_post (&d->pending);
+
+  return EOK;
+}
+
+void um_deferred_get_stats (um_deferred_t * deferred
+			    , um_deferred_stats_t * stats)
+{
+  stats->queued = __atomic_load_n (&deferred->queued, __ATOMIC_RELAXED);
+  stats->released = __atomic_load_n (&deferred->released, __ATOMIC_RELAXED);
+  stats->fallbacks = __atomic_load_n (&deferred->fallbacks, __ATOMIC_RELAXED);
+  stats->queued_bytes = __atomic_load_n (&deferred->queued_bytes, __ATOMIC_RELAXED);
+  stats->max_depth = __atomic_load_n (&deferred->max_depth, __ATOMIC_RELAXED);
+}
+
+void um_deferred_report (FILE * out
+			 , um_deferred_t * deferred)
+{
+  um_deferred_stats_t s;
+
+  um_deferred_get_stats (deferred, &s);
+
+  fprintf (out
+	   , "deferred free: %llu arrays / %llu bytes queued, %llu released"
+	   ", %llu released synchronously (queue full), max depth %llu of %lu\n"
+	   , s.queued
+	   , s.queued_bytes
+	   , s.released
+	   , s.fallbacks
+	   , s.max_depth
+	   , (unsigned long) deferred->mask + 1);
+}
@@ -0,0 +1,75 @@
+#if ! defined (DEFERRED_H)
+#define DEFERRED_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Deferred release of the large arrays.
+ *
+ * Releasing a large array (munmap, or free of a big malloc block) can
+ * stall the machine that abandons it. The machines attached to a deferred
+ * free service push such payloads to a bounded lock-free queue (multiple
+ * producers, one consumer) and a helper thread releases them. When the
+ * queue is full the payload is released synchronously by the machine.
+ */
+
+// arrays from that many platters, as for the mapped ones
+#define UM_DEFERRED_THRESHOLD (64 * 1024)
+
+typedef struct um_deferred_t um_deferred_t;
+
+typedef struct um_deferred_stats_t
+{
+  // payloads released by the helper thread / synchronously because the
+  // queue was full
+  unsigned long long queued;
+  unsigned long long released;
+  unsigned long long fallbacks;
+
+  unsigned long long queued_bytes;
+
+  // highest number of payloads waiting in the queue
+  unsigned long long max_depth;
+
+} um_deferred_stats_t;
+
+/**
+ * Starts the helper thread.
+ *
+ * @param deferred
+ * @param depth capacity of the queue, rounded up to a power of 2
+ * @param threshold arrays of at least that many platters are deferred
+ */
+int um_deferred_start (um_deferred_t ** deferred
+		       , size_t depth
+		       , platter_t threshold);
+
+/**
+ * Releases what is still queued and stops the helper thread. The
+ * machines attached to it must not run anymore.
+ */
+int um_deferred_stop (um_deferred_t * deferred);
+
+int um_deferred_attach (um_deferred_t * deferred
+			, struct um_t * machine);
+
+/**
+ * Called by the VM to release the platters of an array.
+ *
+ * @return EOK if the helper thread will release them, EAGAIN if the
+ * caller has to
+ */
+int um_deferred_release (void * deferred
+			 , platter_t * data
+			 , platter_t count
+			 , byte guarded);
+
+void um_deferred_get_stats (um_deferred_t * deferred
+			    , um_deferred_stats_t * stats);
+
+void um_deferred_report (FILE * out
+			 , um_deferred_t * deferred);
+
+#endif // DEFERRED_H
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+
+#include "um_priv.h"
+#include "gc.h"
+
+
+typedef struct um_gc_t
+{
+  unsigned long long threshold;
+  unsigned long long next_collection;
+
+} um_gc_t;
+
+
+static unsigned long long gc_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void gc_clear_marks (struct um_t * machine)
+{
+  ArrayCell * p = NULL;
+
+  for (p = um_priv_cell_from (machine, 0); NULL != p; p = um_priv_cell_from (machine, p->id + 1))
+    {
+      p->gc_mark = 0;
+    }
+}
+
+/**
+ * @return the live array with that id, NULL if the value is not an id
+ */
+static ArrayCell * gc_lookup (struct um_t * machine, platter_t id)
+{
+  return um_priv_search_for_cell_id (machine, id);
+}
+
+/**
+ * Marks everything reachable from root. When descending from an array to
+ * one of its platters, that platter receives the id of the array we came
+ * from; it is restored with the id of the child when going back up.
+ */
+static void gc_mark_from (struct um_t * machine, ArrayCell * root)
+{
+  ArrayCell * cur = root;
+  ArrayCell * prev = NULL;
+
+  if (NULL == root || root->gc_mark)
+    {
+      return;
+    }
+
+  root->gc_mark = 1;
+  root->gc_scan = 0;
+
+  while (1)
+    {
+      if (cur->gc_scan < cur->datasize)
+	{
+	  ArrayCell * child = gc_lookup (machine, um_priv_swap_platter_bytes (cur->data[cur->gc_scan]));
+
+	  if (NULL != child && ! child->gc_mark)
+	    {
+	      child->gc_mark = 1;
+	      child->gc_scan = 0;
+
+	      cur->data[cur->gc_scan] = um_priv_swap_platter_bytes (NULL != prev ? prev->id : 0);
+
+	      prev = cur;
+	      cur = child;
+	    }
+	  else
+	    {
+	      cur->gc_scan++;
+	    }
+	}
+      else
+	{
+	  ArrayCell * parent = prev;
+	  ArrayCell * grandparent = NULL;
+
+	  if (cur == root)
+	    {
+	      break;
+	    }
+
+	  assert (NULL != parent);
+
+	  if (parent != root)
+	    {
+	      grandparent = gc_lookup (machine, um_priv_swap_platter_bytes (parent->data[parent->gc_scan]));
+	      assert (NULL != grandparent);
+	    }
+
+	  parent->data[parent->gc_scan] = um_priv_swap_platter_bytes (cur->id);
+	  parent->gc_scan++;
+
+	  cur = parent;
+	  prev = grandparent;
+	}
+    }
+}
+
+static void gc_sweep (struct um_t * machine)
+{
+  ArrayCell * cell = um_priv_cell_from (machine, 0);
+
+  while (NULL != cell)
+    {
+      ArrayCell * next = um_priv_cell_from (machine, cell->id + 1);
+
+      if (cell->gc_mark)
+	{
+	  cell->gc_mark = 0;
+	  cell = next;
+	  continue;
+	}
+
+      um_priv_remove_array_cell (machine, cell);
+
+      machine->stats.gc_reclaimed_arrays++;
+      machine->stats.gc_reclaimed_bytes += (unsigned long long) cell->datasize * sizeof(platter_t);
+
+      um_priv_release_array_cell (machine, cell);
+      cell = next;
+    }
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_gc_enable (struct um_t * machine
+		  , unsigned long long threshold)
+{
+  um_gc_t * gc = NULL;
+
+  if (NULL == machine || 0 == threshold)
+    {
+      return EINVAL;
+    }
+
+  um_gc_disable (machine);
+
+  gc = (um_gc_t *) calloc (1, sizeof(um_gc_t));
+  if (NULL == gc)
+    {
+      return ENOMEM;
+    }
+
+  gc->threshold = threshold;
+  gc->next_collection = threshold;
+
+  machine->gc = gc;
+
+  return EOK;
+}
+
+int um_gc_disable (struct um_t * machine)
+{
+  um_gc_t * gc = NULL;
+
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+
+  gc = (um_gc_t *) machine->gc;
+  if (NULL != gc)
+    {
+      free (gc);
+      machine->gc = NULL;
+    }
+
+  return EOK;
+}
+
+int um_gc_collect (struct um_t * machine)
+{
+  um_gc_t * gc = NULL;
+  unsigned long long start = 0;
+  unsigned long long pause = 0;
+
+  if (NULL == machine || NULL == machine->gc)
+    {
+      return EINVAL;
+    }
+
+  gc = (um_gc_t *) machine->gc;
+  start = gc_now_ns ();
+
+  gc_clear_marks (machine);
+
+  gc_mark_from (machine, gc_lookup (machine, UM_PROGRAM_ARRAY_ID));
+
+  {
+    size_t i = 0;
+    for (i = 0; i < UM_REGISTER_COUNT; ++i)
+      {
+	gc_mark_from (machine, gc_lookup (machine, machine->registers[i]));
+      }
+  }
+
+  gc_sweep (machine);
+
+  gc->next_collection = 2 * machine->stats.heap_bytes;
+  if (gc->next_collection < gc->threshold)
+    {
+      gc->next_collection = gc->threshold;
+    }
+
+  pause = gc_now_ns () - start;
+
+  machine->stats.gc_collections++;
+  machine->stats.gc_pause_ns += pause;
+  if (pause > machine->stats.gc_max_pause_ns)
+    {
+      machine->stats.gc_max_pause_ns = pause;
+    }
+
+  return EOK;
+}
+
+void um_gc_allocated (void * gc
+		      , struct um_t * machine)
+{
+  if (machine->stats.heap_bytes >= ((um_gc_t *) gc)->next_collection)
+    {
+      um_gc_collect (machine);
+    }
+}
+
+void um_gc_report (FILE * out
+		   , struct um_t * machine)
+{
+  const um_stats_t * s = &machine->stats;
+
+  fprintf (out
+	   , "gc: %llu collections, %llu arrays / %llu bytes reclaimed"
+	   ", pauses %.3fms total, %.3fms max, heap %llu bytes (peak %llu)\n"
+	   , s->gc_collections
+	   , s->gc_reclaimed_arrays
+	   , s->gc_reclaimed_bytes
+	   , s->gc_pause_ns / 1e6
+	   , s->gc_max_pause_ns / 1e6
+	   , s->heap_bytes
+	   , s->peak_heap_bytes);
+}
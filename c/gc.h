@@ -0,0 +1,51 @@
+#if ! defined (GC_H)
+#define GC_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Optional conservative mark & sweep collector of the UM arrays.
+ *
+ * The roots are the registers and the program array. Any platter of a
+ * reachable array whose value is the id of a live array keeps that array
+ * alive. The arrays are traversed with Schorr / Waite pointer reversal
+ * (the reversed links are stored in the platters themselves), so marking
+ * needs no stack.
+ *
+ * A program that computes array ids instead of keeping them around would
+ * see its arrays disappear, which is why the collector is opt-in.
+ */
+
+/**
+ * Attaches a collector to the machine. A collection is run by the
+ * allocation operator once the heap reaches threshold bytes; the next
+ * threshold is then twice the surviving heap (and at least threshold).
+ *
+ * @param machine
+ * @param threshold in bytes
+ */
+int um_gc_enable (struct um_t * machine
+		  , unsigned long long threshold);
+
+int um_gc_disable (struct um_t * machine);
+
+/**
+ * Runs a collection now. The counters are in machine->stats.
+ */
+int um_gc_collect (struct um_t * machine);
+
+/**
+ * Called by the VM after an allocation.
+ */
+void um_gc_allocated (void * gc
+		      , struct um_t * machine);
+
+/**
+ * Prints the collection counters of the machine.
+ */
+void um_gc_report (FILE * out
+		   , struct um_t * machine);
+
+#endif // GC_H
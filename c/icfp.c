@@ -4,10 +4,21 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "um.h"
+#include "trace.h"
+#include "gc.h"
+#include "profile.h"
+#include "deferred.h"
+#include "iopipe.h"
+#include "replay.h"
+#include "intrinsic.h"
+#include "checkpoint.h"
 #include "debugger/parser.h"
 #include "debugger/debugger.h"
 
@@ -17,9 +28,68 @@
 
 
 um_t u_machine;
+um_trace_t * u_trace = NULL;
+um_profile_t * u_profile = NULL;
+um_deferred_t * u_deferred = NULL;
+um_checkpoint_t * u_checkpoint = NULL;
 
 
-int run_debug_mode (um_t * machine, byte * data, size_t size)
+// fail () exits the process, the trace still has to be completed
+void close_trace (void)
+{
+  if (NULL != u_trace)
+    {
+      um_trace_close (u_trace);
+      u_trace = NULL;
+    }
+}
+
+// same for the profile, whose summary is printed on exit
+void close_profile (void)
+{
+  if (NULL != u_profile)
+    {
+      um_profile_report (stderr, u_profile);
+      um_profile_close (u_profile);
+      u_profile = NULL;
+    }
+}
+
+// and for the deferred frees, whose metrics are printed on exit
+void close_deferred (void)
+{
+  if (NULL != u_deferred)
+    {
+      um_deferred_report (stderr, u_deferred);
+      um_deferred_stop (u_deferred);
+      u_deferred = NULL;
+      u_machine.deferred = NULL;
+    }
+}
+
+// and for the checkpoint log
+void close_checkpoint (void)
+{
+  if (NULL != u_checkpoint)
+    {
+      um_checkpoint_report (stderr, u_checkpoint);
+      um_checkpoint_close (u_checkpoint);
+      u_checkpoint = NULL;
+    }
+}
+
+// and for the native routines
+void close_intrinsics (void)
+{
+  if (NULL != u_machine.intrinsics)
+    {
+      um_intrinsics_report (stderr, &u_machine);
+      um_intrinsics_disable (&u_machine);
+    }
+}
+
+
+int run_debug_mode (um_t * machine)
 {
   int should_be_stopped (struct um_t * machine, platter_t instruction, void * arguments)
   {
@@ -66,19 +136,19 @@ int run_debug_mode (um_t * machine, byte * data, size_t size)
   // big GCC / C99 extension
   int next ()
   {
-    um_run_one_step (machine, data, size, onestep);
+    um_run_one_step (machine, NULL, 0, onestep);
     return EOK;
   }
   
   int peek_next ()
   {
-    um_run_one_step (machine, data, size, onestep);
+    um_run_one_step (machine, NULL, 0, onestep);
     return EOK;
   }
   
   int run_until (const char * const arguments)
   {
-    um_run_until (machine, data, size, onestep, should_be_stopped, arguments);
+    um_run_until (machine, NULL, 0, onestep, should_be_stopped, arguments);
   }
   
   int where ()
@@ -109,48 +179,329 @@ int run_debug_mode (um_t * machine, byte * data, size_t size)
   return run_debugger (&debugger);
 }
 
-int run_normal (um_t * machine, byte * data, size_t size)
+// seconds between two checkpoints, looked at every slice of that many
+// instructions
+#define ICFP_CHECKPOINT_PERIOD 5
+#define ICFP_CHECKPOINT_SLICE (1ULL << 24)
+
+int run_normal (um_t * machine)
 {
-  return um_run (&machine, data, size);
+  um_status_t status = UM_STATUS_RUNNING;
+  
+  if (NULL == u_checkpoint)
+    {
+      status = um_run_for (machine, UM_ENGINE_DEFAULT, ~0ULL);
+    }
+  else
+    {
+      time_t last = time (NULL);
+      
+      while (UM_STATUS_RUNNING
+	     == (status = um_run_for (machine, UM_ENGINE_DEFAULT, ICFP_CHECKPOINT_SLICE)))
+	{
+	  if (time (NULL) - last >= ICFP_CHECKPOINT_PERIOD)
+	    {
+	      fflush (stdout);
+	      um_checkpoint_take (u_checkpoint);
+	      last = time (NULL);
+	    }
+	}
+    }
+  
+  if (UM_STATUS_HALTED != status)
+    {
+      fprintf (stderr, "fail: invalid operation\n");
+      exit (1);
+    }
+  
+  printf ("Processor halted\n");
+  
+  return EOK;
 }
 
-int main (int argc, char ** argv)
+// the I/O goes through the threads of iopipe.h
+int run_pipelined (um_t * machine)
 {
-  FILE * f = fopen ("../data/sandmark.umz", "rb");
-  if ( ! f)
+  um_iopipe_t * pipe = NULL;
+  um_status_t status = UM_STATUS_FAILED;
+  int err = um_iopipe_open (&pipe, STDIN_FILENO, STDOUT_FILENO, 1 << 16, machine);
+  
+  if (EOK != err)
     {
-      printf ("Could not open the codex file: %d\n", errno);
-      return 1;
+      printf ("Could not start the I/O threads: %d\n", err);
+      return err;
     }
   
-  {
-    size_t fs = 0;
-    byte * content = NULL;
+  status = um_run_for (machine, UM_ENGINE_DEFAULT, ~0ULL);
+  
+  um_iopipe_flush (pipe);
+  um_iopipe_report (stderr, pipe);
+  um_iopipe_close (pipe);
+  
+  if (UM_STATUS_HALTED != status)
+    {
+      fprintf (stderr, "fail: invalid operation\n");
+      exit (1);
+    }
+  
+  printf ("Processor halted\n");
+  
+  return EOK;
+}
 
-    fseek (f, 0, SEEK_END);
-    fs = ftell (f);
-    fseek (f, 0, SEEK_SET);
+/**
+ * Records the input to log or replays log (mode 'R' / 'r'), up to stop
+ * instructions when not 0.
+ */
+int run_replay (um_t * machine
+		, int mode, const char * log, int flags
+		, unsigned long long stop)
+{
+  um_replay_t * replay = NULL;
+  um_status_t status = UM_STATUS_FAILED;
+  int err = 'R' == mode
+    ? um_replay_record (&replay, log, machine)
+    : um_replay_play (&replay, log, machine, flags);
+  
+  if (EOK != err)
+    {
+      printf ("Could not open the input log %s: %d\n", log, err);
+      return err;
+    }
+  
+  status = um_run_for (machine, UM_ENGINE_DEFAULT, 0 == stop ? ~0ULL : stop);
+  fflush (stdout);
+  
+  um_replay_report (stderr, replay);
+  um_replay_close (replay);
+  
+  if (UM_STATUS_RUNNING == status)
+    {
+      fprintf (stderr, "stopped at instruction %llu, ip 0x%08X\n"
+	       , machine->stats.instructions
+	       , machine->ip);
+      return EOK;
+    }
+  
+  if (UM_STATUS_HALTED != status)
+    {
+      fprintf (stderr, "fail: invalid operation\n");
+      exit (1);
+    }
+  
+  printf ("Processor halted\n");
+  
+  return EOK;
+}
+
+/**
+ * Reads the image and copies it as the program array, or maps it with
+ * mapped (see um_load_file: the file must not change while it runs).
+ */
+int load_program (um_t * machine, const char * path, int mapped)
+{
+  byte * content = NULL;
+  size_t size = 0;
+  int err = EOK;
+  
+  if (mapped)
+    {
+      return um_load_file (machine, path);
+    }
+  
+  err = um_load_image (path, &content, &size);
+  if (EOK == err)
+    {
+      err = um_load (machine, content, size);
+      free (content);
+    }
+  
+  return err;
+}
+
+int main (int argc, char ** argv)
+{
+  const char * path = "../data/sandmark.umz";
+  int mapped = 0;
+  int debug = 0;
+  int pipelined = 0;
+  int replay_mode = 0;
+  const char * replay_log = NULL;
+  int replay_flags = 0;
+  unsigned long long stop = 0;
+  const char * checkpoint_log = NULL;
+  int resume = 0;
+  
+  {
+    int i = 0;
     
-    content = (byte *) malloc (fs);
-    if (NULL != content)
+    for (i = 1; i < argc; ++i)
       {
-	if (fs == fread (content, 1, fs, f))
+	if (0 == strcmp (argv[i], "-d"))
+	  {
+	    debug = 1;
+	  }
+	else if (0 == strcmp (argv[i], "-I"))
+	  {
+	    pipelined = 1;
+	  }
+	else if ((0 == strcmp (argv[i], "-R") || 0 == strcmp (argv[i], "-r")) && i + 1 < argc)
+	  {
+	    // -R records the input to the log, -r replays it
+	    replay_mode = argv[i][1];
+	    replay_log = argv[++i];
+	  }
+	else if ((0 == strcmp (argv[i], "-X") || (0 == strcmp (argv[i], "-x") && i + 1 < argc))
+		 && NULL == u_machine.intrinsics)
+	  {
+	    // -x also cross checks one call out of that many with the
+	    // interpretation
+	    unsigned int verify = 'x' == argv[i][1] ? strtoul (argv[++i], NULL, 0) : 0;
+	    um_intrinsics_enable (&u_machine, verify);
+	    atexit (close_intrinsics);
+	  }
+	else if (0 == strcmp (argv[i], "-M"))
+	  {
+	    // shares the pages of a large image file instead of copying it
+	    mapped = 1;
+	  }
+	else if (0 == strcmp (argv[i], "-U"))
+	  {
+	    // runs the guests of data/um.um directly
+	    um_set_bypass (&u_machine, 1);
+	  }
+	else if (0 == strcmp (argv[i], "-E"))
+	  {
+	    // accepts the bulk array operators 14 and 15
+	    um_set_extensions (&u_machine, 1);
+	  }
+	else if ((0 == strcmp (argv[i], "-c") || 0 == strcmp (argv[i], "-C")) && i + 1 < argc)
+	  {
+	    // -c checkpoints the session to the log, -C resumes it from
+	    // the log first
+	    resume = 'C' == argv[i][1];
+	    checkpoint_log = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-q"))
+	  {
+	    replay_flags |= UM_REPLAY_QUIET;
+	  }
+	else if (0 == strcmp (argv[i], "-n") && i + 1 < argc)
+	  {
+	    stop = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-D") && i + 1 < argc && NULL == u_deferred)
+	  {
+	    // the large arrays are released by a helper thread, through a
+	    // queue of that many entries
+	    int err = um_deferred_start (&u_deferred
+					 , strtoul (argv[++i], NULL, 0)
+					 , UM_DEFERRED_THRESHOLD);
+	    if (EOK != err)
+	      {
+		printf ("Could not start the deferred free thread: %d\n", err);
+		return 1;
+	      }
+	    um_deferred_attach (u_deferred, &u_machine);
+	    atexit (close_deferred);
+	  }
+	else if (0 == strcmp (argv[i], "-G"))
+	  {
+	    if (EOK != um_set_checking (&u_machine, UM_CHECKING_GUARD_PAGES))
+	      {
+		printf ("Guard pages are not available\n");
+		return 1;
+	      }
+	  }
+	else if (0 == strcmp (argv[i], "-g") && i + 1 < argc)
 	  {
-	    if (argc > 1
-		&& 0 == strncmp (argv[1], "-d", strlen(argv[1])))
+	    // collects the unreachable arrays once the heap reaches that many MB
+	    int err = um_gc_enable (&u_machine, strtoull (argv[++i], NULL, 0) << 20);
+	    if (EOK != err)
 	      {
-		run_debug_mode (&u_machine, content, fs);
+		printf ("Could not enable the garbage collector: %d\n", err);
+		return 1;
 	      }
-	    else
+	  }
+	else if ((0 == strcmp (argv[i], "-p") || 0 == strcmp (argv[i], "-P")) && NULL == u_profile)
+	  {
+	    // -P also logs every allocation and release
+	    const char * log = 0 == strcmp (argv[i], "-P") && i + 1 < argc ? argv[++i] : NULL;
+	    int err = um_profile_open (&u_profile, log, &u_machine);
+	    if (EOK != err)
 	      {
-		run_normal (&u_machine, content, fs);
+		printf ("Could not start the allocation profiler: %d\n", err);
+		return 1;
 	      }
+	    atexit (close_profile);
+	  }
+	else if (0 == strcmp (argv[i], "-t") && i + 1 < argc)
+	  {
+	    int err = um_trace_open (&u_trace, argv[++i], &u_machine);
+	    if (EOK != err)
+	      {
+		printf ("Could not create the trace file: %d\n", err);
+		return 1;
+	      }
+	    atexit (close_trace);
+	  }
+	else
+	  {
+	    path = argv[i];
 	  }
       }
-        
-    free (content);
+  }
+  
+  {
+    int err = resume
+      ? um_checkpoint_restore (checkpoint_log, &u_machine)
+      : load_program (&u_machine, path, mapped);
+    if (EOK != err)
+      {
+	printf ("Could not open the codex file %s: %d\n", resume ? checkpoint_log : path, err);
+	return 1;
+      }
+    
+    if (NULL != checkpoint_log)
+      {
+	err = um_checkpoint_open (&u_checkpoint, checkpoint_log, &u_machine);
+	if (EOK != err)
+	  {
+	    printf ("Could not create the checkpoint log %s: %d\n", checkpoint_log, err);
+	    return 1;
+	  }
+	atexit (close_checkpoint);
+      }
+    
+    if (debug)
+      {
+	run_debug_mode (&u_machine);
+      }
+    else if (0 != replay_mode)
+      {
+	run_replay (&u_machine, replay_mode, replay_log, replay_flags, stop);
+      }
+    else if (pipelined)
+      {
+	run_pipelined (&u_machine);
+      }
+    else
+      {
+	run_normal (&u_machine);
+      }
+    
+    close_trace ();
+    close_profile ();
+    close_checkpoint ();
+    close_deferred ();
+    close_intrinsics ();
+    
+    if (NULL != u_machine.gc)
+      {
+	um_gc_report (stderr, &u_machine);
+	um_gc_disable (&u_machine);
+      }
   }
     
   return 0;
 }
-
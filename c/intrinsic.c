@@ -0,0 +1,676 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "um_priv.h"
+#include "intrinsic.h"
+
+
+typedef enum INTRINSIC_CONSTANTS
+  {
+    INTRINSICS_CAPACITY = 16,
+
+    // loop iterations run by one call, so that um_run_for budgets are
+    // not overshot by much: the loop head is left as the next entry
+    INTRINSIC_MAX_ITERATIONS = 4096,
+
+  } INTRINSIC_CONSTANTS;
+
+
+typedef enum INTRINSIC_STATE
+  {
+    // platters not hashed since the program array changed
+    INTRINSIC_UNCHECKED,
+    INTRINSIC_MATCHES,
+    INTRINSIC_DIFFERS,
+
+    // diverged from the interpretation
+    INTRINSIC_DISABLED,
+
+  } INTRINSIC_STATE;
+
+
+typedef struct intrinsic_entry_t
+{
+  um_intrinsic_t intrinsic;
+  INTRINSIC_STATE state;
+
+  unsigned long long attempts;
+  unsigned long long calls;
+  unsigned long long instructions;
+  unsigned long long verifications;
+  unsigned long long divergences;
+
+} intrinsic_entry_t;
+
+
+typedef struct intrinsics_t
+{
+  intrinsic_entry_t entries [INTRINSICS_CAPACITY];
+  size_t count;
+
+  // bit (entry & 63) of every entry, dismisses most jumps at once
+  unsigned long long filter;
+
+  // platters covered by at least one entry: [low, high)
+  platter_t low;
+  platter_t high;
+
+  unsigned int verify_every;
+
+} intrinsics_t;
+
+
+//////////////////////////////////////
+// helpers of the native functions
+//////////////////////////////////////
+
+static platter_t intrinsic_read (const ArrayCell * cell, platter_t offset)
+{
+  return um_priv_swap_platter_bytes (cell->data[offset]);
+}
+
+static void intrinsic_write (struct um_t * machine, ArrayCell * cell, platter_t offset, platter_t value)
+{
+  cell->data[offset] = um_priv_swap_platter_bytes (value);
+
+  if (NULL != machine->checkpoint)
+    {
+      um_priv_mark_dirty (cell, offset, 1);
+    }
+
+  if (UM_PROGRAM_ARRAY_ID == cell->id && NULL != machine->intrinsics)
+    {
+      um_intrinsics_amend (machine->intrinsics, offset);
+    }
+}
+
+/**
+ * @return 1 when the output operator would block
+ */
+static int intrinsic_output (struct um_t * machine, byte c)
+{
+  if (NULL != machine->io.output)
+    {
+      return UM_OUTPUT_WOULD_BLOCK == machine->io.output (machine->io.context, c);
+    }
+
+  printf ("%c", c);
+
+  return 0;
+}
+
+
+//////////////////////////////////////
+// codex
+//////////////////////////////////////
+
+// globals of the decompressor, in its program array
+#define CODEX_BUFFER 0x2f
+#define CODEX_BYTE 0x3b
+#define CODEX_POSITION 0x3c
+#define CODEX_SOURCE 0x3d
+#define CODEX_COUNT 0x3e
+#define CODEX_POWERS 0x26
+
+/**
+ * Appends the byte CODEX_BYTE to the buffer packed 4 bytes per platter
+ * (401 - 418), then returns to r0.
+ */
+static int intrinsic_codex_append (struct um_t * machine)
+{
+  platter_t * r = machine->registers;
+  ArrayCell * program = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+  ArrayCell * buffer = NULL;
+  platter_t position = 0;
+  platter_t word = 0;
+
+  if (0 != r[6] || program->datasize <= CODEX_COUNT)
+    {
+      return EAGAIN;
+    }
+
+  position = intrinsic_read (program, CODEX_POSITION);
+  buffer = um_priv_search_for_cell_id (machine, intrinsic_read (program, CODEX_BUFFER));
+
+  // failures and amendments of the program are left to the interpreter
+  if (NULL == buffer || UM_PROGRAM_ARRAY_ID == buffer->id || position / 4 >= buffer->datasize)
+    {
+      return EAGAIN;
+    }
+
+  intrinsic_write (machine, program, CODEX_POSITION, position + 1);
+
+  word = intrinsic_read (buffer, position / 4) * 0x100 + intrinsic_read (program, CODEX_BYTE);
+  intrinsic_write (machine, buffer, position / 4, word);
+
+  r[1] = position / 4;
+  r[2] = word;
+  r[3] = intrinsic_read (program, CODEX_BYTE);
+  r[4] = buffer->id;
+  r[7] = CODEX_BYTE;
+
+  machine->ip = r[0];
+  machine->stats.instructions += 18;
+
+  return EOK;
+}
+
+/**
+ * Copies CODEX_COUNT bytes of the buffer from CODEX_SOURCE to its end
+ * (263 - 327, appending through 401).
+ */
+static int intrinsic_codex_copy (struct um_t * machine)
+{
+  platter_t * r = machine->registers;
+  ArrayCell * program = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+  unsigned int n = 0;
+
+  if (0 != r[6] || program->datasize <= CODEX_COUNT)
+    {
+      return EAGAIN;
+    }
+
+  for (n = 0; n < INTRINSIC_MAX_ITERATIONS; ++n)
+    {
+      const platter_t count = intrinsic_read (program, CODEX_COUNT);
+      const platter_t source = intrinsic_read (program, CODEX_SOURCE);
+      const platter_t position = intrinsic_read (program, CODEX_POSITION);
+      ArrayCell * buffer = NULL;
+      platter_t same = 0;
+      platter_t power = 0;
+      platter_t c = 0;
+      platter_t word = 0;
+
+      if (0 == count)
+	{
+	  r[1] = 0;
+	  r[3] = 0xed;
+	  r[4] = 0x10d;
+	  r[7] = CODEX_COUNT;
+
+	  machine->ip = 0xed;
+	  machine->stats.instructions += 6;
+
+	  return EOK;
+	}
+
+      buffer = um_priv_search_for_cell_id (machine, intrinsic_read (program, CODEX_BUFFER));
+      if (NULL == buffer || UM_PROGRAM_ARRAY_ID == buffer->id
+	  || source / 4 >= buffer->datasize || position / 4 >= buffer->datasize)
+	{
+	  break;
+	}
+
+      // the byte is taken from a platter still being filled when the
+      // source is in the last one
+      same = position / 4 == source / 4 ? 4 - (position & 3) : 0;
+      power = CODEX_POWERS + 3 - (source & 3) - same;
+      if (power >= program->datasize || 0 == intrinsic_read (program, power))
+	{
+	  break;
+	}
+
+      c = (intrinsic_read (buffer, source / 4) / intrinsic_read (program, power)) & 0xFF;
+      word = intrinsic_read (buffer, position / 4) * 0x100 + c;
+
+      intrinsic_write (machine, program, CODEX_COUNT, count - 1);
+      intrinsic_write (machine, program, CODEX_SOURCE, source + 1);
+      intrinsic_write (machine, program, CODEX_BYTE, c);
+      intrinsic_write (machine, program, CODEX_POSITION, position + 1);
+      intrinsic_write (machine, buffer, position / 4, word);
+
+      r[0] = 0x107;
+      r[1] = position / 4;
+      r[2] = word;
+      r[3] = c;
+      r[4] = buffer->id;
+      r[5] = position / 4 - source / 4;
+      r[7] = CODEX_BYTE;
+
+      machine->stats.instructions += 83;
+    }
+
+  // back at the loop head
+  return 0 == n ? EAGAIN : EOK;
+}
+
+/**
+ * Writes the platters [r0, r1) of the program as big endian bytes
+ * (250 - 282), then halts.
+ */
+static int intrinsic_codex_dump (struct um_t * machine)
+{
+  platter_t * r = machine->registers;
+  const ArrayCell * program = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+  unsigned int n = 0;
+
+  if (0 != r[6])
+    {
+      return EAGAIN;
+    }
+
+  for (n = 0; n < INTRINSIC_MAX_ITERATIONS; ++n)
+    {
+      platter_t word = 0;
+
+      if (r[0] == r[1])
+	{
+	  r[2] = 0;
+	  r[3] = 0x11b;
+	  r[4] = 0x102;
+	  r[7] = 1;
+
+	  machine->ip = 0x11b;
+	  machine->stats.instructions += 8;
+
+	  return EOK;
+	}
+
+      if (r[0] >= program->datasize)
+	{
+	  break;
+	}
+
+      word = intrinsic_read (program, r[0]);
+
+      r[2] = word;
+      r[3] = 0xFF;
+      r[4] = 0x100;
+      r[7] = 1;
+
+      // a blocked output is retried by the interpreter: the machine is
+      // left right before that output operator
+#define CODEX_DUMP_OUTPUT(value, at, executed)		\
+      if (intrinsic_output (machine, value))		\
+	{						\
+	  machine->ip = at;				\
+	  machine->stats.instructions += executed;	\
+	  machine->status = UM_STATUS_HAS_OUTPUT;	\
+	  return EOK;					\
+	}
+
+      r[5] = word >> 24;
+      CODEX_DUMP_OUTPUT (r[5], 266, 16);
+      r[5] = (word >> 16) & 0xFF;
+      CODEX_DUMP_OUTPUT (r[5], 271, 21);
+      r[5] = (word >> 8) & 0xFF;
+      CODEX_DUMP_OUTPUT (r[5], 275, 25);
+      r[2] = word & 0xFF;
+      CODEX_DUMP_OUTPUT (r[2], 278, 28);
+
+#undef CODEX_DUMP_OUTPUT
+
+      r[0]++;
+      r[2] = 0xfa;
+      r[4] = 1;
+
+      machine->stats.instructions += 33;
+    }
+
+  return 0 == n ? EAGAIN : EOK;
+}
+
+static const um_intrinsic_t g_builtin_intrinsics [] =
+  {
+    { "codex copy", 263, 156, 0x16e7595aaece8084ULL, intrinsic_codex_copy },
+    { "codex append", 401, 18, 0x6bde6e6d1e59aa62ULL, intrinsic_codex_append },
+    { "codex dump", 250, 34, 0x2cab48950626271aULL, intrinsic_codex_dump },
+  };
+
+
+//////////////////////////////////////
+// verification
+//////////////////////////////////////
+
+typedef struct capture_t
+{
+  byte * data;
+  size_t size;
+  size_t capacity;
+
+} capture_t;
+
+static int capture_output (void * context, byte c)
+{
+  capture_t * k = (capture_t *) context;
+
+  if (k->size == k->capacity)
+    {
+      size_t capacity = 0 == k->capacity ? 4096 : 2 * k->capacity;
+      byte * p = (byte *) realloc (k->data, capacity);
+
+      if (NULL == p)
+	{
+	  return UM_OUTPUT_WOULD_BLOCK;
+	}
+      k->data = p;
+      k->capacity = capacity;
+    }
+
+  k->data[k->size++] = c;
+
+  return EOK;
+}
+
+static int capture_input (void * context)
+{
+  return UM_INPUT_WOULD_BLOCK;
+}
+
+static int intrinsics_same_machines (struct um_t * a, struct um_t * b)
+{
+  const ArrayCell * p = NULL;
+  size_t count = 0;
+
+  if (0 != memcmp (a->registers, b->registers, sizeof(a->registers))
+      || a->ip != b->ip
+      || a->status != b->status
+      || a->next_array_id != b->next_array_id
+      || a->stats.instructions != b->stats.instructions
+      || a->stats.live_arrays != b->stats.live_arrays)
+    {
+      return 0;
+    }
+
+  for (p = um_priv_cell_from (a, 0); NULL != p; p = um_priv_cell_from (a, p->id + 1), ++count)
+    {
+      const ArrayCell * q = um_priv_search_for_cell_id (b, p->id);
+
+      if (NULL == q || p->datasize != q->datasize
+	  || 0 != memcmp (p->data, q->data, (size_t) p->datasize * sizeof(platter_t)))
+	{
+	  return 0;
+	}
+    }
+
+  return count == b->stats.live_arrays;
+}
+
+/**
+ * Runs the intrinsic on a copy of the machine and interprets the routine
+ * on another one, for as many instructions.
+ *
+ * @return 0 if they differ
+ */
+static int intrinsics_verify (intrinsic_entry_t * e, struct um_t * machine)
+{
+  struct um_t a;
+  struct um_t b;
+  capture_t ca = { NULL, 0, 0 };
+  capture_t cb = { NULL, 0, 0 };
+  int same = 1;
+
+  memset (&a, 0, sizeof(a));
+  memset (&b, 0, sizeof(b));
+
+  if (EOK != um_clone (&a, machine) || EOK != um_clone (&b, machine))
+    {
+      um_release (&a);
+      return 1;
+    }
+
+  a.io.output = b.io.output = capture_output;
+  a.io.input = b.io.input = capture_input;
+  a.io.context = &ca;
+  b.io.context = &cb;
+
+  if (EOK == e->intrinsic.run (&a))
+    {
+      um_run_for (&b, UM_ENGINE_DEFAULT, a.stats.instructions);
+
+      // the interpreter stops on the operator that blocks, the intrinsic
+      // sets the status after it
+      if (UM_STATUS_HAS_OUTPUT == a.status && UM_STATUS_RUNNING == b.status)
+	{
+	  b.status = UM_STATUS_HAS_OUTPUT;
+	}
+
+      same = intrinsics_same_machines (&a, &b)
+	&& ca.size == cb.size
+	&& 0 == memcmp (ca.data, cb.data, ca.size);
+
+      e->verifications++;
+    }
+
+  um_release (&a);
+  um_release (&b);
+  free (ca.data);
+  free (cb.data);
+
+  return same;
+}
+
+
+//////////////////////////////////////
+// registry
+//////////////////////////////////////
+
+static unsigned long long intrinsics_hash (const ArrayCell * program, const um_intrinsic_t * i)
+{
+  return um_priv_fnv1a (UM_PRIV_FNV1A_BASIS
+			, program->data + i->entry
+			, (size_t) i->length * sizeof(platter_t));
+}
+
+static INTRINSIC_STATE intrinsics_check (struct um_t * machine, const um_intrinsic_t * i)
+{
+  const ArrayCell * program = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+
+  if (NULL == program
+      || i->entry >= program->datasize
+      || i->length > program->datasize - i->entry
+      || i->hash != intrinsics_hash (program, i))
+    {
+      return INTRINSIC_DIFFERS;
+    }
+
+  return INTRINSIC_MATCHES;
+}
+
+void um_intrinsics_jump (void * intrinsics
+			 , struct um_t * machine)
+{
+  intrinsics_t * r = (intrinsics_t *) intrinsics;
+  const address_t ip = machine->ip;
+  size_t i = 0;
+
+  if (0 == (r->filter & (1ULL << (ip & 63))))
+    {
+      return;
+    }
+
+  for (i = 0; i < r->count; ++i)
+    {
+      intrinsic_entry_t * e = &r->entries[i];
+      unsigned long long before = 0;
+
+      if (ip != e->intrinsic.entry)
+	{
+	  continue;
+	}
+
+      if (INTRINSIC_UNCHECKED == e->state)
+	{
+	  e->state = intrinsics_check (machine, &e->intrinsic);
+	}
+
+      if (INTRINSIC_MATCHES != e->state)
+	{
+	  continue;
+	}
+
+      if (0 != r->verify_every && 0 == e->attempts++ % r->verify_every
+	  && ! intrinsics_verify (e, machine))
+	{
+	  fprintf (stderr, "intrinsic %s: diverges from the interpretation at instruction %llu, disabled\n"
+		   , e->intrinsic.name
+		   , machine->stats.instructions);
+	  e->divergences++;
+	  e->state = INTRINSIC_DISABLED;
+	  return;
+	}
+
+      before = machine->stats.instructions;
+
+      if (EOK == e->intrinsic.run (machine))
+	{
+	  e->calls++;
+	  e->instructions += machine->stats.instructions - before;
+	}
+
+      return;
+    }
+}
+
+void um_intrinsics_amend (void * intrinsics
+			  , platter_t offset)
+{
+  intrinsics_t * r = (intrinsics_t *) intrinsics;
+  size_t i = 0;
+
+  if (offset < r->low || offset >= r->high)
+    {
+      return;
+    }
+
+  for (i = 0; i < r->count; ++i)
+    {
+      intrinsic_entry_t * e = &r->entries[i];
+
+      if (INTRINSIC_DISABLED != e->state
+	  && offset >= e->intrinsic.entry
+	  && offset - e->intrinsic.entry < e->intrinsic.length)
+	{
+	  e->state = INTRINSIC_UNCHECKED;
+	}
+    }
+}
+
+void um_intrinsics_reload (void * intrinsics)
+{
+  intrinsics_t * r = (intrinsics_t *) intrinsics;
+  size_t i = 0;
+
+  for (i = 0; i < r->count; ++i)
+    {
+      if (INTRINSIC_DISABLED != r->entries[i].state)
+	{
+	  r->entries[i].state = INTRINSIC_UNCHECKED;
+	}
+    }
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_intrinsics_enable (struct um_t * machine
+			  , unsigned int verify_every)
+{
+  intrinsics_t * r = NULL;
+  size_t i = 0;
+
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+
+  if (NULL != machine->intrinsics)
+    {
+      return EBUSY;
+    }
+
+  r = (intrinsics_t *) calloc (1, sizeof(intrinsics_t));
+  if (NULL == r)
+    {
+      return ENOMEM;
+    }
+
+  r->verify_every = verify_every;
+  r->low = ~0U;
+  machine->intrinsics = r;
+
+  for (i = 0; i < sizeof(g_builtin_intrinsics) / sizeof(g_builtin_intrinsics[0]); ++i)
+    {
+      um_intrinsics_register (machine, &g_builtin_intrinsics[i]);
+    }
+
+  return EOK;
+}
+
+int um_intrinsics_register (struct um_t * machine
+			    , const um_intrinsic_t * intrinsic)
+{
+  intrinsics_t * r = NULL;
+  intrinsic_entry_t * e = NULL;
+
+  if (NULL == machine || NULL == machine->intrinsics
+      || NULL == intrinsic || NULL == intrinsic->run || 0 == intrinsic->length)
+    {
+      return EINVAL;
+    }
+
+  r = (intrinsics_t *) machine->intrinsics;
+  if (INTRINSICS_CAPACITY == r->count)
+    {
+      return ENOSPC;
+    }
+
+  e = &r->entries[r->count++];
+  memset (e, 0, sizeof(*e));
+  e->intrinsic = *intrinsic;
+  e->state = INTRINSIC_UNCHECKED;
+
+  r->filter |= 1ULL << (intrinsic->entry & 63);
+  if (intrinsic->entry < r->low)
+    {
+      r->low = intrinsic->entry;
+    }
+  if (intrinsic->entry + intrinsic->length > r->high)
+    {
+      r->high = intrinsic->entry + intrinsic->length;
+    }
+
+  return EOK;
+}
+
+int um_intrinsics_disable (struct um_t * machine)
+{
+  if (NULL == machine || NULL == machine->intrinsics)
+    {
+      return EINVAL;
+    }
+
+  free (machine->intrinsics);
+  machine->intrinsics = NULL;
+
+  return EOK;
+}
+
+void um_intrinsics_report (FILE * out
+			   , struct um_t * machine)
+{
+  const intrinsics_t * r = (const intrinsics_t *) machine->intrinsics;
+  size_t i = 0;
+
+  for (i = 0; NULL != r && i < r->count; ++i)
+    {
+      const intrinsic_entry_t * e = &r->entries[i];
+
+      if (0 == e->calls && 0 == e->verifications && 0 == e->divergences)
+	{
+	  continue;
+	}
+
+      fprintf (out
+	       , "intrinsic %s: %llu calls for %llu instructions, %llu verified, %llu divergences\n"
+	       , e->intrinsic.name
+	       , e->calls
+	       , e->instructions
+	       , e->verifications
+	       , e->divergences);
+    }
+}
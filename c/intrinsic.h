@@ -0,0 +1,84 @@
+#if ! defined (INTRINSIC_H)
+#define INTRINSIC_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Native replacements of guest routines.
+ *
+ * An intrinsic is keyed by the ip of its entry and the hash of the
+ * platters of the program array it covers. When the load program operator
+ * jumps to the entry of an intrinsic whose platters are the registered
+ * ones, its function runs instead of the guest code and leaves the
+ * registers, the arrays, the ip, the status and the instruction count
+ * exactly as interpreting the routine would have. Amending those platters
+ * or loading another program makes them checked again on the next entry.
+ *
+ * The built-in intrinsics replace the hot loops of data/codex.umz: the
+ * copy of the decompressor and the dump of the decrypted image.
+ */
+
+typedef struct um_intrinsic_t
+{
+  const char * name;
+
+  address_t entry;
+
+  // platters of array 0 from entry whose big endian bytes (as in the
+  // program image) hash (FNV-1a) to hash
+  platter_t length;
+  unsigned long long hash;
+
+  /**
+   * Called with machine->ip == entry.
+   *
+   * @return EOK, EAGAIN when the routine has to be interpreted (the
+   * machine must be left untouched then)
+   */
+  int (* run) (struct um_t * machine);
+
+} um_intrinsic_t;
+
+/**
+ * Attaches a registry holding the built-in intrinsics to the machine.
+ *
+ * @param verify_every when not 0, one call out of verify_every of each
+ * intrinsic is first run on a copy of the machine and compared with the
+ * interpretation of the routine on another copy; an intrinsic that
+ * diverges is reported on stderr and disabled
+ */
+int um_intrinsics_enable (struct um_t * machine
+			  , unsigned int verify_every);
+
+/**
+ * @return ENOSPC when the registry is full
+ */
+int um_intrinsics_register (struct um_t * machine
+			    , const um_intrinsic_t * intrinsic);
+
+int um_intrinsics_disable (struct um_t * machine);
+
+/**
+ * Calls, guest instructions replaced, verifications and divergences of
+ * every intrinsic entered at least once.
+ */
+void um_intrinsics_report (FILE * out
+			   , struct um_t * machine);
+
+/**
+ * Called by the VM after the load program operator set the ip.
+ */
+void um_intrinsics_jump (void * intrinsics
+			 , struct um_t * machine);
+
+/**
+ * Called by the VM when array 0 is amended at offset / replaced.
+ */
+void um_intrinsics_amend (void * intrinsics
+			  , platter_t offset);
+
+void um_intrinsics_reload (void * intrinsics);
+
+#endif // INTRINSIC_H
@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "um_priv.h"
+#include "iopipe.h"
+
+
+typedef enum IOPIPE_CONSTANTS
+  {
+    // the writer waits for that many bytes, a flush or the delay
+    IOPIPE_BATCH = 4096,
+    IOPIPE_DELAY_NS = 1000000,
+
+  } IOPIPE_CONSTANTS;
+
+
+typedef struct iopipe_ring_t
+{
+  byte * data;
+  size_t mask;
+
+  // free running positions, written by the consumer / the producer
+  size_t head;
+  size_t tail;
+
+  // no more bytes will be produced (end of the input, close) / the
+  // bytes produced are wanted now
+  int ended;
+  int flush;
+
+  // slow path, taken by a side that has to wait, woken up when the ring
+  // holds wanted bytes (0 when waiting for room)
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int sleepers;
+  size_t wanted;
+
+} iopipe_ring_t;
+
+
+struct um_iopipe_t
+{
+  struct um_t * machine;
+  um_io_t io;
+
+  int input_fd;
+  int output_fd;
+
+  iopipe_ring_t input;
+  iopipe_ring_t output;
+
+  pthread_t reader;
+  pthread_t writer;
+
+  int stopping;
+
+  um_iopipe_stats_t stats;
+};
+
+
+//////////////////////////////////////
+// rings
+//////////////////////////////////////
+
+static int iopipe_ring_init (iopipe_ring_t * r, size_t capacity)
+{
+  size_t size = 2;
+
+  while (size < capacity)
+    {
+      size *= 2;
+    }
+
+  memset (r, 0, sizeof(*r));
+
+  r->data = (byte *) malloc (size);
+  if (NULL == r->data)
+    {
+      return ENOMEM;
+    }
+
+  r->mask = size - 1;
+  pthread_mutex_init (&r->lock, NULL);
+  pthread_cond_init (&r->changed, NULL);
+
+  return EOK;
+}
+
+static void iopipe_ring_destroy (iopipe_ring_t * r)
+{
+  pthread_cond_destroy (&r->changed);
+  pthread_mutex_destroy (&r->lock);
+  free (r->data);
+}
+
+static size_t iopipe_ring_used (iopipe_ring_t * r)
+{
+  return __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE) - __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+}
+
+// after a position changed, the waiting side is woken up if what it
+// waits for happened
+static void iopipe_ring_notify (iopipe_ring_t * r, int force)
+{
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+  if (0 != __atomic_load_n (&r->sleepers, __ATOMIC_RELAXED)
+      && (force || iopipe_ring_used (r) >= __atomic_load_n (&r->wanted, __ATOMIC_RELAXED)))
+    {
+      pthread_mutex_lock (&r->lock);
+      pthread_cond_broadcast (&r->changed);
+      pthread_mutex_unlock (&r->lock);
+    }
+}
+
+/**
+ * Waits until the ring holds bytes, room when bytes is 0, or the ring or
+ * the pipe ended. A flush only ends the waits for bytes: the writer
+ * waits for the ones there are.
+ *
+ * @param delay_ns gives up after that delay when not 0
+ */
+static void iopipe_ring_wait (iopipe_ring_t * r, size_t bytes, long delay_ns, const int * stopping)
+{
+  struct timespec deadline;
+
+  if (0 != delay_ns)
+    {
+      clock_gettime (CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += delay_ns;
+      if (deadline.tv_nsec >= 1000000000L)
+	{
+	  deadline.tv_sec++;
+	  deadline.tv_nsec -= 1000000000L;
+	}
+    }
+
+  pthread_mutex_lock (&r->lock);
+  __atomic_store_n (&r->wanted, bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&r->sleepers, 1, __ATOMIC_SEQ_CST);
+
+  while ( ! __atomic_load_n (stopping, __ATOMIC_ACQUIRE)
+	 && ! __atomic_load_n (&r->ended, __ATOMIC_ACQUIRE)
+	 && (0 == bytes || ! __atomic_load_n (&r->flush, __ATOMIC_ACQUIRE)))
+    {
+      const size_t used = iopipe_ring_used (r);
+
+      if (0 != bytes ? used >= bytes : used <= r->mask)
+	{
+	  break;
+	}
+
+      if (0 != delay_ns)
+	{
+	  if (ETIMEDOUT == pthread_cond_timedwait (&r->changed, &r->lock, &deadline))
+	    {
+	      break;
+	    }
+	}
+      else
+	{
+	  pthread_cond_wait (&r->changed, &r->lock);
+	}
+    }
+
+  __atomic_sub_fetch (&r->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock (&r->lock);
+}
+
+
+//////////////////////////////////////
+// threads
+//////////////////////////////////////
+
+static void * iopipe_writer (void * argument)
+{
+  um_iopipe_t * p = (um_iopipe_t *) argument;
+  iopipe_ring_t * r = &p->output;
+
+  while (1)
+    {
+      size_t head = 0;
+      size_t used = iopipe_ring_used (r);
+      size_t chunk = 0;
+      ssize_t written = 0;
+
+      if (0 == used)
+	{
+	  if (__atomic_load_n (&r->ended, __ATOMIC_ACQUIRE) && 0 == iopipe_ring_used (r))
+	    {
+	      break;
+	    }
+	  __atomic_store_n (&r->flush, 0, __ATOMIC_RELAXED);
+	  iopipe_ring_wait (r, 1, 0, &p->stopping);
+	  continue;
+	}
+
+      // a few bytes at a time would cost a system call each
+      if (used < IOPIPE_BATCH)
+	{
+	  iopipe_ring_wait (r, IOPIPE_BATCH, IOPIPE_DELAY_NS, &p->stopping);
+	  used = iopipe_ring_used (r);
+	}
+      __atomic_store_n (&r->flush, 0, __ATOMIC_RELAXED);
+
+      head = r->head;
+      chunk = used;
+
+      // up to the end of the buffer
+      if ((head & r->mask) + chunk > r->mask + 1)
+	{
+	  chunk = r->mask + 1 - (head & r->mask);
+	}
+
+      written = write (p->output_fd, r->data + (head & r->mask), chunk);
+      if (written < 0 && EINTR == errno)
+	{
+	  continue;
+	}
+
+      p->stats.writes++;
+
+      // the output is lost, the machine is not stopped for that
+      if (written <= 0)
+	{
+	  written = chunk;
+	}
+
+      // the interpreter waits for room or for the flush
+      __atomic_store_n (&r->head, head + written, __ATOMIC_RELEASE);
+      iopipe_ring_notify (r, 1);
+    }
+
+  return NULL;
+}
+
+static void * iopipe_reader (void * argument)
+{
+  um_iopipe_t * p = (um_iopipe_t *) argument;
+  iopipe_ring_t * r = &p->input;
+
+  // only cancelled while blocked in read
+  pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+
+  while ( ! __atomic_load_n (&p->stopping, __ATOMIC_ACQUIRE))
+    {
+      const size_t tail = r->tail;
+      const size_t used = iopipe_ring_used (r);
+      size_t chunk = r->mask + 1 - used;
+      ssize_t n = 0;
+
+      if (0 == chunk)
+	{
+	  iopipe_ring_wait (r, 0, 0, &p->stopping);
+	  continue;
+	}
+
+      if ((tail & r->mask) + chunk > r->mask + 1)
+	{
+	  chunk = r->mask + 1 - (tail & r->mask);
+	}
+
+      pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+      n = read (p->input_fd, r->data + (tail & r->mask), chunk);
+      pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+
+      if (n < 0 && EINTR == errno)
+	{
+	  continue;
+	}
+
+      p->stats.reads++;
+
+      if (n <= 0)
+	{
+	  __atomic_store_n (&r->ended, 1, __ATOMIC_RELEASE);
+	  iopipe_ring_notify (r, 1);
+	  break;
+	}
+
+      __atomic_store_n (&r->tail, tail + n, __ATOMIC_RELEASE);
+      iopipe_ring_notify (r, 0);
+    }
+
+  return NULL;
+}
+
+
+//////////////////////////////////////
+// hooks, on the interpreter thread
+//////////////////////////////////////
+
+static int iopipe_output (void * context, byte c)
+{
+  um_iopipe_t * p = (um_iopipe_t *) context;
+  iopipe_ring_t * r = &p->output;
+  const size_t tail = r->tail;
+
+  if (tail - __atomic_load_n (&r->head, __ATOMIC_ACQUIRE) > r->mask)
+    {
+      p->stats.output_waits++;
+    }
+
+  while (tail - __atomic_load_n (&r->head, __ATOMIC_ACQUIRE) > r->mask)
+    {
+      // no writer left to make room, the byte is lost
+      if (__atomic_load_n (&p->stopping, __ATOMIC_ACQUIRE)
+	  || __atomic_load_n (&r->ended, __ATOMIC_ACQUIRE))
+	{
+	  return EOK;
+	}
+
+      iopipe_ring_wait (r, 0, 0, &p->stopping);
+    }
+
+  r->data[tail & r->mask] = c;
+  __atomic_store_n (&r->tail, tail + 1, __ATOMIC_RELEASE);
+  p->stats.output_bytes++;
+
+  iopipe_ring_notify (r, 0);
+
+  return EOK;
+}
+
+static int iopipe_input (void * context)
+{
+  um_iopipe_t * p = (um_iopipe_t *) context;
+  iopipe_ring_t * r = &p->input;
+  const size_t head = r->head;
+  int c = 0;
+
+  if (head == __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE))
+    {
+      if (__atomic_load_n (&r->ended, __ATOMIC_ACQUIRE)
+	  && head == __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE))
+	{
+	  return EOF;
+	}
+
+      // the prompt has to be shown before waiting for the answer
+      __atomic_store_n (&p->output.flush, 1, __ATOMIC_RELEASE);
+      iopipe_ring_notify (&p->output, 1);
+
+      p->stats.input_waits++;
+      iopipe_ring_wait (r, 1, 0, &p->stopping);
+
+      if (head == __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE))
+	{
+	  return EOF;
+	}
+    }
+
+  c = r->data[head & r->mask];
+  __atomic_store_n (&r->head, head + 1, __ATOMIC_RELEASE);
+  p->stats.input_bytes++;
+
+  iopipe_ring_notify (r, 0);
+
+  return c;
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_iopipe_open (um_iopipe_t ** pipe
+		    , int input_fd
+		    , int output_fd
+		    , size_t capacity
+		    , struct um_t * machine)
+{
+  um_iopipe_t * p = NULL;
+  int err = EOK;
+
+  if (NULL == pipe || NULL == machine || 0 == capacity)
+    {
+      return EINVAL;
+    }
+
+  p = (um_iopipe_t *) calloc (1, sizeof(um_iopipe_t));
+  if (NULL == p)
+    {
+      return ENOMEM;
+    }
+
+  p->machine = machine;
+  p->input_fd = input_fd;
+  p->output_fd = output_fd;
+
+  if (EOK != (err = iopipe_ring_init (&p->input, capacity)))
+    {
+      free (p);
+      return err;
+    }
+  if (EOK != (err = iopipe_ring_init (&p->output, capacity)))
+    {
+      iopipe_ring_destroy (&p->input);
+      free (p);
+      return err;
+    }
+
+  if (0 != (err = pthread_create (&p->writer, NULL, iopipe_writer, p)))
+    {
+      iopipe_ring_destroy (&p->output);
+      iopipe_ring_destroy (&p->input);
+      free (p);
+      return err;
+    }
+  if (0 != (err = pthread_create (&p->reader, NULL, iopipe_reader, p)))
+    {
+      __atomic_store_n (&p->output.ended, 1, __ATOMIC_RELEASE);
+      iopipe_ring_notify (&p->output, 1);
+      pthread_join (p->writer, NULL);
+      iopipe_ring_destroy (&p->output);
+      iopipe_ring_destroy (&p->input);
+      free (p);
+      return err;
+    }
+
+  p->io = machine->io;
+  machine->io.input = iopipe_input;
+  machine->io.output = iopipe_output;
+  machine->io.context = p;
+
+  *pipe = p;
+
+  return EOK;
+}
+
+int um_iopipe_flush (um_iopipe_t * pipe)
+{
+  iopipe_ring_t * r = NULL;
+
+  if (NULL == pipe)
+    {
+      return EINVAL;
+    }
+
+  r = &pipe->output;
+
+  __atomic_store_n (&r->flush, 1, __ATOMIC_RELEASE);
+  iopipe_ring_notify (r, 1);
+
+  // woken up after each write of the writer
+  pthread_mutex_lock (&r->lock);
+  __atomic_store_n (&r->wanted, 0, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&r->sleepers, 1, __ATOMIC_SEQ_CST);
+
+  while (0 != iopipe_ring_used (r))
+    {
+      __atomic_store_n (&r->flush, 1, __ATOMIC_RELEASE);
+      pthread_cond_broadcast (&r->changed);
+      pthread_cond_wait (&r->changed, &r->lock);
+    }
+
+  __atomic_sub_fetch (&r->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock (&r->lock);
+
+  return EOK;
+}
+
+int um_iopipe_close (um_iopipe_t * pipe)
+{
+  if (NULL == pipe)
+    {
+      return EINVAL;
+    }
+
+  // the writer ends once the ring is empty
+  __atomic_store_n (&pipe->output.ended, 1, __ATOMIC_RELEASE);
+  iopipe_ring_notify (&pipe->output, 1);
+  pthread_join (pipe->writer, NULL);
+
+  // the reader can be blocked in read or waiting for room
+  __atomic_store_n (&pipe->stopping, 1, __ATOMIC_RELEASE);
+  pthread_cancel (pipe->reader);
+  pthread_mutex_lock (&pipe->input.lock);
+  pthread_cond_broadcast (&pipe->input.changed);
+  pthread_mutex_unlock (&pipe->input.lock);
+  pthread_join (pipe->reader, NULL);
+
+  pipe->machine->io = pipe->io;
+
+  iopipe_ring_destroy (&pipe->output);
+  iopipe_ring_destroy (&pipe->input);
+  free (pipe);
+
+  return EOK;
+}
+
+void um_iopipe_get_stats (um_iopipe_t * pipe
+			  , um_iopipe_stats_t * stats)
+{
+  *stats = pipe->stats;
+}
+
+void um_iopipe_report (FILE * out
+		       , um_iopipe_t * pipe)
+{
+  const um_iopipe_stats_t * s = &pipe->stats;
+
+  fprintf (out
+	   , "io: %llu bytes out in %llu writes (%llu waits for room)"
+	   ", %llu bytes in from %llu reads (%llu waits for input)\n"
+	   , s->output_bytes
+	   , s->writes
+	   , s->output_waits
+	   , s->input_bytes
+	   , s->reads
+	   , s->input_waits);
+}
@@ -0,0 +1,67 @@
+#if ! defined (IOPIPE_H)
+#define IOPIPE_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Threaded I/O for a machine.
+ *
+ * The output operator appends its byte to a single producer / single
+ * consumer ring emptied by a writer thread, and the input operator takes
+ * its byte from a ring filled by a reader thread, so that the interpreter
+ * makes no system call: it only waits when the output ring is full or
+ * when it needs input that did not arrive yet.
+ */
+
+typedef struct um_iopipe_t um_iopipe_t;
+
+typedef struct um_iopipe_stats_t
+{
+  unsigned long long output_bytes;
+  unsigned long long input_bytes;
+
+  // write / read system calls of the I/O threads
+  unsigned long long writes;
+  unsigned long long reads;
+
+  // times the interpreter waited for room in the output ring / for input
+  unsigned long long output_waits;
+  unsigned long long input_waits;
+
+} um_iopipe_stats_t;
+
+/**
+ * Starts the I/O threads and sets the hooks of the machine.
+ *
+ * @param pipe
+ * @param input_fd
+ * @param output_fd
+ * @param capacity bytes of each ring, rounded up to a power of 2
+ * @param machine
+ */
+int um_iopipe_open (um_iopipe_t ** pipe
+		    , int input_fd
+		    , int output_fd
+		    , size_t capacity
+		    , struct um_t * machine);
+
+/**
+ * Waits until the output produced so far is written.
+ */
+int um_iopipe_flush (um_iopipe_t * pipe);
+
+/**
+ * Writes the pending output, stops the threads and gives the machine its
+ * hooks back.
+ */
+int um_iopipe_close (um_iopipe_t * pipe);
+
+void um_iopipe_get_stats (um_iopipe_t * pipe
+			  , um_iopipe_stats_t * stats);
+
+void um_iopipe_report (FILE * out
+		       , um_iopipe_t * pipe);
+
+#endif // IOPIPE_H
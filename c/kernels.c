@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#   include <immintrin.h>
+#   define KERNELS_X86 1
+#endif
+
+#include "um_priv.h"
+#include "kernels.h"
+
+
+typedef void (* swap_func) (platter_t * out, const platter_t * in, size_t count);
+
+
+static void kernels_swap_scalar (platter_t * out
+				 , const platter_t * in
+				 , size_t count)
+{
+  size_t i = 0;
+
+  for (i = 0; i < count; ++i)
+    {
+      out[i] = __builtin_bswap32 (in[i]);
+    }
+}
+
+#if defined (KERNELS_X86)
+
+// SSE2 has no byte shuffle, the bytes are moved with shifts and masks
+__attribute__ ((target ("sse2")))
+static void kernels_swap_sse2 (platter_t * out
+			       , const platter_t * in
+			       , size_t count)
+{
+  const __m128i mask = _mm_set1_epi32 (0x00FF00FF);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (in + i));
+
+      // swaps the 16 bits halves, then the bytes of each half
+      v = _mm_or_si128 (_mm_slli_epi32 (v, 16), _mm_srli_epi32 (v, 16));
+      v = _mm_or_si128 (_mm_slli_epi16 (_mm_and_si128 (v, mask), 8)
+			, _mm_and_si128 (_mm_srli_epi16 (v, 8), mask));
+
+      _mm_storeu_si128 ((__m128i *) (out + i), v);
+    }
+
+  kernels_swap_scalar (out + i, in + i, count - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void kernels_swap_avx2 (platter_t * out
+			       , const platter_t * in
+			       , size_t count)
+{
+  const __m256i order = _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4
+					  , 11, 10, 9, 8, 15, 14, 13, 12
+					  , 3, 2, 1, 0, 7, 6, 5, 4
+					  , 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16)
+    {
+      __m256i a = _mm256_loadu_si256 ((const __m256i *) (in + i));
+      __m256i b = _mm256_loadu_si256 ((const __m256i *) (in + i + 8));
+
+      _mm256_storeu_si256 ((__m256i *) (out + i), _mm256_shuffle_epi8 (a, order));
+      _mm256_storeu_si256 ((__m256i *) (out + i + 8), _mm256_shuffle_epi8 (b, order));
+    }
+
+  kernels_swap_scalar (out + i, in + i, count - i);
+}
+
+#endif // KERNELS_X86
+
+
+static const struct
+{
+  const char * name;
+  swap_func swap;
+
+} g_kernels [UM_KERNEL_COUNT] = {
+
+  [UM_KERNEL_SCALAR] = { "scalar", kernels_swap_scalar },
+#if defined (KERNELS_X86)
+  [UM_KERNEL_SSE2] = { "sse2", kernels_swap_sse2 },
+  [UM_KERNEL_AVX2] = { "avx2", kernels_swap_avx2 },
+#else
+  [UM_KERNEL_SSE2] = { "sse2", NULL },
+  [UM_KERNEL_AVX2] = { "avx2", NULL },
+#endif
+};
+
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static um_kernel_t g_selected = UM_KERNEL_SCALAR;
+
+static void kernels_priv_select_best (void)
+{
+  um_kernel_t k = UM_KERNEL_COUNT;
+
+  while (k-- > UM_KERNEL_SCALAR)
+    {
+      if (um_kernels_supported (k))
+	{
+	  g_selected = k;
+	  break;
+	}
+    }
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+void um_kernels_swap_platters (platter_t * out
+			       , const platter_t * in
+			       , size_t count)
+{
+  pthread_once (&g_once, kernels_priv_select_best);
+
+  g_kernels [g_selected].swap (out, in, count);
+}
+
+um_kernel_t um_kernels_selected (void)
+{
+  pthread_once (&g_once, kernels_priv_select_best);
+
+  return g_selected;
+}
+
+int um_kernels_select (um_kernel_t kernel)
+{
+  pthread_once (&g_once, kernels_priv_select_best);
+
+  if (kernel >= UM_KERNEL_COUNT)
+    {
+      return EINVAL;
+    }
+
+  if ( ! um_kernels_supported (kernel))
+    {
+      return ENOTSUP;
+    }
+
+  g_selected = kernel;
+
+  return EOK;
+}
+
+int um_kernels_supported (um_kernel_t kernel)
+{
+  switch (kernel)
+    {
+    case UM_KERNEL_SCALAR:
+      return 1;
+#if defined (KERNELS_X86)
+    case UM_KERNEL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case UM_KERNEL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+    default:
+      break;
+    }
+
+  return 0;
+}
+
+const char * um_kernels_name (um_kernel_t kernel)
+{
+  return kernel < UM_KERNEL_COUNT ? g_kernels [kernel].name : "unknown";
+}
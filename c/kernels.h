@@ -0,0 +1,52 @@
+#if ! defined (KERNELS_H)
+#define KERNELS_H
+
+#include <stddef.h>
+
+#include "um.h"
+
+/**
+ * Vectorized kernels of the bulk platter operations.
+ *
+ * The arrays are stored big endian, as in the program image, so that
+ * loading, copying and zeroing them are plain memcpy / calloc (glibc
+ * already picks their SIMD variant at run time). What is left is the
+ * conversion of ranges of platters to and from the native order, done
+ * by the AVX2 or the SSE2 kernel when the CPU has it, and by the scalar
+ * one otherwise. The kernel is selected at the first call.
+ */
+
+typedef enum um_kernel_t
+  {
+    UM_KERNEL_SCALAR,
+    UM_KERNEL_SSE2,
+    UM_KERNEL_AVX2,
+
+    UM_KERNEL_COUNT,
+
+  } um_kernel_t;
+
+/**
+ * Byte swaps count platters from in to out, which may be the same.
+ */
+void um_kernels_swap_platters (platter_t * out
+			       , const platter_t * in
+			       , size_t count);
+
+/**
+ * @return the kernel used by um_kernels_swap_platters
+ */
+um_kernel_t um_kernels_selected (void);
+
+/**
+ * Forces a kernel, for the benchmarks and the comparisons.
+ *
+ * @return ENOTSUP if the CPU cannot run it
+ */
+int um_kernels_select (um_kernel_t kernel);
+
+int um_kernels_supported (um_kernel_t kernel);
+
+const char * um_kernels_name (um_kernel_t kernel);
+
+#endif // KERNELS_H
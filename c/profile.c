@@ -0,0 +1,571 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+
+#include "um_priv.h"
+#include "profile.h"
+
+
+typedef enum PROFILE_CONSTANTS
+  {
+    PROFILE_VERSION = 1,
+
+    // log2 buckets of the sizes (in platters) and of the lifetimes
+    PROFILE_BUCKETS = 66,
+
+    // allocation sites printed by the report
+    PROFILE_TOP_SITES = 16,
+
+  } PROFILE_CONSTANTS;
+
+
+typedef struct live_entry_t
+{
+  platter_t id;
+  platter_t size;
+  address_t site;
+  int used;
+  unsigned long long birth;
+
+} live_entry_t;
+
+
+typedef struct site_entry_t
+{
+  address_t ip;
+  int used;
+
+  unsigned long long allocations;
+  unsigned long long bytes;
+  unsigned long long releases;
+  unsigned long long lifetime;
+
+} site_entry_t;
+
+
+typedef struct table_t
+{
+  void * entries;
+  size_t capacity;
+  size_t count;
+
+} table_t;
+
+
+struct um_profile_t
+{
+  struct um_t * machine;
+  FILE * log;
+  unsigned long long last_event;
+
+  // live arrays by id, allocation sites by ip (open addressing)
+  table_t live;
+  table_t sites;
+
+  unsigned long long allocations;
+  unsigned long long releases;
+  unsigned long long live_bytes;
+  unsigned long long peak_live;
+  unsigned long long peak_live_bytes;
+
+  // releases of the most recently allocated array still alive
+  platter_t last_allocated;
+  unsigned long long lifo_releases;
+
+  unsigned long long size_allocations [PROFILE_BUCKETS];
+  unsigned long long size_bytes [PROFILE_BUCKETS];
+  unsigned long long size_releases [PROFILE_BUCKETS];
+  unsigned long long size_lifetime [PROFILE_BUCKETS];
+  unsigned long long lifetimes [PROFILE_BUCKETS];
+};
+
+
+static volatile sig_atomic_t g_report_requested = 0;
+
+static void profile_on_signal (int sig)
+{
+  g_report_requested = 1;
+}
+
+/**
+ * @return 0 for 0, 1 + floor (log2 (v)) otherwise
+ */
+static unsigned int profile_bucket (unsigned long long v)
+{
+  unsigned int b = 0;
+  while (0 != v)
+    {
+      v >>= 1;
+      b++;
+    }
+  return b;
+}
+
+static size_t profile_hash (platter_t key, size_t capacity)
+{
+  return (key * 2654435761U) & (capacity - 1);
+}
+
+
+//////////////////////////////////////
+// tables
+//////////////////////////////////////
+
+static int live_grow (table_t * t)
+{
+  const size_t capacity = 0 == t->capacity ? 1024 : 2 * t->capacity;
+  live_entry_t * entries = (live_entry_t *) calloc (capacity, sizeof(live_entry_t));
+  live_entry_t * old = (live_entry_t *) t->entries;
+  size_t i = 0;
+
+  if (NULL == entries)
+    {
+      return ENOMEM;
+    }
+
+  for (i = 0; i < t->capacity; ++i)
+    {
+      if (old[i].used)
+	{
+	  size_t h = profile_hash (old[i].id, capacity);
+	  while (entries[h].used)
+	    {
+	      h = (h + 1) & (capacity - 1);
+	    }
+	  entries[h] = old[i];
+	}
+    }
+
+  free (old);
+  t->entries = entries;
+  t->capacity = capacity;
+
+  return EOK;
+}
+
+static live_entry_t * live_find (table_t * t, platter_t id)
+{
+  live_entry_t * entries = (live_entry_t *) t->entries;
+  size_t h = 0;
+
+  if (0 == t->capacity)
+    {
+      return NULL;
+    }
+
+  for (h = profile_hash (id, t->capacity); entries[h].used; h = (h + 1) & (t->capacity - 1))
+    {
+      if (entries[h].id == id)
+	{
+	  return &entries[h];
+	}
+    }
+
+  return NULL;
+}
+
+static void live_insert (table_t * t, const live_entry_t * e)
+{
+  live_entry_t * entries = NULL;
+  size_t h = 0;
+
+  if (2 * (t->count + 1) > t->capacity && EOK != live_grow (t))
+    {
+      return;
+    }
+
+  entries = (live_entry_t *) t->entries;
+  for (h = profile_hash (e->id, t->capacity); entries[h].used; h = (h + 1) & (t->capacity - 1))
+    ;
+
+  entries[h] = *e;
+  entries[h].used = 1;
+  t->count++;
+}
+
+/**
+ * Removes e, shifting back the entries of its probe sequence.
+ */
+static void live_remove (table_t * t, live_entry_t * e)
+{
+  live_entry_t * entries = (live_entry_t *) t->entries;
+  const size_t mask = t->capacity - 1;
+  size_t hole = e - entries;
+  size_t i = (hole + 1) & mask;
+
+  for (; entries[i].used; i = (i + 1) & mask)
+    {
+      const size_t home = profile_hash (entries[i].id, t->capacity);
+
+      // moves i into the hole unless its home is cyclically in ]hole, i]
+      if (((i - home) & mask) >= ((i - hole) & mask))
+	{
+	  entries[hole] = entries[i];
+	  hole = i;
+	}
+    }
+
+  entries[hole].used = 0;
+  t->count--;
+}
+
+static site_entry_t * site_get (table_t * t, address_t ip)
+{
+  site_entry_t * entries = NULL;
+  size_t h = 0;
+
+  if (2 * (t->count + 1) > t->capacity)
+    {
+      const size_t capacity = 0 == t->capacity ? 256 : 2 * t->capacity;
+      site_entry_t * grown = (site_entry_t *) calloc (capacity, sizeof(site_entry_t));
+      site_entry_t * old = (site_entry_t *) t->entries;
+      size_t i = 0;
+
+      if (NULL == grown)
+	{
+	  return NULL;
+	}
+
+      for (i = 0; i < t->capacity; ++i)
+	{
+	  if (old[i].used)
+	    {
+	      h = profile_hash (old[i].ip, capacity);
+	      while (grown[h].used)
+		{
+		  h = (h + 1) & (capacity - 1);
+		}
+	      grown[h] = old[i];
+	    }
+	}
+
+      free (old);
+      t->entries = grown;
+      t->capacity = capacity;
+    }
+
+  entries = (site_entry_t *) t->entries;
+  for (h = profile_hash (ip, t->capacity); entries[h].used; h = (h + 1) & (t->capacity - 1))
+    {
+      if (entries[h].ip == ip)
+	{
+	  return &entries[h];
+	}
+    }
+
+  entries[h].used = 1;
+  entries[h].ip = ip;
+  t->count++;
+
+  return &entries[h];
+}
+
+
+//////////////////////////////////////
+// event log
+//////////////////////////////////////
+
+static void profile_log (um_profile_t * profile
+			 , um_profile_event_t kind
+			 , platter_t id
+			 , platter_t size
+			 , address_t site)
+{
+  const unsigned long long now = profile->machine->stats.instructions;
+  byte record [1 + 4 * UM_PRIV_VARINT_MAX_SIZE];
+  size_t n = 0;
+
+  record[n++] = (byte) kind;
+  n += um_priv_put_varint (record + n, now - profile->last_event);
+  n += um_priv_put_varint (record + n, id);
+  n += um_priv_put_varint (record + n, size);
+
+  if (UM_PROFILE_ALLOCATION == kind)
+    {
+      n += um_priv_put_varint (record + n, site);
+    }
+
+  fwrite (record, 1, n, profile->log);
+
+  profile->last_event = now;
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_profile_open (um_profile_t ** profile
+		     , const char * log_path
+		     , struct um_t * machine)
+{
+  um_profile_t * p = NULL;
+
+  if (NULL == profile || NULL == machine)
+    {
+      return EINVAL;
+    }
+
+  p = (um_profile_t *) calloc (1, sizeof(um_profile_t));
+  if (NULL == p)
+    {
+      return ENOMEM;
+    }
+
+  if (NULL != log_path)
+    {
+      p->log = fopen (log_path, "wb");
+      if (NULL == p->log)
+	{
+	  int err = errno;
+	  free (p);
+	  return err;
+	}
+
+      setvbuf (p->log, NULL, _IOFBF, 1 << 20);
+      fwrite ("UMAL", 1, 4, p->log);
+      fputc (PROFILE_VERSION, p->log);
+    }
+
+  signal (SIGUSR1, profile_on_signal);
+
+  p->machine = machine;
+  machine->profile = p;
+
+  *profile = p;
+
+  return EOK;
+}
+
+int um_profile_close (um_profile_t * profile)
+{
+  if (NULL == profile)
+    {
+      return EINVAL;
+    }
+
+  if (NULL != profile->log)
+    {
+      fclose (profile->log);
+    }
+
+  if (NULL != profile->machine && profile == profile->machine->profile)
+    {
+      profile->machine->profile = NULL;
+    }
+
+  free (profile->live.entries);
+  free (profile->sites.entries);
+  free (profile);
+
+  return EOK;
+}
+
+void um_profile_allocated (void * profile
+			   , struct um_t * machine
+			   , platter_t id
+			   , platter_t size)
+{
+  um_profile_t * p = (um_profile_t *) profile;
+  const unsigned long long bytes = (unsigned long long) size * sizeof(platter_t);
+  const unsigned int bucket = profile_bucket (size);
+  live_entry_t e;
+  site_entry_t * site = NULL;
+
+  // the initial program array is not allocated by an instruction
+  e.id = id;
+  e.size = size;
+  e.site = 0 == machine->stats.instructions ? 0 : machine->ip - 1;
+  e.birth = machine->stats.instructions;
+
+  live_insert (&p->live, &e);
+
+  p->allocations++;
+  p->live_bytes += bytes;
+  p->last_allocated = id;
+
+  if (p->live.count > p->peak_live)
+    {
+      p->peak_live = p->live.count;
+    }
+  if (p->live_bytes > p->peak_live_bytes)
+    {
+      p->peak_live_bytes = p->live_bytes;
+    }
+
+  p->size_allocations [bucket]++;
+  p->size_bytes [bucket] += bytes;
+
+  site = site_get (&p->sites, e.site);
+  if (NULL != site)
+    {
+      site->allocations++;
+      site->bytes += bytes;
+    }
+
+  if (NULL != p->log)
+    {
+      profile_log (p, UM_PROFILE_ALLOCATION, id, size, e.site);
+    }
+}
+
+void um_profile_released (void * profile
+			  , struct um_t * machine
+			  , platter_t id
+			  , platter_t size)
+{
+  um_profile_t * p = (um_profile_t *) profile;
+  live_entry_t * e = live_find (&p->live, id);
+
+  p->releases++;
+
+  if (id == p->last_allocated)
+    {
+      p->lifo_releases++;
+    }
+
+  if (NULL != e)
+    {
+      const unsigned long long lifetime = machine->stats.instructions - e->birth;
+      const unsigned int bucket = profile_bucket (e->size);
+      site_entry_t * site = site_get (&p->sites, e->site);
+
+      p->live_bytes -= (unsigned long long) e->size * sizeof(platter_t);
+      p->size_releases [bucket]++;
+      p->size_lifetime [bucket] += lifetime;
+      p->lifetimes [profile_bucket (lifetime)]++;
+
+      if (NULL != site)
+	{
+	  site->releases++;
+	  site->lifetime += lifetime;
+	}
+
+      live_remove (&p->live, e);
+    }
+
+  if (NULL != p->log)
+    {
+      profile_log (p, UM_PROFILE_RELEASE, id, size, 0);
+    }
+}
+
+void um_profile_instruction (void * profile
+			     , struct um_t * machine)
+{
+  if (g_report_requested)
+    {
+      g_report_requested = 0;
+      um_profile_report (stderr, (um_profile_t *) profile);
+    }
+}
+
+static int profile_compare_sites (const void * a, const void * b)
+{
+  const site_entry_t * x = (const site_entry_t *) a;
+  const site_entry_t * y = (const site_entry_t *) b;
+  return x->allocations > y->allocations ? -1 : x->allocations < y->allocations;
+}
+
+static void profile_print_range (FILE * out, unsigned int bucket)
+{
+  char range [64];
+
+  if (bucket <= 1)
+    {
+      snprintf (range, sizeof(range), "%u", bucket);
+    }
+  else
+    {
+      snprintf (range, sizeof(range), "%llu-%llu", 1ULL << (bucket - 1), (1ULL << bucket) - 1);
+    }
+
+  fprintf (out, "  %-24s", range);
+}
+
+void um_profile_report (FILE * out
+			, um_profile_t * profile)
+{
+  um_profile_t * p = profile;
+  unsigned int b = 0;
+
+  if (NULL == out || NULL == p)
+    {
+      return;
+    }
+
+  fprintf (out
+	   , "allocation profile after %llu instructions: %llu allocations, %llu releases\n"
+	   , p->machine->stats.instructions, p->allocations, p->releases);
+  fprintf (out
+	   , "live: %lu arrays / %llu bytes, peak %llu arrays / %llu bytes\n"
+	   , (unsigned long) p->live.count, p->live_bytes, p->peak_live, p->peak_live_bytes);
+  fprintf (out
+	   , "releases of the last allocated array: %.1f%%\n"
+	   , 0 == p->releases ? 0.0 : 100.0 * p->lifo_releases / p->releases);
+
+  fprintf (out, "\n  %-24s %14s %16s %14s %18s\n"
+	   , "size (platters)", "allocations", "bytes", "releases", "mean lifetime");
+  for (b = 0; b < PROFILE_BUCKETS; ++b)
+    {
+      if (0 != p->size_allocations[b])
+	{
+	  profile_print_range (out, b);
+	  fprintf (out, " %14llu %16llu %14llu %18.0f\n"
+		   , p->size_allocations[b]
+		   , p->size_bytes[b]
+		   , p->size_releases[b]
+		   , 0 == p->size_releases[b] ? 0.0 : (double) p->size_lifetime[b] / p->size_releases[b]);
+	}
+    }
+
+  fprintf (out, "\n  %-24s %14s\n", "lifetime (instructions)", "releases");
+  for (b = 0; b < PROFILE_BUCKETS; ++b)
+    {
+      if (0 != p->lifetimes[b])
+	{
+	  profile_print_range (out, b);
+	  fprintf (out, " %14llu\n", p->lifetimes[b]);
+	}
+    }
+
+  if (0 != p->sites.count)
+    {
+      site_entry_t * sites = (site_entry_t *) malloc (p->sites.count * sizeof(site_entry_t));
+      const site_entry_t * entries = (const site_entry_t *) p->sites.entries;
+      size_t n = 0;
+      size_t i = 0;
+
+      for (i = 0; i < p->sites.capacity && NULL != sites; ++i)
+	{
+	  if (entries[i].used)
+	    {
+	      sites[n++] = entries[i];
+	    }
+	}
+
+      if (NULL != sites)
+	{
+	  qsort (sites, n, sizeof(site_entry_t), profile_compare_sites);
+
+	  fprintf (out, "\n  %-10s %14s %16s %14s %18s\n"
+		   , "site (ip)", "allocations", "bytes", "still live", "mean lifetime");
+	  for (i = 0; i < n && i < PROFILE_TOP_SITES; ++i)
+	    {
+	      fprintf (out, "  0x%08X %14llu %16llu %14llu %18.0f\n"
+		       , sites[i].ip
+		       , sites[i].allocations
+		       , sites[i].bytes
+		       , sites[i].allocations - sites[i].releases
+		       , 0 == sites[i].releases ? 0.0 : (double) sites[i].lifetime / sites[i].releases);
+	    }
+	}
+
+      free (sites);
+    }
+
+  fflush (out);
+}
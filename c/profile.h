@@ -0,0 +1,75 @@
+#if ! defined (PROFILE_H)
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Allocation lifetime profiler.
+ *
+ * Every array created or released by a machine is recorded: size
+ * histograms, lifetime in instructions, peak live arrays and bytes and
+ * the allocation sites (ip of the allocating instruction). The summary is
+ * printed by um_profile_report, and also on SIGUSR1 while the machine
+ * runs.
+ *
+ * The optional event log is a sequence of records, all numbers being
+ * unsigned LEB128 varints:
+ *
+ *   header: "UMAL" then the version byte
+ *   record: kind (1 allocation, 2 release), instructions executed since
+ *           the previous record, array id, size in platters and, for the
+ *           allocations only, the allocating ip
+ */
+
+typedef enum um_profile_event_t
+  {
+    UM_PROFILE_ALLOCATION = 1,
+    UM_PROFILE_RELEASE = 2,
+
+  } um_profile_event_t;
+
+typedef struct um_profile_t um_profile_t;
+
+/**
+ * Attaches a profiler to the machine.
+ *
+ * @param profile
+ * @param log_path event log file to create, NULL for none
+ * @param machine
+ */
+int um_profile_open (um_profile_t ** profile
+		     , const char * log_path
+		     , struct um_t * machine);
+
+/**
+ * Flushes the event log and detaches the profiler from its machine.
+ */
+int um_profile_close (um_profile_t * profile);
+
+void um_profile_report (FILE * out
+			, um_profile_t * profile);
+
+/**
+ * Called by the VM when an array is created (allocation, program load)
+ * or released (abandonment, program replacement, collection).
+ */
+void um_profile_allocated (void * profile
+			   , struct um_t * machine
+			   , platter_t id
+			   , platter_t size);
+
+void um_profile_released (void * profile
+			  , struct um_t * machine
+			  , platter_t id
+			  , platter_t size);
+
+/**
+ * Called by the VM before every instruction, prints the summary when one
+ * was requested with SIGUSR1.
+ */
+void um_profile_instruction (void * profile
+			     , struct um_t * machine);
+
+#endif // PROFILE_H
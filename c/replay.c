@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "um_priv.h"
+#include "replay.h"
+
+
+typedef enum REPLAY_CONSTANTS
+  {
+    REPLAY_VERSION = 1,
+
+  } REPLAY_CONSTANTS;
+
+
+static const char REPLAY_MAGIC [4] = { 'U', 'M', 'R', 'R' };
+
+
+typedef struct replay_header_t
+{
+  char magic[4];
+  unsigned int version;
+
+  // program array when the recording was started
+  unsigned long long program_size;
+  unsigned long long program_hash;
+
+} replay_header_t;
+
+
+// a record is a varint ((instruction delta << 1) | end of the input)
+// followed by the byte read unless it is the end of the input
+struct um_replay_t
+{
+  struct um_t * machine;
+  um_io_t io;
+  int flags;
+
+  // recording
+  FILE * file;
+
+  // playing, the whole log: data [cur, end)
+  byte * data;
+  const byte * cur;
+  const byte * end;
+
+  unsigned long long last_instruction;
+
+  um_replay_stats_t stats;
+};
+
+
+static unsigned long long replay_priv_program_hash (struct um_t * machine
+						    , unsigned long long * size)
+{
+  const ArrayCell * program = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+
+  *size = program->datasize;
+
+  return um_priv_fnv1a (UM_PRIV_FNV1A_BASIS
+			, program->data
+			, (size_t) program->datasize * sizeof(platter_t));
+}
+
+static int replay_priv_base_input (um_replay_t * r)
+{
+  return NULL != r->io.input ? r->io.input (r->io.context) : fgetc (stdin);
+}
+
+static int replay_priv_base_output (um_replay_t * r, byte c)
+{
+  if (NULL != r->io.output)
+    {
+      return r->io.output (r->io.context, c);
+    }
+
+  printf ("%c", c);
+
+  return EOK;
+}
+
+
+//////////////////////////////////////
+// recording
+//////////////////////////////////////
+
+static int replay_record_input (void * context)
+{
+  um_replay_t * r = (um_replay_t *) context;
+  const int c = replay_priv_base_input (r);
+
+  // retried later, logged once it is read
+  if (UM_INPUT_WOULD_BLOCK == c)
+    {
+      return c;
+    }
+
+  {
+    // the input instruction is already counted
+    const unsigned long long at = r->machine->stats.instructions;
+
+    byte record [UM_PRIV_VARINT_MAX_SIZE + 1];
+    size_t n = um_priv_put_varint (record, ((at - r->last_instruction) << 1) | (EOF == c));
+
+    if (EOF != c)
+      {
+	record[n++] = (byte) c;
+      }
+    fwrite (record, 1, n, r->file);
+
+    r->last_instruction = at;
+    r->stats.bytes++;
+  }
+
+  // what was read before a crash is what matters the most
+  fflush (r->file);
+
+  return c;
+}
+
+static int replay_record_output (void * context, byte c)
+{
+  return replay_priv_base_output ((um_replay_t *) context, c);
+}
+
+
+//////////////////////////////////////
+// playing
+//////////////////////////////////////
+
+static int replay_play_input (void * context)
+{
+  um_replay_t * r = (um_replay_t *) context;
+  unsigned long long h = 0;
+  int c = EOF;
+
+  if (r->cur == r->end)
+    {
+      return replay_priv_base_input (r);
+    }
+
+  // checked when the log was opened
+  um_priv_get_varint (&r->cur, r->end, &h);
+  if (0 == (h & 1))
+    {
+      c = *r->cur++;
+    }
+
+  r->last_instruction += h >> 1;
+  if (r->last_instruction != r->machine->stats.instructions)
+    {
+      r->stats.divergences++;
+    }
+  r->stats.bytes++;
+
+  if (r->cur == r->end)
+    {
+      r->stats.exhausted_at = r->machine->stats.instructions;
+    }
+
+  return c;
+}
+
+static int replay_play_output (void * context, byte c)
+{
+  um_replay_t * r = (um_replay_t *) context;
+
+  if ((r->flags & UM_REPLAY_QUIET) && r->cur != r->end)
+    {
+      return EOK;
+    }
+
+  return replay_priv_base_output (r, c);
+}
+
+/**
+ * Walks the records so that the input hook has nothing to check.
+ */
+static int replay_priv_validate (um_replay_t * r)
+{
+  const byte * start = r->cur;
+  int err = EOK;
+
+  while (r->cur < r->end)
+    {
+      unsigned long long h = 0;
+
+      if (EOK != (err = um_priv_get_varint (&r->cur, r->end, &h)))
+	{
+	  break;
+	}
+      if (0 == (h & 1))
+	{
+	  if (r->cur == r->end)
+	    {
+	      err = EINVAL;
+	      break;
+	    }
+	  r->cur++;
+	}
+    }
+
+  r->cur = start;
+
+  return err;
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_replay_record (um_replay_t ** replay
+		      , const char * path
+		      , struct um_t * machine)
+{
+  um_replay_t * r = NULL;
+  replay_header_t h;
+
+  if (NULL == replay || NULL == path || NULL == machine || NULL == machine->arrays)
+    {
+      return EINVAL;
+    }
+
+  r = (um_replay_t *) calloc (1, sizeof(um_replay_t));
+  if (NULL == r)
+    {
+      return ENOMEM;
+    }
+
+  r->file = fopen (path, "wb");
+  if (NULL == r->file)
+    {
+      int err = errno;
+      free (r);
+      return err;
+    }
+
+  memset (&h, 0, sizeof(h));
+  memcpy (h.magic, REPLAY_MAGIC, sizeof(h.magic));
+  h.version = REPLAY_VERSION;
+  h.program_hash = replay_priv_program_hash (machine, &h.program_size);
+
+  if (1 != fwrite (&h, sizeof(h), 1, r->file) || 0 != fflush (r->file))
+    {
+      int err = errno;
+      fclose (r->file);
+      free (r);
+      return err;
+    }
+
+  r->machine = machine;
+  r->last_instruction = machine->stats.instructions;
+  r->io = machine->io;
+
+  machine->io.input = replay_record_input;
+  machine->io.output = replay_record_output;
+  machine->io.context = r;
+
+  *replay = r;
+
+  return EOK;
+}
+
+int um_replay_play (um_replay_t ** replay
+		    , const char * path
+		    , struct um_t * machine
+		    , int flags)
+{
+  um_replay_t * r = NULL;
+  size_t size = 0;
+  int err = EOK;
+
+  if (NULL == replay || NULL == path || NULL == machine || NULL == machine->arrays)
+    {
+      return EINVAL;
+    }
+
+  r = (um_replay_t *) calloc (1, sizeof(um_replay_t));
+  if (NULL == r)
+    {
+      return ENOMEM;
+    }
+
+  // a few bytes per input byte, read at once
+  err = um_load_image (path, &r->data, &size);
+  if (EOK == err)
+    {
+      const replay_header_t * h = (const replay_header_t *) r->data;
+      unsigned long long program_size = 0;
+
+      if (size < sizeof(replay_header_t)
+	  || 0 != memcmp (h->magic, REPLAY_MAGIC, sizeof(h->magic))
+	  || REPLAY_VERSION != h->version
+	  || h->program_hash != replay_priv_program_hash (machine, &program_size)
+	  || h->program_size != program_size)
+	{
+	  err = EINVAL;
+	}
+    }
+
+  if (EOK == err)
+    {
+      r->cur = r->data + sizeof(replay_header_t);
+      r->end = r->data + size;
+      err = replay_priv_validate (r);
+    }
+
+  if (EOK != err)
+    {
+      free (r->data);
+      free (r);
+      return err;
+    }
+
+  r->machine = machine;
+  r->flags = flags;
+  r->last_instruction = machine->stats.instructions;
+  r->io = machine->io;
+
+  machine->io.input = replay_play_input;
+  machine->io.output = replay_play_output;
+  machine->io.context = r;
+
+  *replay = r;
+
+  return EOK;
+}
+
+int um_replay_close (um_replay_t * replay)
+{
+  if (NULL == replay)
+    {
+      return EINVAL;
+    }
+
+  replay->machine->io = replay->io;
+
+  if (NULL != replay->file)
+    {
+      fclose (replay->file);
+    }
+
+  free (replay->data);
+  free (replay);
+
+  return EOK;
+}
+
+void um_replay_get_stats (um_replay_t * replay
+			  , um_replay_stats_t * stats)
+{
+  *stats = replay->stats;
+}
+
+void um_replay_report (FILE * out
+		       , um_replay_t * replay)
+{
+  const um_replay_stats_t * s = &replay->stats;
+
+  if (NULL != replay->file)
+    {
+      fprintf (out, "replay: %llu input bytes recorded\n", s->bytes);
+      return;
+    }
+
+  fprintf (out
+	   , "replay: %llu input bytes fed back, %llu read by another instruction"
+	   , s->bytes
+	   , s->divergences);
+
+  if (replay->cur == replay->end)
+    {
+      fprintf (out, ", live from instruction %llu\n", s->exhausted_at);
+    }
+  else
+    {
+      fprintf (out, ", %llu bytes left\n", (unsigned long long) (replay->end - replay->cur));
+    }
+}
@@ -0,0 +1,78 @@
+#if ! defined (REPLAY_H)
+#define REPLAY_H
+
+#include <stdio.h>
+
+#include "um.h"
+
+/**
+ * Record / replay of a session.
+ *
+ * The input bytes are the only thing a machine gets from the outside, so
+ * a run is reproduced exactly by feeding it the same bytes. The recorder
+ * logs every byte read (and the end of the input) with the index of the
+ * input instruction that read it; the player feeds them back to the
+ * machine, checks that they are read by the same instructions, and hands
+ * the machine back to its own input once the log is exhausted, so that a
+ * replay can fast forward to the interesting point of a session and go on
+ * interactively from there.
+ */
+
+typedef struct um_replay_t um_replay_t;
+
+typedef enum UM_REPLAY_FLAGS
+  {
+    // the output of the replayed part is dropped
+    UM_REPLAY_QUIET = 1,
+
+  } UM_REPLAY_FLAGS;
+
+typedef struct um_replay_stats_t
+{
+  // bytes (end of the input included) logged / fed back
+  unsigned long long bytes;
+
+  // bytes fed back to another instruction than the recorded one
+  unsigned long long divergences;
+
+  // instruction count of the machine when the last logged byte was fed
+  unsigned long long exhausted_at;
+
+} um_replay_stats_t;
+
+/**
+ * Creates the log and wraps the I/O hooks of the machine, which must
+ * have been loaded already (the program is identified in the log).
+ *
+ * @param replay
+ * @param path
+ * @param machine
+ */
+int um_replay_record (um_replay_t ** replay
+		      , const char * path
+		      , struct um_t * machine);
+
+/**
+ * Feeds the log back to the machine, loaded with the same program.
+ *
+ * @param flags UM_REPLAY_FLAGS
+ * @return EOK, an errno value if the file cannot be read or EINVAL if it
+ * is not a log of that program
+ */
+int um_replay_play (um_replay_t ** replay
+		    , const char * path
+		    , struct um_t * machine
+		    , int flags);
+
+/**
+ * Flushes a log being recorded and gives the machine its hooks back.
+ */
+int um_replay_close (um_replay_t * replay);
+
+void um_replay_get_stats (um_replay_t * replay
+			  , um_replay_stats_t * stats);
+
+void um_replay_report (FILE * out
+		       , um_replay_t * replay);
+
+#endif // REPLAY_H
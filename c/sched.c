@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "um_priv.h"
+#include "sched.h"
+
+
+typedef enum sched_state_t
+  {
+    SCHED_QUEUED,
+    SCHED_RUNNING,
+    SCHED_WAITING,
+    SCHED_STOPPED,
+
+  } sched_state_t;
+
+typedef struct sched_entry_t
+{
+  struct um_t * machine;
+  um_engine_t engine;
+
+  // NULL when the machine is run directly
+  um_session_t * session;
+
+  size_t id;
+  sched_state_t state;
+
+  // a wake up arrived while the machine was queued or running
+  int woken;
+
+  // the notify function is being called for the machine
+  int notifying;
+
+  // CPU time, plus what was skipped while waiting: the queue order
+  unsigned long long vtime;
+  size_t heap_index;
+
+  um_sched_stats_t stats;
+
+} sched_entry_t;
+
+
+struct um_sched_t
+{
+  pthread_mutex_t lock;
+
+  // signaled when a machine is queued / a slice ends
+  pthread_cond_t work;
+  pthread_cond_t idle;
+
+  unsigned long long slice;
+
+  // indexed by id, NULL once removed
+  sched_entry_t ** entries;
+  size_t entry_count;
+  size_t entry_capacity;
+
+  // ids of the removed machines, given again the last removed first
+  size_t * free_ids;
+  size_t free_count;
+
+  // queued machines, min heap on vtime
+  sched_entry_t ** heap;
+  size_t heap_size;
+
+  // vtime of the machine picked last
+  unsigned long long clock;
+
+  size_t running;
+  int stopping;
+
+  um_sched_notify_func notify;
+  void * notify_context;
+
+  pthread_t * workers;
+  unsigned int worker_count;
+};
+
+
+//////////////////////////////////////
+// run queue
+//////////////////////////////////////
+
+static void sched_heap_set (um_sched_t * s, size_t i, sched_entry_t * e)
+{
+  s->heap[i] = e;
+  e->heap_index = i;
+}
+
+static void sched_heap_up (um_sched_t * s, size_t i)
+{
+  sched_entry_t * e = s->heap[i];
+
+  while (i > 0 && s->heap[(i - 1) / 2]->vtime > e->vtime)
+    {
+      sched_heap_set (s, i, s->heap[(i - 1) / 2]);
+      i = (i - 1) / 2;
+    }
+
+  sched_heap_set (s, i, e);
+}
+
+static void sched_heap_down (um_sched_t * s, size_t i)
+{
+  sched_entry_t * e = s->heap[i];
+
+  while (1)
+    {
+      size_t child = 2 * i + 1;
+
+      if (child >= s->heap_size)
+	{
+	  break;
+	}
+      if (child + 1 < s->heap_size && s->heap[child + 1]->vtime < s->heap[child]->vtime)
+	{
+	  child++;
+	}
+      if (s->heap[child]->vtime >= e->vtime)
+	{
+	  break;
+	}
+
+      sched_heap_set (s, i, s->heap[child]);
+      i = child;
+    }
+
+  sched_heap_set (s, i, e);
+}
+
+// the heap has room for every entry
+static void sched_queue (um_sched_t * s, sched_entry_t * e)
+{
+  e->state = SCHED_QUEUED;
+  e->stats.status = UM_STATUS_RUNNING;
+
+  sched_heap_set (s, s->heap_size++, e);
+  sched_heap_up (s, e->heap_index);
+
+  pthread_cond_signal (&s->work);
+}
+
+static void sched_unqueue (um_sched_t * s, sched_entry_t * e)
+{
+  const size_t i = e->heap_index;
+
+  assert (SCHED_QUEUED == e->state && s->heap[i] == e);
+
+  s->heap_size--;
+  if (i != s->heap_size)
+    {
+      sched_heap_set (s, i, s->heap[s->heap_size]);
+      sched_heap_down (s, i);
+      sched_heap_up (s, s->heap[i]->heap_index);
+    }
+}
+
+static sched_entry_t * sched_lookup (um_sched_t * s, size_t id)
+{
+  return id < s->entry_count ? s->entries[id] : NULL;
+}
+
+
+//////////////////////////////////////
+// workers
+//////////////////////////////////////
+
+static unsigned long long sched_thread_cpu_ns (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &t);
+
+  return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int sched_waiting (um_status_t status)
+{
+  return UM_STATUS_NEEDS_INPUT == status || UM_STATUS_HAS_OUTPUT == status;
+}
+
+static void * sched_worker (void * argument)
+{
+  um_sched_t * s = (um_sched_t *) argument;
+
+  pthread_mutex_lock (&s->lock);
+
+  while ( ! s->stopping)
+    {
+      sched_entry_t * e = NULL;
+      unsigned long long start = 0;
+      unsigned long long elapsed = 0;
+      um_status_t status = UM_STATUS_RUNNING;
+
+      if (0 == s->heap_size)
+	{
+	  pthread_cond_wait (&s->work, &s->lock);
+	  continue;
+	}
+
+      e = s->heap[0];
+      sched_unqueue (s, e);
+
+      e->state = SCHED_RUNNING;
+      if (e->vtime > s->clock)
+	{
+	  s->clock = e->vtime;
+	}
+      s->running++;
+
+      pthread_mutex_unlock (&s->lock);
+
+      start = sched_thread_cpu_ns ();
+      status = NULL != e->session
+	? um_session_resume (e->session, s->slice)
+	: um_run_for (e->machine, e->engine, s->slice);
+      elapsed = sched_thread_cpu_ns () - start;
+
+      pthread_mutex_lock (&s->lock);
+
+      s->running--;
+
+      e->vtime += elapsed;
+      e->stats.cpu_ns += elapsed;
+      e->stats.slices++;
+      e->stats.instructions = e->machine->stats.instructions;
+      e->stats.heap_bytes = e->machine->stats.heap_bytes;
+      e->stats.status = status;
+
+      if (UM_STATUS_RUNNING == status
+	  || (sched_waiting (status) && e->woken))
+	{
+	  e->woken = 0;
+	  sched_queue (s, e);
+	}
+      else if (sched_waiting (status))
+	{
+	  e->state = SCHED_WAITING;
+	  e->stats.waits++;
+	}
+      else
+	{
+	  e->state = SCHED_STOPPED;
+	}
+
+      pthread_cond_broadcast (&s->idle);
+
+      if (NULL != s->notify && SCHED_QUEUED != e->state)
+	{
+	  const um_sched_notify_func notify = s->notify;
+	  void * context = s->notify_context;
+	  const size_t id = e->id;
+
+	  // the id is not given again before notify returns
+	  e->notifying = 1;
+	  pthread_mutex_unlock (&s->lock);
+	  notify (context, id, status);
+	  pthread_mutex_lock (&s->lock);
+	  e->notifying = 0;
+
+	  pthread_cond_broadcast (&s->idle);
+	}
+    }
+
+  pthread_mutex_unlock (&s->lock);
+
+  return NULL;
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_sched_create (um_sched_t ** sched
+		     , unsigned int workers
+		     , unsigned long long slice)
+{
+  um_sched_t * s = NULL;
+
+  if (NULL == sched || 0 == workers || 0 == slice)
+    {
+      return EINVAL;
+    }
+
+  s = (um_sched_t *) calloc (1, sizeof(um_sched_t));
+  if (NULL == s)
+    {
+      return ENOMEM;
+    }
+
+  s->workers = (pthread_t *) calloc (workers, sizeof(pthread_t));
+  if (NULL == s->workers)
+    {
+      free (s);
+      return ENOMEM;
+    }
+
+  pthread_mutex_init (&s->lock, NULL);
+  pthread_cond_init (&s->work, NULL);
+  pthread_cond_init (&s->idle, NULL);
+
+  s->slice = slice;
+
+  for (s->worker_count = 0; s->worker_count < workers; ++s->worker_count)
+    {
+      int err = pthread_create (&s->workers[s->worker_count], NULL, sched_worker, s);
+      if (0 != err)
+	{
+	  um_sched_destroy (s);
+	  return err;
+	}
+    }
+
+  *sched = s;
+
+  return EOK;
+}
+
+int um_sched_destroy (um_sched_t * sched)
+{
+  unsigned int i = 0;
+
+  if (NULL == sched)
+    {
+      return EINVAL;
+    }
+
+  pthread_mutex_lock (&sched->lock);
+  sched->stopping = 1;
+  pthread_cond_broadcast (&sched->work);
+  pthread_mutex_unlock (&sched->lock);
+
+  for (i = 0; i < sched->worker_count; ++i)
+    {
+      pthread_join (sched->workers[i], NULL);
+    }
+
+  for (i = 0; i < sched->entry_count; ++i)
+    {
+      free (sched->entries[i]);
+    }
+
+  pthread_cond_destroy (&sched->idle);
+  pthread_cond_destroy (&sched->work);
+  pthread_mutex_destroy (&sched->lock);
+
+  free (sched->heap);
+  free (sched->entries);
+  free (sched->free_ids);
+  free (sched->workers);
+  free (sched);
+
+  return EOK;
+}
+
+static int sched_add (um_sched_t * sched
+		      , struct um_t * machine
+		      , um_engine_t engine
+		      , um_session_t * session
+		      , size_t * id)
+{
+  sched_entry_t * e = (sched_entry_t *) calloc (1, sizeof(sched_entry_t));
+
+  if (NULL == e)
+    {
+      return ENOMEM;
+    }
+
+  e->machine = machine;
+  e->engine = engine;
+  e->session = session;
+
+  pthread_mutex_lock (&sched->lock);
+
+  if (0 == sched->free_count && sched->entry_count == sched->entry_capacity)
+    {
+      const size_t capacity = 0 == sched->entry_capacity ? 16 : 2 * sched->entry_capacity;
+      sched_entry_t ** entries =
+	(sched_entry_t **) realloc (sched->entries, capacity * sizeof(sched_entry_t *));
+      sched_entry_t ** heap =
+	(sched_entry_t **) realloc (sched->heap, capacity * sizeof(sched_entry_t *));
+      size_t * free_ids =
+	(size_t *) realloc (sched->free_ids, capacity * sizeof(size_t));
+
+      if (NULL != entries)
+	{
+	  sched->entries = entries;
+	}
+      if (NULL != heap)
+	{
+	  sched->heap = heap;
+	}
+      if (NULL != free_ids)
+	{
+	  sched->free_ids = free_ids;
+	}
+      if (NULL == entries || NULL == heap || NULL == free_ids)
+	{
+	  pthread_mutex_unlock (&sched->lock);
+	  free (e);
+	  return ENOMEM;
+	}
+
+      sched->entry_capacity = capacity;
+    }
+
+  e->id = 0 != sched->free_count
+    ? sched->free_ids[--sched->free_count]
+    : sched->entry_count++;
+  if (NULL != id)
+    {
+      *id = e->id;
+    }
+  sched->entries[e->id] = e;
+
+  e->vtime = sched->clock;
+  sched_queue (sched, e);
+
+  pthread_mutex_unlock (&sched->lock);
+
+  return EOK;
+}
+
+int um_sched_add (um_sched_t * sched
+		  , struct um_t * machine
+		  , um_engine_t engine
+		  , size_t * id)
+{
+  if (NULL == sched || NULL == machine || NULL == machine->arrays
+      || NULL == um_engine_name (engine))
+    {
+      return EINVAL;
+    }
+
+  return sched_add (sched, machine, engine, NULL, id);
+}
+
+int um_sched_add_session (um_sched_t * sched
+			  , um_session_t * session
+			  , size_t * id)
+{
+  if (NULL == sched || NULL == session)
+    {
+      return EINVAL;
+    }
+
+  return sched_add (sched, um_session_machine (session), UM_ENGINE_DEFAULT, session, id);
+}
+
+int um_sched_remove (um_sched_t * sched
+		     , size_t id)
+{
+  sched_entry_t * e = NULL;
+
+  if (NULL == sched)
+    {
+      return EINVAL;
+    }
+
+  pthread_mutex_lock (&sched->lock);
+
+  while (NULL != (e = sched_lookup (sched, id))
+	 && (SCHED_RUNNING == e->state || e->notifying))
+    {
+      pthread_cond_wait (&sched->idle, &sched->lock);
+    }
+
+  if (NULL != e)
+    {
+      if (SCHED_QUEUED == e->state)
+	{
+	  sched_unqueue (sched, e);
+	}
+
+      sched->entries[id] = NULL;
+      sched->free_ids[sched->free_count++] = id;
+      free (e);
+    }
+
+  pthread_mutex_unlock (&sched->lock);
+
+  return NULL == e ? ENOENT : EOK;
+}
+
+int um_sched_wake (um_sched_t * sched
+		   , size_t id)
+{
+  sched_entry_t * e = NULL;
+
+  if (NULL == sched)
+    {
+      return EINVAL;
+    }
+
+  pthread_mutex_lock (&sched->lock);
+
+  e = sched_lookup (sched, id);
+  if (NULL != e)
+    {
+      if (SCHED_WAITING == e->state)
+	{
+	  if (e->vtime < sched->clock)
+	    {
+	      e->vtime = sched->clock;
+	    }
+	  sched_queue (sched, e);
+	}
+      else if (SCHED_STOPPED != e->state)
+	{
+	  e->woken = 1;
+	}
+    }
+
+  pthread_mutex_unlock (&sched->lock);
+
+  return NULL == e ? ENOENT : EOK;
+}
+
+int um_sched_wait (um_sched_t * sched)
+{
+  if (NULL == sched)
+    {
+      return EINVAL;
+    }
+
+  pthread_mutex_lock (&sched->lock);
+
+  while (0 != sched->heap_size || 0 != sched->running)
+    {
+      pthread_cond_wait (&sched->idle, &sched->lock);
+    }
+
+  pthread_mutex_unlock (&sched->lock);
+
+  return EOK;
+}
+
+int um_sched_set_notify (um_sched_t * sched
+			 , um_sched_notify_func notify
+			 , void * context)
+{
+  if (NULL == sched)
+    {
+      return EINVAL;
+    }
+
+  pthread_mutex_lock (&sched->lock);
+  sched->notify = notify;
+  sched->notify_context = context;
+  pthread_mutex_unlock (&sched->lock);
+
+  return EOK;
+}
+
+int um_sched_get_stats (um_sched_t * sched
+			, size_t id
+			, um_sched_stats_t * stats)
+{
+  sched_entry_t * e = NULL;
+
+  if (NULL == sched || NULL == stats)
+    {
+      return EINVAL;
+    }
+
+  pthread_mutex_lock (&sched->lock);
+
+  e = sched_lookup (sched, id);
+  if (NULL != e)
+    {
+      *stats = e->stats;
+    }
+
+  pthread_mutex_unlock (&sched->lock);
+
+  return NULL == e ? ENOENT : EOK;
+}
@@ -0,0 +1,113 @@
+#if ! defined (SCHED_H)
+#define SCHED_H
+
+#include "um.h"
+#include "session.h"
+
+/**
+ * Runs many machines on a few worker threads.
+ *
+ * The machines are run by slices of a fixed number of instructions with
+ * um_run_for. A worker always picks the runnable machine that used the
+ * least CPU time (measured with the CPU clock of the worker thread), a
+ * machine that never stops being preempted at the end of every slice, so
+ * that it does not delay the others more than a slice per worker. A
+ * machine woken up after waiting for input is not credited the time it
+ * waited: it restarts from the time of the machine picked last.
+ *
+ * A machine whose input hook returns UM_INPUT_WOULD_BLOCK, or output
+ * hook UM_OUTPUT_WOULD_BLOCK, waits until um_sched_wake.
+ */
+
+typedef struct um_sched_t um_sched_t;
+
+typedef struct um_sched_stats_t
+{
+  // UM_STATUS_RUNNING while the machine is queued or running
+  um_status_t status;
+
+  unsigned long long cpu_ns;
+  unsigned long long slices;
+  unsigned long long instructions;
+
+  // times the machine waited for input or output
+  unsigned long long waits;
+
+  // heap of the machine at the end of its last slice
+  unsigned long long heap_bytes;
+
+} um_sched_stats_t;
+
+/**
+ * Starts the worker threads.
+ *
+ * @param sched
+ * @param workers
+ * @param slice instructions per slice
+ */
+int um_sched_create (um_sched_t ** sched
+		     , unsigned int workers
+		     , unsigned long long slice);
+
+/**
+ * Stops the worker threads once their current slice is done. The
+ * machines still belong to the caller.
+ */
+int um_sched_destroy (um_sched_t * sched);
+
+/**
+ * Queues a machine initialized by um_load.
+ *
+ * @param id receives the id of the machine in the scheduler
+ */
+int um_sched_add (um_sched_t * sched
+		  , struct um_t * machine
+		  , um_engine_t engine
+		  , size_t * id);
+
+/**
+ * Queues a session, run with um_session_resume: the machine also waits
+ * while it has output not drained yet.
+ */
+int um_sched_add_session (um_sched_t * sched
+			  , um_session_t * session
+			  , size_t * id);
+
+/**
+ * Removes a machine, waiting for the end of its slice if it is running.
+ * Its id is given to the next machine added.
+ */
+int um_sched_remove (um_sched_t * sched
+		     , size_t id);
+
+/**
+ * Queues again a machine that waits for input or output, its hooks being
+ * ready now. The next wait is cancelled when the machine is queued or
+ * running.
+ */
+int um_sched_wake (um_sched_t * sched
+		   , size_t id);
+
+/**
+ * Waits until no machine is queued or running: they all halted, failed
+ * or wait for input or output.
+ */
+int um_sched_wait (um_sched_t * sched);
+
+/**
+ * Called by the workers, out of the scheduler lock, when a machine
+ * starts waiting, halts or fails.
+ */
+typedef void (* um_sched_notify_func) (void * context
+				       , size_t id
+				       , um_status_t status);
+
+int um_sched_set_notify (um_sched_t * sched
+			 , um_sched_notify_func notify
+			 , void * context);
+
+int um_sched_get_stats (um_sched_t * sched
+			, size_t id
+			, um_sched_stats_t * stats);
+
+#endif // SCHED_H
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "um_priv.h"
+#include "session.h"
+
+
+struct um_session_t
+{
+  struct um_t * machine;
+  um_engine_t engine;
+
+  // hooks of the machine before the session
+  um_io_t io;
+
+  // input fed and not read yet: data [start, size)
+  byte * input;
+  size_t input_start;
+  size_t input_size;
+  size_t input_capacity;
+  int input_ended;
+
+  // output not drained yet: data [start, size)
+  byte * output;
+  size_t output_start;
+  size_t output_size;
+  size_t output_capacity;
+};
+
+
+static int session_input (void * context)
+{
+  um_session_t * s = (um_session_t *) context;
+
+  if (s->input_start == s->input_size)
+    {
+      return s->input_ended ? EOF : UM_INPUT_WOULD_BLOCK;
+    }
+
+  return s->input[s->input_start++];
+}
+
+static int session_output (void * context, byte c)
+{
+  um_session_t * s = (um_session_t *) context;
+
+  if (s->output_size == s->output_capacity)
+    {
+      if (0 == s->output_start)
+	{
+	  return UM_OUTPUT_WOULD_BLOCK;
+	}
+
+      memmove (s->output, s->output + s->output_start, s->output_size - s->output_start);
+      s->output_size -= s->output_start;
+      s->output_start = 0;
+    }
+
+  s->output[s->output_size++] = c;
+
+  return EOK;
+}
+
+
+//////////////////////////////////////
+// public functions
+//////////////////////////////////////
+
+int um_session_open (um_session_t ** session
+		     , struct um_t * machine
+		     , um_engine_t engine
+		     , size_t output_capacity)
+{
+  um_session_t * s = NULL;
+
+  if (NULL == session || NULL == machine || NULL == machine->arrays
+      || NULL == um_engine_name (engine) || 0 == output_capacity)
+    {
+      return EINVAL;
+    }
+
+  s = (um_session_t *) calloc (1, sizeof(um_session_t));
+  if (NULL == s)
+    {
+      return ENOMEM;
+    }
+
+  s->output = (byte *) malloc (output_capacity);
+  if (NULL == s->output)
+    {
+      free (s);
+      return ENOMEM;
+    }
+
+  s->output_capacity = output_capacity;
+  s->machine = machine;
+  s->engine = engine;
+  s->io = machine->io;
+
+  machine->io.input = session_input;
+  machine->io.output = session_output;
+  machine->io.context = s;
+
+  *session = s;
+
+  return EOK;
+}
+
+int um_session_close (um_session_t * session)
+{
+  if (NULL == session)
+    {
+      return EINVAL;
+    }
+
+  session->machine->io = session->io;
+
+  free (session->input);
+  free (session->output);
+  free (session);
+
+  return EOK;
+}
+
+um_status_t um_session_resume (um_session_t * session
+			       , unsigned long long budget)
+{
+  um_status_t status = UM_STATUS_FAILED;
+
+  if (NULL == session)
+    {
+      return UM_STATUS_FAILED;
+    }
+
+  // nothing can run before the output is drained
+  if (session->output_size - session->output_start == session->output_capacity)
+    {
+      return UM_STATUS_HAS_OUTPUT;
+    }
+
+  status = um_run_for (session->machine, session->engine, budget);
+
+  if (UM_STATUS_HALTED != status
+      && UM_STATUS_FAILED != status
+      && session->output_start != session->output_size)
+    {
+      return UM_STATUS_HAS_OUTPUT;
+    }
+
+  return status;
+}
+
+int um_session_feed (um_session_t * session
+		     , const byte * data
+		     , size_t size)
+{
+  if (NULL == session || (NULL == data && 0 != size))
+    {
+      return EINVAL;
+    }
+
+  if (session->input_ended)
+    {
+      return EPIPE;
+    }
+
+  // the bytes already read are dropped first
+  if (session->input_start == session->input_size)
+    {
+      session->input_start = session->input_size = 0;
+    }
+
+  if (session->input_size + size > session->input_capacity)
+    {
+      const size_t pending = session->input_size - session->input_start;
+
+      memmove (session->input, session->input + session->input_start, pending);
+      session->input_start = 0;
+      session->input_size = pending;
+
+      if (pending + size > session->input_capacity)
+	{
+	  size_t capacity = 0 == session->input_capacity ? 4096 : session->input_capacity;
+	  byte * p = NULL;
+
+	  while (capacity < pending + size)
+	    {
+	      capacity *= 2;
+	    }
+
+	  p = (byte *) realloc (session->input, capacity);
+	  if (NULL == p)
+	    {
+	      return ENOMEM;
+	    }
+	  session->input = p;
+	  session->input_capacity = capacity;
+	}
+    }
+
+  memcpy (session->input + session->input_size, data, size);
+  session->input_size += size;
+
+  return EOK;
+}
+
+int um_session_end_input (um_session_t * session)
+{
+  if (NULL == session)
+    {
+      return EINVAL;
+    }
+
+  session->input_ended = 1;
+
+  return EOK;
+}
+
+size_t um_session_drain (um_session_t * session
+			 , byte * out
+			 , size_t capacity)
+{
+  size_t n = 0;
+
+  if (NULL == session || NULL == out)
+    {
+      return 0;
+    }
+
+  n = session->output_size - session->output_start;
+  if (n > capacity)
+    {
+      n = capacity;
+    }
+
+  memcpy (out, session->output + session->output_start, n);
+  session->output_start += n;
+
+  if (session->output_start == session->output_size)
+    {
+      session->output_start = session->output_size = 0;
+    }
+
+  return n;
+}
+
+size_t um_session_pending_output (um_session_t * session)
+{
+  return NULL == session ? 0 : session->output_size - session->output_start;
+}
+
+struct um_t * um_session_machine (um_session_t * session)
+{
+  return NULL == session ? NULL : session->machine;
+}
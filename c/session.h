@@ -0,0 +1,78 @@
+#if ! defined (SESSION_H)
+#define SESSION_H
+
+#include "um.h"
+
+/**
+ * Non blocking embedding of a machine.
+ *
+ * The session takes over the I/O hooks of a machine initialized by
+ * um_load: the input operator reads the bytes given to um_session_feed,
+ * the output operator fills a buffer emptied by um_session_drain. Instead
+ * of blocking, um_session_resume returns as soon as the machine needs
+ * input that was not fed yet or fills the output buffer, the machine
+ * being left as it was so that the next um_session_resume carries on.
+ *
+ *   while (UM_STATUS_HALTED != (status = um_session_resume (s, budget)))
+ *     {
+ *       HAS_OUTPUT: um_session_drain
+ *       NEEDS_INPUT: um_session_feed (or um_session_end_input)
+ *       RUNNING: the budget is spent, anything else to do
+ *       FAILED: stop
+ *     }
+ */
+
+typedef struct um_session_t um_session_t;
+
+/**
+ * @param session
+ * @param machine initialized by um_load, still owned by the caller
+ * @param engine
+ * @param output_capacity bytes of output buffered before
+ * um_session_resume returns UM_STATUS_HAS_OUTPUT
+ */
+int um_session_open (um_session_t ** session
+		     , struct um_t * machine
+		     , um_engine_t engine
+		     , size_t output_capacity);
+
+/**
+ * Gives the machine its hooks back.
+ */
+int um_session_close (um_session_t * session);
+
+/**
+ * Runs the machine for up to budget instructions.
+ *
+ * @return UM_STATUS_HAS_OUTPUT while output is buffered, then the status
+ * of the machine: UM_STATUS_NEEDS_INPUT, UM_STATUS_HALTED,
+ * UM_STATUS_FAILED or UM_STATUS_RUNNING when the budget is spent. The
+ * output written just before halting or failing still has to be drained.
+ */
+um_status_t um_session_resume (um_session_t * session
+			       , unsigned long long budget);
+
+/**
+ * Appends bytes to the input of the machine.
+ */
+int um_session_feed (um_session_t * session
+		     , const byte * data
+		     , size_t size);
+
+/**
+ * The input operator gets EOF once the bytes fed are consumed.
+ */
+int um_session_end_input (um_session_t * session);
+
+/**
+ * @return the number of output bytes copied to out
+ */
+size_t um_session_drain (um_session_t * session
+			 , byte * out
+			 , size_t capacity);
+
+size_t um_session_pending_output (um_session_t * session);
+
+struct um_t * um_session_machine (um_session_t * session);
+
+#endif // SESSION_H
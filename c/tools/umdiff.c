@@ -0,0 +1,984 @@
+// umdiff : runs programs under two execution engines in lockstep and
+// reports the first point where they diverge
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../umasm.h"
+
+
+typedef enum DIFF_CONSTANTS
+  {
+    DIFF_MAX_IMAGES = 64,
+    DIFF_MAX_WINDOW = 256,
+    DIFF_WHY_SIZE = 256,
+
+    // arrays allocated by the overrun program before it reads past the
+    // end of the last one
+    DIFF_OVERRUN_ARRAYS = 8,
+
+  } DIFF_CONSTANTS;
+
+
+typedef struct options_t
+{
+  um_engine_t reference;
+  um_engine_t candidate;
+
+  // checking mode of the candidate machine
+  um_checking_t checking;
+
+  // instructions run by each engine between two comparisons
+  unsigned long long chunk;
+
+  // the arrays are compared every arrays_every comparisons
+  unsigned int arrays_every;
+
+  // stops a run after that many instructions, 0 for no limit
+  unsigned long long limit;
+
+  // instructions shown before a divergence
+  unsigned int window;
+
+} options_t;
+
+
+typedef struct buffer_t
+{
+  byte * data;
+  size_t size;
+  size_t capacity;
+
+} buffer_t;
+
+
+typedef struct case_t
+{
+  char name [128];
+
+  byte * image;
+  size_t size;
+
+  const byte * input;
+  size_t input_size;
+
+} case_t;
+
+
+typedef struct side_t
+{
+  um_t machine;
+  um_engine_t engine;
+
+  buffer_t output;
+
+  const byte * input;
+  size_t input_size;
+  size_t input_pos;
+
+} side_t;
+
+
+typedef struct context_entry_t
+{
+  address_t ip;
+  char text [128];
+
+} context_entry_t;
+
+
+//////////////////////////////////////
+// engines side by side
+//////////////////////////////////////
+
+static int side_output (void * context, byte c)
+{
+  buffer_t * b = &((side_t *) context)->output;
+
+  if (b->size == b->capacity)
+    {
+      size_t capacity = 0 == b->capacity ? 4096 : 2 * b->capacity;
+      byte * data = (byte *) realloc (b->data, capacity);
+      if (NULL == data)
+	{
+	  return ENOMEM;
+	}
+      b->data = data;
+      b->capacity = capacity;
+    }
+
+  b->data[b->size++] = c;
+
+  return EOK;
+}
+
+static int side_input (void * context)
+{
+  side_t * side = (side_t *) context;
+
+  if (side->input_pos >= side->input_size)
+    {
+      return EOF;
+    }
+
+  return side->input[side->input_pos++];
+}
+
+static void side_start (side_t * side
+			, um_engine_t engine
+			, um_checking_t checking
+			, const case_t * c)
+{
+  memset (side, 0, sizeof(*side));
+
+  um_set_checking (&side->machine, checking);
+
+  side->engine = engine;
+  side->input = c->input;
+  side->input_size = c->input_size;
+
+  side->machine.io.output = side_output;
+  side->machine.io.input = side_input;
+  side->machine.io.context = side;
+
+  um_load (&side->machine, c->image, c->size);
+}
+
+static void side_stop (side_t * side)
+{
+  um_release (&side->machine);
+  free (side->output.data);
+  memset (side, 0, sizeof(*side));
+}
+
+/**
+ * Runs the candidate engine for budget instructions (it may stop further,
+ * at the end of a block) then the reference up to the same point.
+ */
+static void lockstep (side_t * reference
+		      , side_t * candidate
+		      , unsigned long long budget)
+{
+  um_run_for (&candidate->machine, candidate->engine, budget);
+
+  if (candidate->machine.stats.instructions > reference->machine.stats.instructions)
+    {
+      um_run_for (&reference->machine
+		  , reference->engine
+		  , candidate->machine.stats.instructions - reference->machine.stats.instructions);
+    }
+}
+
+
+//////////////////////////////////////
+// comparisons
+//////////////////////////////////////
+
+static int compare_platter (const void * a, const void * b)
+{
+  platter_t x = * (const platter_t *) a;
+  platter_t y = * (const platter_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static platter_t * sorted_ids (um_t * machine, size_t * count)
+{
+  platter_t * ids = NULL;
+
+  um_array_ids (machine, NULL, 0, count);
+
+  ids = (platter_t *) malloc ((*count + 1) * sizeof(platter_t));
+  um_array_ids (machine, ids, *count, count);
+  qsort (ids, *count, sizeof(platter_t), compare_platter);
+
+  return ids;
+}
+
+static int compare_array (side_t * a, side_t * b, platter_t id, char * why, size_t whysize)
+{
+  platter_t size_a = 0;
+  platter_t size_b = 0;
+  int found_a = EOK == um_array_size (&a->machine, id, &size_a);
+  int found_b = EOK == um_array_size (&b->machine, id, &size_b);
+
+  if (found_a != found_b)
+    {
+      snprintf (why, whysize, "array 0x%08X is %s in the reference only"
+		, id, found_a ? "alive" : "abandoned");
+      return 1;
+    }
+
+  if ( ! found_a)
+    {
+      return 0;
+    }
+
+  if (size_a != size_b)
+    {
+      snprintf (why, whysize, "array 0x%08X has 0x%08X platters, 0x%08X in the candidate"
+		, id, size_a, size_b);
+      return 1;
+    }
+
+  {
+    platter_t * da = (platter_t *) malloc ((size_a + 1) * sizeof(platter_t));
+    platter_t * db = (platter_t *) malloc ((size_a + 1) * sizeof(platter_t));
+    platter_t i = 0;
+    int diff = 0;
+
+    um_array_read (&a->machine, id, 0, size_a, da);
+    um_array_read (&b->machine, id, 0, size_a, db);
+
+    for (i = 0; i < size_a && ! diff; ++i)
+      {
+	if (da[i] != db[i])
+	  {
+	    snprintf (why, whysize, "ARRAY[0x%08X][0x%08X] = 0x%08X, 0x%08X in the candidate"
+		      , id, i, da[i], db[i]);
+	    diff = 1;
+	  }
+      }
+
+    free (da);
+    free (db);
+
+    return diff;
+  }
+}
+
+/**
+ *
+ * @param arrays also compares the content of all the arrays
+ * @return 0 if the machines are in the same state, otherwise why
+ * describes the first difference
+ */
+static int compare_state (side_t * a
+			  , side_t * b
+			  , int arrays
+			  , char * why
+			  , size_t whysize)
+{
+  um_t * ma = &a->machine;
+  um_t * mb = &b->machine;
+  size_t i = 0;
+
+  if (ma->status != mb->status)
+    {
+      snprintf (why, whysize, "status %d, %d in the candidate", ma->status, mb->status);
+      return 1;
+    }
+
+  if (ma->stats.instructions != mb->stats.instructions)
+    {
+      snprintf (why, whysize, "%llu instructions executed, %llu by the candidate"
+		, ma->stats.instructions, mb->stats.instructions);
+      return 1;
+    }
+
+  if (ma->ip != mb->ip)
+    {
+      snprintf (why, whysize, "IP 0x%08X, 0x%08X in the candidate", ma->ip, mb->ip);
+      return 1;
+    }
+
+  for (i = 0; i < UM_REGISTER_COUNT; ++i)
+    {
+      if (ma->registers[i] != mb->registers[i])
+	{
+	  snprintf (why, whysize, "REG[0x%02X] = 0x%08X, 0x%08X in the candidate"
+		    , (unsigned int) i, ma->registers[i], mb->registers[i]);
+	  return 1;
+	}
+    }
+
+  if (a->output.size != b->output.size
+      || 0 != memcmp (a->output.data, b->output.data, a->output.size))
+    {
+      size_t at = 0;
+      while (at < a->output.size && at < b->output.size
+	     && a->output.data[at] == b->output.data[at])
+	{
+	  at++;
+	}
+      snprintf (why, whysize, "output differs at byte %lu (%lu bytes, %lu in the candidate)"
+		, (unsigned long) at
+		, (unsigned long) a->output.size
+		, (unsigned long) b->output.size);
+      return 1;
+    }
+
+  if (a->input_pos != b->input_pos)
+    {
+      snprintf (why, whysize, "%lu input bytes read, %lu by the candidate"
+		, (unsigned long) a->input_pos, (unsigned long) b->input_pos);
+      return 1;
+    }
+
+  if (arrays)
+    {
+      size_t count_a = 0;
+      size_t count_b = 0;
+      platter_t * ids_a = sorted_ids (ma, &count_a);
+      platter_t * ids_b = sorted_ids (mb, &count_b);
+      int diff = 0;
+
+      if (count_a != count_b || 0 != memcmp (ids_a, ids_b, count_a * sizeof(platter_t)))
+	{
+	  snprintf (why, whysize, "%lu live arrays, %lu in the candidate (or different ids)"
+		    , (unsigned long) count_a, (unsigned long) count_b);
+	  diff = 1;
+	}
+
+      for (i = 0; i < count_a && ! diff; ++i)
+	{
+	  diff = compare_array (a, b, ids_a[i], why, whysize);
+	}
+
+      free (ids_a);
+      free (ids_b);
+
+      return diff;
+    }
+
+  return 0;
+}
+
+/**
+ * Compares the part of the heap touched by instruction p, executed with
+ * the registers before, right after it was executed.
+ */
+static int compare_touched (side_t * a
+			    , side_t * b
+			    , platter_t p
+			    , const platter_t * before
+			    , char * why
+			    , size_t whysize)
+{
+  const byte rega = (p >> 6) & 0x7;
+  const byte regb = (p >> 3) & 0x7;
+  const byte regc = p & 0x7;
+
+  switch (OPCODE_FROM_PLATTER (p))
+    {
+    case OP_ARRAY_AMEND:
+      {
+	platter_t va = 0;
+	platter_t vb = 0;
+	um_array_read (&a->machine, before[rega], before[regb], 1, &va);
+	um_array_read (&b->machine, before[rega], before[regb], 1, &vb);
+	if (va != vb)
+	  {
+	    snprintf (why, whysize, "ARRAY[0x%08X][0x%08X] = 0x%08X, 0x%08X in the candidate"
+		      , before[rega], before[regb], va, vb);
+	    return 1;
+	  }
+      }
+      break;
+    case OP_ALLOCATION:
+      return compare_array (a, b, a->machine.registers[regb], why, whysize);
+    case OP_ABANDONMENT:
+      return compare_array (a, b, before[regc], why, whysize);
+    case OP_LOAD_PROGRAM:
+      if (UM_PROGRAM_ARRAY_ID != before[regb])
+	{
+	  return compare_array (a, b, UM_PROGRAM_ARRAY_ID, why, whysize);
+	}
+      break;
+    default:
+      break;
+    }
+
+  return 0;
+}
+
+
+//////////////////////////////////////
+// divergence
+//////////////////////////////////////
+
+/**
+ * Replays the case up to the last point where the machines were found
+ * identical, then single steps both engines to find the first diverging
+ * instruction.
+ */
+static void locate (const case_t * c
+		    , const options_t * o
+		    , unsigned long long last_good)
+{
+  side_t a;
+  side_t b;
+  context_entry_t ring [DIFF_MAX_WINDOW];
+  unsigned long long recorded = 0;
+  char why [DIFF_WHY_SIZE] = {0};
+
+  side_start (&a, o->reference, UM_CHECKING_EXPLICIT, c);
+  side_start (&b, o->candidate, o->checking, c);
+
+  while (b.machine.stats.instructions < last_good
+	 && UM_STATUS_RUNNING == b.machine.status)
+    {
+      lockstep (&a, &b, last_good - b.machine.stats.instructions);
+    }
+
+  while (1)
+    {
+      context_entry_t * e = &ring [recorded % o->window];
+      platter_t before [UM_REGISTER_COUNT];
+      platter_t p = 0;
+
+      if (UM_STATUS_RUNNING != a.machine.status && UM_STATUS_RUNNING != b.machine.status)
+	{
+	  printf ("  could not reproduce the divergence instruction by instruction\n");
+	  break;
+	}
+
+      memcpy (before, a.machine.registers, sizeof(before));
+
+      e->ip = a.machine.ip;
+      if (EOK == um_array_read (&a.machine, UM_PROGRAM_ARRAY_ID, a.machine.ip, 1, &p))
+	{
+	  um_pp_instruction (e->text, sizeof(e->text), &a.machine, p);
+	}
+      else
+	{
+	  snprintf (e->text, sizeof(e->text), "<outside of the program>");
+	}
+      recorded++;
+
+      lockstep (&a, &b, 1);
+
+      if (compare_state (&a, &b, 0, why, sizeof(why))
+	  || compare_touched (&a, &b, p, before, why, sizeof(why)))
+	{
+	  unsigned long long first = recorded > o->window ? recorded - o->window : 0;
+	  unsigned long long i = 0;
+
+	  printf ("  first divergence after instruction %llu: %s\n"
+		  , a.machine.stats.instructions, why);
+	  printf ("  reference context:\n");
+
+	  for (i = first; i < recorded; ++i)
+	    {
+	      const context_entry_t * r = &ring [i % o->window];
+	      printf ("  %s 0x%08X : %s\n", i + 1 == recorded ? "=>" : "  ", r->ip, r->text);
+	    }
+	  break;
+	}
+    }
+
+  side_stop (&a);
+  side_stop (&b);
+}
+
+/**
+ *
+ * @return 0 if both engines behave the same
+ */
+static int run_case (const case_t * c, const options_t * o)
+{
+  side_t a;
+  side_t b;
+  unsigned long long last_good = 0;
+  unsigned int compares = 0;
+  char why [DIFF_WHY_SIZE] = {0};
+  int diverged = 0;
+
+  if (0 != c->size % sizeof(platter_t))
+    {
+      printf ("%s: not a UM program\n", c->name);
+      return 1;
+    }
+
+  side_start (&a, o->reference, UM_CHECKING_EXPLICIT, c);
+  side_start (&b, o->candidate, o->checking, c);
+
+  while (1)
+    {
+      int stopped = 0;
+      int arrays = 0;
+
+      lockstep (&a, &b, o->chunk);
+
+      stopped = UM_STATUS_RUNNING != a.machine.status
+	|| UM_STATUS_RUNNING != b.machine.status
+	|| (0 != o->limit && a.machine.stats.instructions >= o->limit);
+
+      arrays = stopped || 0 == (++compares % o->arrays_every);
+
+      if (compare_state (&a, &b, arrays, why, sizeof(why)))
+	{
+	  diverged = 1;
+	  break;
+	}
+
+      if (arrays)
+	{
+	  last_good = a.machine.stats.instructions;
+	}
+
+      if (stopped)
+	{
+	  break;
+	}
+    }
+
+  if (diverged)
+    {
+      printf ("%s: DIVERGENCE between %llu and %llu instructions: %s\n"
+	      , c->name, last_good, a.machine.stats.instructions, why);
+      locate (c, o, last_good);
+    }
+  else
+    {
+      static const char * const statuses [] = { "running", "halted", "failed", "needs input", "has output" };
+
+      printf ("%s: identical, %llu instructions, %lu output bytes, %s\n"
+	      , c->name
+	      , a.machine.stats.instructions
+	      , (unsigned long) a.output.size
+	      , statuses [a.machine.status]);
+    }
+
+  side_stop (&a);
+  side_stop (&b);
+
+  return diverged;
+}
+
+
+//////////////////////////////////////
+// random programs
+//////////////////////////////////////
+
+static unsigned int random_next (unsigned long long * state)
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (unsigned int) (*state >> 33);
+}
+
+static byte random_register (unsigned long long * state)
+{
+  return random_next (state) % UM_REGISTER_COUNT;
+}
+
+static byte random_other_register (unsigned long long * state, byte r)
+{
+  return (r + 1 + random_next (state) % (UM_REGISTER_COUNT - 1)) % UM_REGISTER_COUNT;
+}
+
+/**
+ * Generates a program made of random snippets that exercise every
+ * operator, most of them in ways that do not fail the machine: arithmetic,
+ * reads of the program, allocation / amendment / abandonment, output,
+ * input, forward jumps over garbage, self modification and finally an
+ * optional load of a program from another array.
+ */
+static void random_program (umasm_t * a, unsigned long long seed, unsigned int snippets)
+{
+  unsigned long long s = seed * 2 + 1;
+  unsigned int i = 0;
+
+  random_next (&s);
+
+  for (i = 0; i < snippets; ++i)
+    {
+      const unsigned int kind = random_next (&s) % 100;
+      const byte ra = random_register (&s);
+      const byte rb = random_other_register (&s, ra);
+      const byte rc = random_other_register (&s, rb);
+
+      if (kind < 30)
+	{
+	  static const OperatorCodes arithmetic [] = {
+	    OP_COND_MOVE, OP_ADDITION, OP_MULTIPLICATION, OP_NOT_AND
+	  };
+	  umasm_emit (a, umasm_op (arithmetic [random_next (&s) % 4]
+				   , random_register (&s)
+				   , random_register (&s)
+				   , random_register (&s)));
+	}
+      else if (kind < 38)
+	{
+	  // a zero divisor every now and then
+	  platter_t divisor = 0 == random_next (&s) % 400 ? 0 : 1 + random_next (&s) % 0x1FFFFFF;
+	  umasm_emit (a, umasm_ortho (rc, divisor));
+	  umasm_emit (a, umasm_op (OP_DIVISION, ra, rb, rc));
+	}
+      else if (kind < 53)
+	{
+	  umasm_emit (a, umasm_ortho (ra, random_next (&s) % 0x2000000));
+	}
+      else if (kind < 61)
+	{
+	  umasm_emit (a, umasm_ortho (rb, UM_PROGRAM_ARRAY_ID));
+	  umasm_emit (a, umasm_ortho (rc, random_next (&s) % (umasm_here (a) + 1)));
+	  umasm_emit (a, umasm_op (OP_ARRAY_INDEX, ra, rb, rc));
+	}
+      else if (kind < 73)
+	{
+	  const platter_t size = 1 + random_next (&s) % 64;
+	  const byte rv = random_register (&s);
+
+	  umasm_emit (a, umasm_ortho (rc, size));
+	  umasm_emit (a, umasm_op (OP_ALLOCATION, 0, rb, rc));
+	  umasm_emit (a, umasm_ortho (rc, random_next (&s) % size));
+	  umasm_emit (a, umasm_op (OP_ARRAY_AMEND, rb, rc, rv == rc ? ra : rv));
+	  umasm_emit (a, umasm_op (OP_ARRAY_INDEX, ra, rb, rc));
+
+	  if (random_next (&s) % 2)
+	    {
+	      umasm_emit (a, umasm_op (OP_ABANDONMENT, 0, 0, rb));
+	    }
+	}
+      else if (kind < 81)
+	{
+	  umasm_emit (a, umasm_ortho (rc, random_next (&s) % 256));
+	  umasm_emit (a, umasm_op (OP_OUTPUT, 0, 0, rc));
+	}
+      else if (kind < 85)
+	{
+	  umasm_emit (a, umasm_op (OP_INPUT, 0, 0, rc));
+	}
+      else if (kind < 95)
+	{
+	  // jumps over a few garbage platters
+	  address_t target = 0;
+	  unsigned int garbage = 1 + random_next (&s) % 4;
+
+	  umasm_emit (a, umasm_ortho (rb, UM_PROGRAM_ARRAY_ID));
+	  target = umasm_emit (a, 0);
+	  umasm_emit (a, umasm_op (OP_LOAD_PROGRAM, 0, rb, rc));
+	  while (garbage--)
+	    {
+	      umasm_emit (a, random_next (&s) ^ (random_next (&s) << 16));
+	    }
+	  umasm_patch (a, target, umasm_ortho (rc, umasm_here (a)));
+	}
+      else
+	{
+	  // writes an instruction in the program before executing it
+	  address_t target = 0;
+	  const platter_t generated = umasm_op (OP_ADDITION
+						, random_register (&s)
+						, random_register (&s)
+						, random_register (&s));
+
+	  umasm_load_constant (a, ra, rb, generated);
+	  umasm_emit (a, umasm_ortho (rb, UM_PROGRAM_ARRAY_ID));
+	  target = umasm_emit (a, 0);
+	  umasm_emit (a, umasm_op (OP_ARRAY_AMEND, rb, rc, ra));
+	  umasm_patch (a, target, umasm_ortho (rc, umasm_here (a)));
+	  umasm_emit (a, umasm_op (OP_HALT, 0, 0, 0));
+	}
+    }
+
+  if (random_next (&s) % 2)
+    {
+      // continues in a new program made of: output r1, halt
+      umasm_load_constant (a, 2, 3, umasm_op (OP_OUTPUT, 0, 0, 1));
+      umasm_emit (a, umasm_ortho (3, 2));
+      umasm_emit (a, umasm_op (OP_ALLOCATION, 0, 4, 3));
+      umasm_emit (a, umasm_ortho (5, 0));
+      umasm_emit (a, umasm_op (OP_ARRAY_AMEND, 4, 5, 2));
+      umasm_load_constant (a, 2, 3, umasm_op (OP_HALT, 0, 0, 0));
+      umasm_emit (a, umasm_ortho (5, 1));
+      umasm_emit (a, umasm_op (OP_ARRAY_AMEND, 4, 5, 2));
+      umasm_emit (a, umasm_ortho (1, '\n'));
+      umasm_emit (a, umasm_ortho (5, 0));
+      umasm_emit (a, umasm_op (OP_LOAD_PROGRAM, 0, 4, 5));
+    }
+
+  umasm_emit (a, umasm_op (OP_HALT, 0, 0, 0));
+}
+
+
+/**
+ * Allocates DIFF_OVERRUN_ARRAYS arrays then reads and writes past the
+ * end of the last one, which both engines have to fail on. Under an
+ * address space limit, the guard regions (-G) run out first and the
+ * candidate falls back to the explicit checks while it runs.
+ */
+static void overrun_program (umasm_t * a)
+{
+  int i = 0;
+
+  umasm_emit (a, umasm_ortho (3, 4));
+  for (i = 0; i < DIFF_OVERRUN_ARRAYS; ++i)
+    {
+      umasm_emit (a, umasm_op (OP_ALLOCATION, 0, 1, 3));
+    }
+
+  // r3 is the size of the array, the first platter past its end
+  umasm_emit (a, umasm_op (OP_ARRAY_AMEND, 1, 3, 3));
+  umasm_emit (a, umasm_op (OP_ARRAY_INDEX, 2, 1, 3));
+
+  umasm_emit (a, umasm_ortho (2, 'A'));
+  umasm_emit (a, umasm_op (OP_OUTPUT, 0, 0, 2));
+  umasm_emit (a, umasm_op (OP_HALT, 0, 0, 0));
+}
+
+
+//////////////////////////////////////
+// main
+//////////////////////////////////////
+
+static int engine_by_name (const char * name, um_engine_t * engine)
+{
+  um_engine_t e;
+
+  for (e = 0; e < UM_ENGINE_COUNT; ++e)
+    {
+      if (0 == strcmp (name, um_engine_name (e)))
+	{
+	  *engine = e;
+	  return EOK;
+	}
+    }
+
+  printf ("Unknown engine %s, available:", name);
+  for (e = 0; e < UM_ENGINE_COUNT; ++e)
+    {
+      printf (" %s", um_engine_name (e));
+    }
+  printf ("\n");
+
+  return EINVAL;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-a reference-engine] [-b candidate-engine] [-G] [-k chunk]\n"
+	  "\t[-A arrays-every] [-l limit] [-w window] [-i input-file]\n"
+	  "\t[-r random-programs] [-s seed] [-n snippets] [-u um.um] [-o] [image ...]\n"
+	  , name);
+}
+
+int main (int argc, char ** argv)
+{
+  options_t o = {
+    .reference = UM_ENGINE_DEFAULT
+    , .candidate = UM_ENGINE_DEFAULT
+    , .checking = UM_CHECKING_EXPLICIT
+    , .chunk = 10000
+    , .arrays_every = 16
+    , .limit = 0
+    , .window = 16
+  };
+
+  const char * images [DIFF_MAX_IMAGES];
+  size_t image_count = 0;
+  const char * input_path = NULL;
+  const char * umum_path = "../data/um.um";
+  unsigned int random_count = 0;
+  unsigned long long seed = 1;
+  unsigned int snippets = 2000;
+  int overrun = 0;
+
+  byte * input = NULL;
+  size_t input_size = 0;
+  byte * umum = NULL;
+  size_t umum_size = 0;
+  int divergences = 0;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	const int has_value = i + 1 < argc;
+
+	if (0 == strcmp (argv[i], "-a") && has_value)
+	  {
+	    if (EOK != engine_by_name (argv[++i], &o.reference))
+	      {
+		return 1;
+	      }
+	  }
+	else if (0 == strcmp (argv[i], "-b") && has_value)
+	  {
+	    if (EOK != engine_by_name (argv[++i], &o.candidate))
+	      {
+		return 1;
+	      }
+	  }
+	else if (0 == strcmp (argv[i], "-G"))
+	  {
+	    o.checking = UM_CHECKING_GUARD_PAGES;
+	  }
+	else if (0 == strcmp (argv[i], "-k") && has_value)
+	  {
+	    o.chunk = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-A") && has_value)
+	  {
+	    o.arrays_every = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-l") && has_value)
+	  {
+	    o.limit = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-w") && has_value)
+	  {
+	    o.window = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-i") && has_value)
+	  {
+	    input_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-r") && has_value)
+	  {
+	    random_count = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-s") && has_value)
+	  {
+	    seed = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-n") && has_value)
+	  {
+	    snippets = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-u") && has_value)
+	  {
+	    umum_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-o"))
+	  {
+	    overrun = 1;
+	  }
+	else if ('-' == argv[i][0])
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+	else if (image_count < DIFF_MAX_IMAGES)
+	  {
+	    images[image_count++] = argv[i];
+	  }
+      }
+  }
+
+  if (0 == o.chunk || 0 == o.arrays_every || 0 == o.window || o.window > DIFF_MAX_WINDOW)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  if (0 == image_count && 0 == random_count && ! overrun)
+    {
+      images[image_count++] = "../data/sandmark.umz";
+      images[image_count++] = umum_path;
+      random_count = 20;
+    }
+
+  if (NULL != input_path && EOK != um_load_image (input_path, &input, &input_size))
+    {
+      printf ("Could not read the input file %s\n", input_path);
+      return 1;
+    }
+
+  printf ("reference: %s, candidate: %s%s\n"
+	  , um_engine_name (o.reference)
+	  , um_engine_name (o.candidate)
+	  , UM_CHECKING_GUARD_PAGES == o.checking ? " with guard pages" : "");
+
+  {
+    size_t i = 0;
+    for (i = 0; i < image_count; ++i)
+      {
+	case_t c;
+
+	memset (&c, 0, sizeof(c));
+	snprintf (c.name, sizeof(c.name), "%s", images[i]);
+	c.input = input;
+	c.input_size = input_size;
+
+	if (EOK != um_load_image (images[i], &c.image, &c.size))
+	  {
+	    printf ("Could not open the codex file %s\n", images[i]);
+	    return 1;
+	  }
+
+	divergences += run_case (&c, &o);
+	free (c.image);
+      }
+  }
+
+  if (overrun)
+    {
+      umasm_t a;
+      case_t c;
+
+      umasm_init (&a);
+      overrun_program (&a);
+
+      memset (&c, 0, sizeof(c));
+      snprintf (c.name, sizeof(c.name), "overrun");
+      c.image = umasm_image (&a, &c.size);
+      c.input = input;
+      c.input_size = input_size;
+
+      divergences += run_case (&c, &o);
+
+      free (c.image);
+      umasm_free (&a);
+    }
+
+  // every random program is also run under the UM self interpreter, which
+  // runs the program appended to it
+  um_load_image (umum_path, &umum, &umum_size);
+
+  {
+    unsigned int r = 0;
+    for (r = 0; r < random_count; ++r)
+      {
+	umasm_t a;
+	case_t c;
+	byte random_input [64];
+	size_t i = 0;
+	unsigned long long s = seed + r;
+
+	for (i = 0; i < sizeof(random_input); ++i)
+	  {
+	    random_input[i] = (byte) random_next (&s);
+	  }
+
+	umasm_init (&a);
+	random_program (&a, seed + r, snippets);
+
+	memset (&c, 0, sizeof(c));
+	snprintf (c.name, sizeof(c.name), "random-%llu", seed + r);
+	c.image = umasm_image (&a, &c.size);
+	c.input = NULL != input ? input : random_input;
+	c.input_size = NULL != input ? input_size : sizeof(random_input);
+
+	divergences += run_case (&c, &o);
+
+	if (NULL != umum)
+	  {
+	    byte * nested = (byte *) malloc (umum_size + c.size);
+
+	    memcpy (nested, umum, umum_size);
+	    memcpy (nested + umum_size, c.image, c.size);
+	    free (c.image);
+
+	    snprintf (c.name, sizeof(c.name), "um.um+random-%llu", seed + r);
+	    c.image = nested;
+	    c.size += umum_size;
+
+	    divergences += run_case (&c, &o);
+	  }
+
+	free (c.image);
+	umasm_free (&a);
+      }
+  }
+
+  free (umum);
+  free (input);
+
+  printf ("%d divergence(s)\n", divergences);
+
+  return 0 == divergences ? 0 : 2;
+}
@@ -0,0 +1,1104 @@
+// umdis : static disassembler of UM images. Follows the control flow from
+// the entry point, propagating the constants set by the orthography
+// operator to resolve the targets of the load program operator, splits
+// the code in basic blocks and prints the listing, with the data ranges
+// in between, and the block map
+//
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../um_priv.h"
+#include "../kernels.h"
+
+
+enum
+  {
+    // constants tracked in a register before it is considered unknown,
+    // two are enough for the conditional jumps (orthography of both
+    // targets then conditional move)
+    DIS_MAX_VALUES = 4,
+    DIS_UNKNOWN = 0xFF,
+
+    DIS_MAX_THREADS = 64,
+
+    // flags of the platters
+    DIS_LEADER = 1,
+    DIS_REACHED = 2,
+    DIS_QUEUED = 4,
+    // entry of a block whose registers are unknown (return sites)
+    DIS_SEED = 8,
+  };
+
+
+// count is 0 while no value reached the register, DIS_UNKNOWN once it may
+// hold any value
+typedef struct values_t
+{
+  byte count;
+  platter_t v [DIS_MAX_VALUES];
+
+} values_t;
+
+typedef struct state_t
+{
+  values_t r [UM_REGISTER_COUNT];
+
+} state_t;
+
+typedef enum block_end_t
+  {
+    // the next platter is the entry of another block
+    END_FALLTHROUGH,
+    // load program of array 0 to known offsets
+    END_JUMP,
+    // load program of array 0 to an unknown offset
+    END_INDIRECT,
+    // load program of another array (or maybe)
+    END_PROGRAM,
+    END_HALT,
+    // invalid operator or end of the image
+    END_FAIL,
+
+    END_COUNT,
+
+  } block_end_t;
+
+static const char * g_end_names [END_COUNT] = {
+  "fallthrough", "jump", "indirect", "program", "halt", "fail"
+};
+
+// registers read by each operator: 1 for A, 2 for B, 4 for C
+static const byte g_reads [16] = {
+  [OP_COND_MOVE] = 7,
+  [OP_ARRAY_INDEX] = 6,
+  [OP_ARRAY_AMEND] = 7,
+  [OP_ADDITION] = 6,
+  [OP_MULTIPLICATION] = 6,
+  [OP_DIVISION] = 6,
+  [OP_NOT_AND] = 6,
+  [OP_ALLOCATION] = 4,
+  [OP_ABANDONMENT] = 4,
+  [OP_OUTPUT] = 4,
+  [OP_LOAD_PROGRAM] = 6,
+  [OP_BULK_STORE] = 7,
+  [OP_BULK_SCAN] = 7,
+};
+
+typedef struct dis_t
+{
+  // the image, native order
+  const platter_t * code;
+  platter_t size;
+  int extensions;
+
+  byte * flags;
+
+  // in state of the reached leaders
+  int * state_of;
+  state_t * states;
+  size_t state_count;
+  size_t state_capacity;
+
+  platter_t * worklist;
+  size_t work_count;
+  size_t work_capacity;
+
+  // leaders / seeds found by the current pass
+  size_t new_leaders;
+
+} dis_t;
+
+typedef struct step_t
+{
+  block_end_t end;
+  size_t target_count;
+  platter_t targets [DIS_MAX_VALUES];
+
+} step_t;
+
+
+//////////////////////////////////////
+// constants
+//////////////////////////////////////
+
+static void values_set (values_t * v, platter_t x)
+{
+  v->count = 1;
+  v->v[0] = x;
+}
+
+static int values_is (const values_t * v, platter_t x)
+{
+  return 1 == v->count && x == v->v[0];
+}
+
+static int values_add (values_t * v, platter_t x)
+{
+  byte i = 0;
+
+  if (DIS_UNKNOWN == v->count)
+    {
+      return 0;
+    }
+
+  for (i = 0; i < v->count; ++i)
+    {
+      if (x == v->v[i])
+	{
+	  return 0;
+	}
+    }
+
+  if (DIS_MAX_VALUES == v->count)
+    {
+      v->count = DIS_UNKNOWN;
+    }
+  else
+    {
+      v->v[v->count++] = x;
+    }
+
+  return 1;
+}
+
+/**
+ * @return 1 if to changed
+ */
+static int values_join (values_t * to, const values_t * from)
+{
+  int changed = 0;
+  byte i = 0;
+
+  if (DIS_UNKNOWN == from->count)
+    {
+      changed = DIS_UNKNOWN != to->count;
+      to->count = DIS_UNKNOWN;
+      return changed;
+    }
+
+  for (i = 0; i < from->count; ++i)
+    {
+      changed |= values_add (to, from->v[i]);
+    }
+
+  return changed;
+}
+
+static void values_binary (values_t * out
+			   , const values_t * a
+			   , const values_t * b
+			   , OperatorCodes op)
+{
+  values_t r;
+  byte i = 0;
+  byte j = 0;
+
+  r.count = 0;
+
+  if (DIS_UNKNOWN == a->count || DIS_UNKNOWN == b->count)
+    {
+      out->count = DIS_UNKNOWN;
+      return;
+    }
+
+  for (i = 0; i < a->count; ++i)
+    {
+      for (j = 0; j < b->count; ++j)
+	{
+	  const platter_t x = a->v[i];
+	  const platter_t y = b->v[j];
+
+	  switch (op)
+	    {
+	    case OP_ADDITION:
+	      values_add (&r, x + y);
+	      break;
+	    case OP_MULTIPLICATION:
+	      values_add (&r, x * y);
+	      break;
+	    case OP_DIVISION:
+	      // the machine fails, no value
+	      if (0 != y)
+		{
+		  values_add (&r, x / y);
+		}
+	      break;
+	    default:
+	      values_add (&r, ~(x & y));
+	      break;
+	    }
+	}
+    }
+
+  if (0 == r.count)
+    {
+      r.count = DIS_UNKNOWN;
+    }
+
+  *out = r;
+}
+
+static void state_fill (state_t * s, int zero)
+{
+  size_t i = 0;
+
+  for (i = 0; i < UM_REGISTER_COUNT; ++i)
+    {
+      if (zero)
+	{
+	  values_set (&s->r[i], 0);
+	}
+      else
+	{
+	  s->r[i].count = DIS_UNKNOWN;
+	}
+    }
+}
+
+/**
+ * Applies the platter to the registers.
+ *
+ * @return 1 if it ends its block, described by step
+ */
+static int dis_step (const dis_t * d, state_t * s, platter_t p, step_t * step)
+{
+  const byte a = (p >> 6) & 0x7;
+  const byte b = (p >> 3) & 0x7;
+  const byte c = p & 0x7;
+  values_t * r = s->r;
+
+  step->target_count = 0;
+
+  switch (OPCODE_FROM_PLATTER (p))
+    {
+    case OP_COND_MOVE:
+      if (values_is (&r[c], 0))
+	{
+	  break;
+	}
+      {
+	byte i = 0;
+	int zero = DIS_UNKNOWN == r[c].count;
+
+	for (i = 0; ! zero && i < r[c].count; ++i)
+	  {
+	    zero = 0 == r[c].v[i];
+	  }
+
+	if (zero)
+	  {
+	    values_t t = r[a];
+	    values_join (&t, &r[b]);
+	    r[a] = t;
+	  }
+	else
+	  {
+	    r[a] = r[b];
+	  }
+      }
+      break;
+
+    case OP_ARRAY_INDEX:
+      r[a].count = DIS_UNKNOWN;
+      break;
+
+    case OP_ADDITION:
+    case OP_MULTIPLICATION:
+    case OP_DIVISION:
+    case OP_NOT_AND:
+      values_binary (&r[a], &r[b], &r[c], OPCODE_FROM_PLATTER (p));
+      break;
+
+    case OP_HALT:
+      step->end = END_HALT;
+      return 1;
+
+    case OP_ALLOCATION:
+      r[b].count = DIS_UNKNOWN;
+      break;
+
+    case OP_INPUT:
+      r[c].count = DIS_UNKNOWN;
+      break;
+
+    case OP_LOAD_PROGRAM:
+      {
+	const int zero = values_is (&r[b], 0);
+	int maybe_zero = DIS_UNKNOWN == r[b].count;
+	byte i = 0;
+
+	for (i = 0; ! maybe_zero && i < r[b].count; ++i)
+	  {
+	    maybe_zero = 0 == r[b].v[i];
+	  }
+
+	if (maybe_zero && DIS_UNKNOWN != r[c].count)
+	  {
+	    for (i = 0; i < r[c].count; ++i)
+	      {
+		step->targets[step->target_count++] = r[c].v[i];
+	      }
+	  }
+
+	step->end = ! zero
+	  ? END_PROGRAM
+	  : DIS_UNKNOWN == r[c].count ? END_INDIRECT : END_JUMP;
+      }
+      return 1;
+
+    case OP_ORTHOGRAPHY:
+      values_set (&r[(p >> 25) & 0x7], p & 0x1FFFFFF);
+      break;
+
+    case OP_BULK_STORE:
+    case OP_BULK_SCAN:
+      if ( ! d->extensions)
+	{
+	  step->end = END_FAIL;
+	  return 1;
+	}
+      if (OP_BULK_SCAN == OPCODE_FROM_PLATTER (p))
+	{
+	  r[c].count = DIS_UNKNOWN;
+	}
+      break;
+
+    default:
+      // amendment, abandonment and output leave the registers alone
+      break;
+    }
+
+  return 0;
+}
+
+
+//////////////////////////////////////
+// analysis
+//////////////////////////////////////
+
+static void dis_push (dis_t * d, platter_t at)
+{
+  if (d->flags[at] & DIS_QUEUED)
+    {
+      return;
+    }
+
+  if (d->work_count == d->work_capacity)
+    {
+      d->work_capacity = 0 == d->work_capacity ? 1024 : 2 * d->work_capacity;
+      d->worklist = (platter_t *) realloc (d->worklist, d->work_capacity * sizeof(platter_t));
+      if (NULL == d->worklist)
+	{
+	  fprintf (stderr, "out of memory\n");
+	  exit (1);
+	}
+    }
+
+  d->worklist[d->work_count++] = at;
+  d->flags[at] |= DIS_QUEUED;
+}
+
+/**
+ * Joins s in the in state of the leader at.
+ */
+static void dis_join_into (dis_t * d, platter_t at, const state_t * s)
+{
+  if (d->state_of[at] < 0)
+    {
+      if (d->state_count == d->state_capacity)
+	{
+	  d->state_capacity = 0 == d->state_capacity ? 1024 : 2 * d->state_capacity;
+	  d->states = (state_t *) realloc (d->states, d->state_capacity * sizeof(state_t));
+	  if (NULL == d->states)
+	    {
+	      fprintf (stderr, "out of memory\n");
+	      exit (1);
+	    }
+	}
+
+      d->state_of[at] = (int) d->state_count;
+      d->states[d->state_count++] = *s;
+      dis_push (d, at);
+      return;
+    }
+
+  {
+    state_t * to = &d->states[d->state_of[at]];
+    int changed = 0;
+    size_t i = 0;
+
+    for (i = 0; i < UM_REGISTER_COUNT; ++i)
+      {
+	changed |= values_join (&to->r[i], &s->r[i]);
+      }
+
+    if (changed)
+      {
+	dis_push (d, at);
+      }
+  }
+}
+
+static void dis_enter (dis_t * d, platter_t at, const state_t * s)
+{
+  if (at >= d->size)
+    {
+      return;
+    }
+
+  if (0 == (d->flags[at] & DIS_LEADER))
+    {
+      d->flags[at] |= DIS_LEADER;
+      d->new_leaders++;
+    }
+
+  dis_join_into (d, at, s);
+}
+
+static void dis_walk (dis_t * d, platter_t leader)
+{
+  state_t s = d->states[d->state_of[leader]];
+  platter_t i = leader;
+
+  for (;;)
+    {
+      step_t step;
+
+      d->flags[i] |= DIS_REACHED;
+
+      if (dis_step (d, &s, d->code[i], &step))
+	{
+	  size_t t = 0;
+
+	  for (t = 0; t < step.target_count; ++t)
+	    {
+	      dis_enter (d, step.targets[t], &s);
+	    }
+	  return;
+	}
+
+      if (i + 1 == d->size)
+	{
+	  return;
+	}
+
+      if (d->flags[i + 1] & DIS_LEADER)
+	{
+	  dis_join_into (d, i + 1, &s);
+	  return;
+	}
+
+      i++;
+    }
+}
+
+/**
+ * Adds the return sites of the reached code as seeds: offsets set by an
+ * orthography that follow a load program.
+ */
+static void dis_find_return_sites (dis_t * d)
+{
+  platter_t i = 0;
+
+  for (i = 0; i < d->size; ++i)
+    {
+      const platter_t p = d->code[i];
+      const platter_t v = p & 0x1FFFFFF;
+
+      if (0 == (d->flags[i] & DIS_REACHED)
+	  || OP_ORTHOGRAPHY != OPCODE_FROM_PLATTER (p)
+	  || 0 == v
+	  || v >= d->size
+	  || OP_LOAD_PROGRAM != OPCODE_FROM_PLATTER (d->code[v - 1])
+	  || (d->flags[v] & DIS_SEED))
+	{
+	  continue;
+	}
+
+      d->flags[v] |= DIS_SEED | DIS_LEADER;
+      d->new_leaders++;
+    }
+}
+
+/**
+ * Runs the propagation from the entry and the seeds until no leader is
+ * found anymore. A pass that finds a leader inside a block already walked
+ * is started again, so that the block is split with the right state.
+ */
+static void dis_analyze (dis_t * d, unsigned int * passes)
+{
+  state_t entry;
+  state_t unknown;
+
+  state_fill (&entry, 1);
+  state_fill (&unknown, 0);
+
+  *passes = 0;
+
+  do
+    {
+      platter_t i = 0;
+
+      (*passes)++;
+
+      d->new_leaders = 0;
+      d->state_count = 0;
+      for (i = 0; i < d->size; ++i)
+	{
+	  d->flags[i] &= ~(DIS_REACHED | DIS_QUEUED);
+	  d->state_of[i] = -1;
+	}
+
+      dis_enter (d, 0, &entry);
+
+      // the seeds only enter with unknown registers when the propagation
+      // does not reach them
+      do
+	{
+	  while (0 != d->work_count)
+	    {
+	      const platter_t at = d->worklist[--d->work_count];
+
+	      d->flags[at] &= ~DIS_QUEUED;
+	      dis_walk (d, at);
+	    }
+
+	  for (i = 0; i < d->size; ++i)
+	    {
+	      if ((d->flags[i] & DIS_SEED) && d->state_of[i] < 0)
+		{
+		  dis_join_into (d, i, &unknown);
+		}
+	    }
+	}
+      while (0 != d->work_count);
+
+      if (0 == d->new_leaders)
+	{
+	  dis_find_return_sites (d);
+	}
+    }
+  while (0 != d->new_leaders);
+}
+
+
+//////////////////////////////////////
+// listing
+//////////////////////////////////////
+
+typedef struct buffer_t
+{
+  char * data;
+  size_t size;
+  size_t capacity;
+
+} buffer_t;
+
+static void buffer_printf (buffer_t * b, const char * format, ...)
+  __attribute__ ((format (printf, 2, 3)));
+
+static void buffer_printf (buffer_t * b, const char * format, ...)
+{
+  for (;;)
+    {
+      va_list args;
+      int n = 0;
+
+      va_start (args, format);
+      n = vsnprintf (b->data + b->size, b->capacity - b->size, format, args);
+      va_end (args);
+
+      if (n >= 0 && (size_t) n < b->capacity - b->size)
+	{
+	  b->size += n;
+	  return;
+	}
+
+      b->capacity = 0 == b->capacity ? 1 << 16 : 2 * b->capacity;
+      b->data = (char *) realloc (b->data, b->capacity);
+      if (NULL == b->data)
+	{
+	  fprintf (stderr, "out of memory\n");
+	  exit (1);
+	}
+    }
+}
+
+typedef struct shard_t
+{
+  const dis_t * dis;
+  platter_t start;
+  platter_t end;
+  int dump_data;
+
+  buffer_t out;
+
+  // blocks of the shard
+  unsigned long long blocks;
+  unsigned long long edges;
+  unsigned long long ends [END_COUNT];
+
+  // block map lines, when asked for
+  int map;
+  buffer_t blocks_out;
+
+} shard_t;
+
+static void shard_print_values (buffer_t * b, byte reg, const values_t * v)
+{
+  byte i = 0;
+
+  if (DIS_UNKNOWN == v->count)
+    {
+      buffer_printf (b, " REG[0x%02X]=?", reg);
+      return;
+    }
+
+  buffer_printf (b, " REG[0x%02X] in {", reg);
+  for (i = 0; i < v->count; ++i)
+    {
+      buffer_printf (b, 0 == i ? "0x%08X" : ", 0x%08X", v->v[i]);
+    }
+  buffer_printf (b, "}");
+}
+
+/**
+ * Prints the block from leader, its state is the in state found by the
+ * analysis.
+ *
+ * @return the platter that follows the block
+ */
+static platter_t shard_block (shard_t * sh, platter_t leader)
+{
+  const dis_t * d = sh->dis;
+  state_t s = d->states[d->state_of[leader]];
+  um_t scratch;
+  platter_t i = leader;
+  step_t step;
+  int ended = 0;
+
+  memset (&scratch, 0, sizeof(scratch));
+
+  buffer_printf (&sh->out, "\nL_%08X:\n", leader);
+
+  for (;;)
+    {
+      const platter_t p = d->code[i];
+      const byte regs [3] = { (p >> 6) & 0x7, (p >> 3) & 0x7, p & 0x7 };
+      char text [192];
+      int annotated = 0;
+      size_t r = 0;
+
+      // the formatters print the registers of the machine, which holds
+      // the constants known at that point
+      for (r = 0; r < UM_REGISTER_COUNT; ++r)
+	{
+	  scratch.registers[r] = 1 == s.r[r].count ? s.r[r].v[0] : 0;
+	}
+      um_pp_instruction (text, sizeof(text), &scratch, p);
+
+      buffer_printf (&sh->out, "  0x%08X: %08X  %s", i, p, text);
+
+      // the registers read that are not a known constant
+      for (r = 0; r < 3; ++r)
+	{
+	  const byte reg = regs[r];
+
+	  if (0 == (g_reads [OPCODE_FROM_PLATTER (p)] & (1 << r))
+	      || 1 == s.r[reg].count
+	      || (r > 0 && reg == regs[0] && (g_reads [OPCODE_FROM_PLATTER (p)] & 1))
+	      || (r > 1 && reg == regs[1] && (g_reads [OPCODE_FROM_PLATTER (p)] & 2)))
+	    {
+	      continue;
+	    }
+
+	  buffer_printf (&sh->out, annotated ? "," : "  ;");
+	  shard_print_values (&sh->out, reg, &s.r[reg]);
+	  annotated = 1;
+	}
+
+      ended = dis_step (d, &s, p, &step);
+      if (ended)
+	{
+	  size_t t = 0;
+
+	  buffer_printf (&sh->out, "%s %s", annotated ? ";" : "  ;", g_end_names [step.end]);
+	  for (t = 0; t < step.target_count; ++t)
+	    {
+	      buffer_printf (&sh->out, step.targets[t] < d->size ? " L_%08X" : " 0x%08X (outside)"
+			     , step.targets[t]);
+	    }
+	}
+      buffer_printf (&sh->out, "\n");
+
+      if (ended)
+	{
+	  break;
+	}
+
+      if (i + 1 == d->size)
+	{
+	  step.end = END_FAIL;
+	  step.target_count = 0;
+	  buffer_printf (&sh->out, "  ; falls off the end of the image\n");
+	  break;
+	}
+
+      if (d->flags[i + 1] & DIS_LEADER)
+	{
+	  step.end = END_FALLTHROUGH;
+	  step.targets[0] = i + 1;
+	  step.target_count = 1;
+	  break;
+	}
+
+      i++;
+    }
+
+  sh->blocks++;
+  sh->edges += step.target_count;
+  sh->ends [step.end]++;
+
+  if (sh->map)
+    {
+      size_t t = 0;
+
+      buffer_printf (&sh->blocks_out, "%08X %08X %s", leader, i + 1, g_end_names [step.end]);
+      for (t = 0; t < step.target_count; ++t)
+	{
+	  buffer_printf (&sh->blocks_out, " %08X", step.targets[t]);
+	}
+      buffer_printf (&sh->blocks_out, "\n");
+    }
+
+  return i + 1;
+}
+
+static void * shard_run (void * arg)
+{
+  shard_t * sh = (shard_t *) arg;
+  const dis_t * d = sh->dis;
+  platter_t i = sh->start;
+
+  // a data range is summed up by the shard where it starts
+  if ( ! sh->dump_data && 0 != i)
+    {
+      while (i < sh->end
+	     && 0 == (d->flags[i - 1] & DIS_REACHED)
+	     && 0 == (d->flags[i] & DIS_REACHED))
+	{
+	  i++;
+	}
+    }
+
+  while (i < sh->end)
+    {
+      if (d->flags[i] & DIS_REACHED)
+	{
+	  i = shard_block (sh, i);
+	  continue;
+	}
+
+      // data up to the next reached platter
+      {
+	const platter_t start = i;
+
+	while ((i < sh->end || ! sh->dump_data)
+	       && i < d->size
+	       && 0 == (d->flags[i] & DIS_REACHED))
+	  {
+	    if (sh->dump_data)
+	      {
+		buffer_printf (&sh->out, "  0x%08X: %08X  DATA\n", i, d->code[i]);
+	      }
+	    i++;
+	  }
+
+	if ( ! sh->dump_data)
+	  {
+	    buffer_printf (&sh->out, "\n  0x%08X - 0x%08X: data, %u platters\n"
+			   , start, i - 1, i - start);
+	  }
+      }
+    }
+
+  return NULL;
+}
+
+
+//////////////////////////////////////
+// main
+//////////////////////////////////////
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-j threads] [-o listing] [-b blocks] [-d] [-q] [-E] image\n", name);
+  printf ("\t-j threads: formats the listing with that many threads (one per CPU)\n");
+  printf ("\t-o listing: writes the listing there instead of stdout\n");
+  printf ("\t-b blocks: writes the block map, \"start end kind successors\" per line\n");
+  printf ("\t-d: lists every data platter\n");
+  printf ("\t-q: only prints the summary\n");
+  printf ("\t-E: operators 14 and 15 are valid (see um_set_extensions)\n");
+}
+
+int main (int argc, char ** argv)
+{
+  const char * path = NULL;
+  const char * listing = NULL;
+  const char * map = NULL;
+  long threads = sysconf (_SC_NPROCESSORS_ONLN);
+  int dump_data = 0;
+  int quiet = 0;
+  dis_t d;
+  byte * image = NULL;
+  size_t size = 0;
+  platter_t * code = NULL;
+  unsigned int passes = 0;
+  double start = 0;
+  double analyzed = 0;
+  double listed = 0;
+
+  memset (&d, 0, sizeof(d));
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-j") && i + 1 < argc)
+	  {
+	    threads = atol (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-o") && i + 1 < argc)
+	  {
+	    listing = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-b") && i + 1 < argc)
+	  {
+	    map = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-d"))
+	  {
+	    dump_data = 1;
+	  }
+	else if (0 == strcmp (argv[i], "-q"))
+	  {
+	    quiet = 1;
+	  }
+	else if (0 == strcmp (argv[i], "-E"))
+	  {
+	    d.extensions = 1;
+	  }
+	else if ('-' == argv[i][0])
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+	else
+	  {
+	    path = argv[i];
+	  }
+      }
+  }
+
+  if (NULL == path)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  if (threads < 1)
+    {
+      threads = 1;
+    }
+  if (threads > DIS_MAX_THREADS)
+    {
+      threads = DIS_MAX_THREADS;
+    }
+
+  if (EOK != um_load_image (path, &image, &size) || 0 == size || 0 != size % sizeof(platter_t))
+    {
+      printf ("Could not read the image %s\n", path);
+      return 1;
+    }
+
+  start = now ();
+
+  d.size = size / sizeof(platter_t);
+  code = (platter_t *) malloc (size);
+  d.flags = (byte *) calloc (d.size, 1);
+  d.state_of = (int *) malloc (d.size * sizeof(int));
+  if (NULL == code || NULL == d.flags || NULL == d.state_of)
+    {
+      printf ("out of memory\n");
+      return 1;
+    }
+
+  um_kernels_swap_platters (code, (const platter_t *) image, d.size);
+  d.code = code;
+
+  dis_analyze (&d, &passes);
+
+  analyzed = now ();
+
+  {
+    shard_t shards [DIS_MAX_THREADS];
+    pthread_t ids [DIS_MAX_THREADS];
+    shard_t total;
+    long s = 0;
+    platter_t at = 0;
+    unsigned long long code_platters = 0;
+    platter_t i = 0;
+
+    memset (shards, 0, sizeof(shards));
+    memset (&total, 0, sizeof(total));
+
+    // the shards start on a block or on data
+    for (s = 0; s < threads; ++s)
+      {
+	platter_t end = (platter_t) ((unsigned long long) d.size * (s + 1) / threads);
+
+	while (end < d.size
+	       && (d.flags[end] & DIS_REACHED)
+	       && 0 == (d.flags[end] & DIS_LEADER))
+	  {
+	    end++;
+	  }
+	if (end < at)
+	  {
+	    end = at;
+	  }
+
+	shards[s].dis = &d;
+	shards[s].start = at;
+	shards[s].end = end;
+	shards[s].dump_data = dump_data;
+	shards[s].map = NULL != map;
+	at = end;
+      }
+
+    for (s = 0; s < threads; ++s)
+      {
+	if (0 != pthread_create (&ids[s], NULL, shard_run, &shards[s]))
+	  {
+	    shard_run (&shards[s]);
+	    ids[s] = pthread_self ();
+	  }
+      }
+
+    for (s = 0; s < threads; ++s)
+      {
+	if ( ! pthread_equal (ids[s], pthread_self ()))
+	  {
+	    pthread_join (ids[s], NULL);
+	  }
+      }
+
+    listed = now ();
+
+    {
+      FILE * out = NULL;
+
+      if ( ! quiet)
+	{
+	  out = NULL == listing ? stdout : fopen (listing, "w");
+	  if (NULL == out)
+	    {
+	      printf ("Could not write the listing %s\n", listing);
+	      return 1;
+	    }
+	}
+
+      for (s = 0; s < threads; ++s)
+	{
+	  if (NULL != out)
+	    {
+	      fwrite (shards[s].out.data, 1, shards[s].out.size, out);
+	    }
+	  free (shards[s].out.data);
+	}
+
+      if (NULL != out && stdout != out)
+	{
+	  fclose (out);
+	}
+    }
+
+    if (NULL != map)
+      {
+	FILE * out = fopen (map, "w");
+
+	if (NULL == out)
+	  {
+	    printf ("Could not write the block map %s\n", map);
+	    return 1;
+	  }
+
+	for (s = 0; s < threads; ++s)
+	  {
+	    fwrite (shards[s].blocks_out.data, 1, shards[s].blocks_out.size, out);
+	  }
+	fclose (out);
+      }
+
+    for (s = 0; s < threads; ++s)
+      {
+	size_t e = 0;
+
+	total.blocks += shards[s].blocks;
+	total.edges += shards[s].edges;
+	for (e = 0; e < END_COUNT; ++e)
+	  {
+	    total.ends[e] += shards[s].ends[e];
+	  }
+	free (shards[s].blocks_out.data);
+      }
+
+    for (i = 0; i < d.size; ++i)
+      {
+	code_platters += 0 != (d.flags[i] & DIS_REACHED);
+      }
+
+    fprintf (stderr, "%s: %u platters, %llu of code in %llu blocks (%llu edges), %llu of data\n"
+	     , path
+	     , d.size
+	     , code_platters
+	     , total.blocks
+	     , total.edges
+	     , d.size - code_platters);
+    fprintf (stderr, "block ends: %llu fallthrough, %llu jump, %llu indirect, %llu program, %llu halt, %llu fail\n"
+	     , total.ends[END_FALLTHROUGH]
+	     , total.ends[END_JUMP]
+	     , total.ends[END_INDIRECT]
+	     , total.ends[END_PROGRAM]
+	     , total.ends[END_HALT]
+	     , total.ends[END_FAIL]);
+    fprintf (stderr, "analysis %.1fms (%u passes), listing %.1fms with %ld threads\n"
+	     , (analyzed - start) * 1e3
+	     , passes
+	     , (listed - analyzed) * 1e3
+	     , threads);
+  }
+
+  free (d.worklist);
+  free (d.states);
+  free (d.state_of);
+  free (d.flags);
+  free (code);
+  free (image);
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+// umprof : renders an allocation event log recorded with "icfp -P"
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../um_priv.h"
+#include "../profile.h"
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-n count] log-file\n", name);
+  printf ("\t-n count: only renders the first count events\n");
+}
+
+int main (int argc, char ** argv)
+{
+  const char * path = NULL;
+  unsigned long long limit = ~0ULL;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-n") && i + 1 < argc)
+	  {
+	    limit = strtoull (argv[++i], NULL, 0);
+	  }
+	else
+	  {
+	    path = argv[i];
+	  }
+      }
+  }
+
+  if (NULL == path)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  {
+    int fd = open (path, O_RDONLY);
+    struct stat st;
+    void * log = MAP_FAILED;
+    const byte * cur = NULL;
+    const byte * end = NULL;
+    unsigned long long count = 0;
+    unsigned long long now = 0;
+
+    if (fd < 0 || 0 != fstat (fd, &st))
+      {
+	printf ("Could not open the log file: %d\n", errno);
+	return 1;
+      }
+
+    // the magic and the version byte
+    if (st.st_size > 5)
+      {
+	log = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+    close (fd);
+
+    if (MAP_FAILED == log || 0 != memcmp (log, "UMAL", 4))
+      {
+	printf ("Not an allocation log\n");
+	return 1;
+      }
+
+    cur = (const byte *) log + 5;
+    end = (const byte *) log + st.st_size;
+
+    while (count < limit && cur < end)
+      {
+	const int kind = *cur++;
+	unsigned long long delta = 0;
+	unsigned long long id = 0;
+	unsigned long long size = 0;
+	unsigned long long site = 0;
+
+	if (EOK != um_priv_get_varint (&cur, end, &delta)
+	    || EOK != um_priv_get_varint (&cur, end, &id)
+	    || EOK != um_priv_get_varint (&cur, end, &size)
+	    || (UM_PROFILE_ALLOCATION == kind && EOK != um_priv_get_varint (&cur, end, &site)))
+	  {
+	    printf ("Corrupted log after %llu events\n", count);
+	    break;
+	  }
+
+	now += delta;
+	count++;
+
+	if (UM_PROFILE_ALLOCATION == kind)
+	  {
+	    printf ("%llu : ALLOCATE 0x%08llX (0x%08llX platters) at 0x%08llX\n"
+		    , now, id, size, site);
+	  }
+	else
+	  {
+	    printf ("%llu : RELEASE 0x%08llX (0x%08llX platters)\n", now, id, size);
+	  }
+      }
+
+    munmap (log, st.st_size);
+  }
+
+  return 0;
+}
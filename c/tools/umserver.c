@@ -0,0 +1,867 @@
+// umserver : serves sessions of a UM program over a Unix domain socket,
+// every connection getting its own clone of a machine booted once
+//
+
+// accept4, pipe2
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../um.h"
+#include "../session.h"
+#include "../sched.h"
+
+#if ! defined(EOK)
+#define EOK 0
+#endif
+
+
+typedef struct buffer_t
+{
+  byte * data;
+  size_t start;
+  size_t size;
+  size_t capacity;
+
+} buffer_t;
+
+
+typedef struct conn_t
+{
+  int fd;
+
+  um_t machine;
+  um_session_t * session;
+  size_t id;
+
+  // the machine waits (for input or for its output to be drained) or is
+  // stopped: the session can be used by the main thread
+  int parked;
+  um_status_t status;
+
+  // received and not fed yet / drained and not sent yet
+  buffer_t in;
+  buffer_t out;
+  int writing;
+
+  // the client shut its side down: the machine reads EOF once what was
+  // received is fed, the session ends when it halts and its output is sent
+  int eof;
+
+  double last_activity;
+
+  // position in the active connections
+  size_t index;
+
+} conn_t;
+
+
+// what the workers send through the notification pipe
+typedef struct notification_t
+{
+  size_t id;
+  um_status_t status;
+
+} notification_t;
+
+
+typedef struct server_t
+{
+  int epoll;
+  int listener;
+  int notify_pipe [2];
+
+  um_sched_t * sched;
+
+  // booted machine and what it printed while booting
+  um_t template;
+  buffer_t banner;
+
+  size_t output_capacity;
+  double idle_timeout;
+
+  // indexed by scheduler id: the ids of the closed sessions are given
+  // again, so the table stays the size of the peak of sessions
+  conn_t ** conns;
+  size_t conn_capacity;
+
+  conn_t ** active;
+  size_t active_count;
+  size_t active_capacity;
+
+  // a notification did not fit in the pipe: every session is looked at
+  int overflowed;
+
+  // stats
+  unsigned long long sessions;
+  unsigned long long closed_instructions;
+  unsigned long long last_instructions;
+  double last_report;
+
+} server_t;
+
+
+// tags of the epoll events that are not connections
+static int g_listener_tag;
+static int g_notify_tag;
+
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long rss_kb (void)
+{
+  FILE * f = fopen ("/proc/self/statm", "r");
+  long size = 0;
+  long resident = 0;
+
+  if (NULL == f)
+    {
+      return 0;
+    }
+
+  if (2 != fscanf (f, "%ld %ld", &size, &resident))
+    {
+      resident = 0;
+    }
+  fclose (f);
+
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static int buffer_append (buffer_t * b, const byte * data, size_t size)
+{
+  if (b->start == b->size)
+    {
+      b->start = b->size = 0;
+    }
+
+  if (b->size + size > b->capacity)
+    {
+      size_t capacity = 0 == b->capacity ? 4096 : b->capacity;
+      byte * p = NULL;
+
+      memmove (b->data, b->data + b->start, b->size - b->start);
+      b->size -= b->start;
+      b->start = 0;
+
+      while (capacity < b->size + size)
+	{
+	  capacity *= 2;
+	}
+
+      p = (byte *) realloc (b->data, capacity);
+      if (NULL == p)
+	{
+	  return ENOMEM;
+	}
+      b->data = p;
+      b->capacity = capacity;
+    }
+
+  memcpy (b->data + b->size, data, size);
+  b->size += size;
+
+  return EOK;
+}
+
+static size_t buffer_pending (const buffer_t * b)
+{
+  return b->size - b->start;
+}
+
+static void notify (void * context, size_t id, um_status_t status)
+{
+  server_t * server = (server_t *) context;
+  notification_t n = { id, status };
+  ssize_t written = 0;
+
+  // smaller than PIPE_BUF, written at once or not at all: the pipe does
+  // not block, the main thread may be waiting in um_sched_remove
+  while ((written = write (server->notify_pipe[1], &n, sizeof(n))) < 0 && EINTR == errno)
+    ;
+
+  // the full pipe wakes the main thread up anyway
+  if (written < 0)
+    {
+      __atomic_store_n (&server->overflowed, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void watch (server_t * server, conn_t * c, int writing)
+{
+  struct epoll_event event;
+
+  memset (&event, 0, sizeof(event));
+  event.events = (c->eof ? 0 : EPOLLIN) | (writing ? EPOLLOUT : 0);
+  event.data.ptr = c;
+
+  epoll_ctl (server->epoll, EPOLL_CTL_MOD, c->fd, &event);
+  c->writing = writing;
+}
+
+
+//////////////////////////////////////
+// connections
+//////////////////////////////////////
+
+static void close_conn (server_t * server, conn_t * c)
+{
+  um_sched_remove (server->sched, c->id);
+
+  server->closed_instructions += c->machine.stats.instructions;
+
+  um_session_close (c->session);
+  um_release (&c->machine);
+
+  epoll_ctl (server->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+  close (c->fd);
+
+  server->conns[c->id] = NULL;
+
+  server->active[c->index] = server->active[--server->active_count];
+  server->active[c->index]->index = c->index;
+
+  free (c->in.data);
+  free (c->out.data);
+  free (c);
+}
+
+/**
+ * @return 0 when the connection was closed
+ */
+static int flush_conn (server_t * server, conn_t * c)
+{
+  while (0 != buffer_pending (&c->out))
+    {
+      ssize_t n = send (c->fd, c->out.data + c->out.start, buffer_pending (&c->out), MSG_NOSIGNAL);
+
+      if (n < 0 && EINTR == errno)
+	{
+	  continue;
+	}
+      if (n < 0 && EAGAIN == errno)
+	{
+	  break;
+	}
+      if (n <= 0)
+	{
+	  close_conn (server, c);
+	  return 0;
+	}
+
+      c->out.start += n;
+      c->last_activity = now ();
+    }
+
+  if ((0 != buffer_pending (&c->out)) != c->writing)
+    {
+      watch (server, c, 0 != buffer_pending (&c->out));
+    }
+
+  return 1;
+}
+
+/**
+ * Moves the output of a parked machine to the socket and its input to the
+ * machine, then queues it again when it can make progress.
+ */
+static void service (server_t * server, conn_t * c)
+{
+  if ( ! c->parked)
+    {
+      return;
+    }
+
+  while (0 != um_session_pending_output (c->session))
+    {
+      byte chunk [4096];
+      size_t n = um_session_drain (c->session, chunk, sizeof(chunk));
+
+      buffer_append (&c->out, chunk, n);
+    }
+
+  if ( ! flush_conn (server, c))
+    {
+      return;
+    }
+
+  if (UM_STATUS_HALTED == c->status || UM_STATUS_FAILED == c->status)
+    {
+      if (0 == buffer_pending (&c->out))
+	{
+	  close_conn (server, c);
+	}
+      return;
+    }
+
+  // the client reads slower than the machine writes
+  if (0 != buffer_pending (&c->out))
+    {
+      return;
+    }
+
+  if (0 != buffer_pending (&c->in))
+    {
+      um_session_feed (c->session, c->in.data + c->in.start, buffer_pending (&c->in));
+      c->in.start = c->in.size = 0;
+    }
+  else if (UM_STATUS_NEEDS_INPUT == c->status && ! c->eof)
+    {
+      return;
+    }
+
+  if (c->eof)
+    {
+      um_session_end_input (c->session);
+    }
+
+  c->parked = 0;
+  um_sched_wake (server->sched, c->id);
+}
+
+static void accept_conns (server_t * server)
+{
+  while (1)
+    {
+      conn_t * c = NULL;
+      struct epoll_event event;
+      int fd = accept4 (server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      int err = EOK;
+
+      if (fd < 0)
+	{
+	  return;
+	}
+
+      c = (conn_t *) calloc (1, sizeof(conn_t));
+      if (NULL == c)
+	{
+	  close (fd);
+	  continue;
+	}
+
+      c->fd = fd;
+      c->last_activity = now ();
+
+      err = um_clone (&c->machine, &server->template);
+      if (EOK == err)
+	{
+	  err = um_session_open (&c->session, &c->machine, UM_ENGINE_DEFAULT, server->output_capacity);
+	}
+      if (EOK == err)
+	{
+	  err = buffer_append (&c->out, server->banner.data, server->banner.size);
+	}
+      if (EOK == err && server->active_count == server->active_capacity)
+	{
+	  const size_t capacity = 0 == server->active_capacity ? 64 : 2 * server->active_capacity;
+	  conn_t ** p = (conn_t **) realloc (server->active, capacity * sizeof(conn_t *));
+
+	  err = NULL == p ? ENOMEM : EOK;
+	  if (NULL != p)
+	    {
+	      server->active = p;
+	      server->active_capacity = capacity;
+	    }
+	}
+      if (EOK == err)
+	{
+	  err = um_sched_add_session (server->sched, c->session, &c->id);
+	}
+
+      if (EOK != err)
+	{
+	  fprintf (stderr, "could not start a session: %d\n", err);
+	  if (NULL != c->session)
+	    {
+	      um_session_close (c->session);
+	    }
+	  um_release (&c->machine);
+	  free (c->out.data);
+	  free (c);
+	  close (fd);
+	  continue;
+	}
+
+      if (c->id >= server->conn_capacity)
+	{
+	  size_t capacity = 0 == server->conn_capacity ? 64 : server->conn_capacity;
+	  conn_t ** p = NULL;
+
+	  while (capacity <= c->id)
+	    {
+	      capacity *= 2;
+	    }
+
+	  p = (conn_t **) realloc (server->conns, capacity * sizeof(conn_t *));
+	  if (NULL == p)
+	    {
+	      fprintf (stderr, "out of memory\n");
+	      exit (1);
+	    }
+	  memset (p + server->conn_capacity, 0, (capacity - server->conn_capacity) * sizeof(conn_t *));
+	  server->conns = p;
+	  server->conn_capacity = capacity;
+	}
+
+      server->conns[c->id] = c;
+      c->index = server->active_count;
+      server->active[server->active_count++] = c;
+      server->sessions++;
+
+      memset (&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = c;
+      epoll_ctl (server->epoll, EPOLL_CTL_ADD, fd, &event);
+
+      flush_conn (server, c);
+    }
+}
+
+static void read_conn (server_t * server, conn_t * c)
+{
+  while (1)
+    {
+      byte chunk [4096];
+      ssize_t n = recv (c->fd, chunk, sizeof(chunk), 0);
+
+      if (n < 0 && EINTR == errno)
+	{
+	  continue;
+	}
+      if (n < 0 && EAGAIN == errno)
+	{
+	  break;
+	}
+      if (0 == n && ! c->eof)
+	{
+	  c->eof = 1;
+	  watch (server, c, c->writing);
+	  break;
+	}
+      // or the client is gone, EPOLLHUP once it shut its side down
+      if (n <= 0)
+	{
+	  close_conn (server, c);
+	  return;
+	}
+
+      buffer_append (&c->in, chunk, n);
+      c->last_activity = now ();
+    }
+
+  service (server, c);
+}
+
+/**
+ * Services the session when its machine is in that state: a notification
+ * may come for a closed session whose id was given again, or for a wait
+ * already serviced, the machine being queued or running.
+ */
+static void notified (server_t * server, size_t id, um_status_t status)
+{
+  conn_t * c = id < server->conn_capacity ? server->conns[id] : NULL;
+  um_sched_stats_t stats;
+
+  // closed since
+  if (NULL == c)
+    {
+      return;
+    }
+
+  if (EOK != um_sched_get_stats (server->sched, id, &stats)
+      || stats.status != status
+      || UM_STATUS_RUNNING == status)
+    {
+      return;
+    }
+
+  c->parked = 1;
+  c->status = status;
+
+  service (server, c);
+}
+
+static void read_notifications (server_t * server)
+{
+  notification_t n;
+
+  while (sizeof(n) == read (server->notify_pipe[0], &n, sizeof(n)))
+    {
+      notified (server, n.id, n.status);
+    }
+
+  // the notifications lost are found in the state of the machines
+  if (__atomic_exchange_n (&server->overflowed, 0, __ATOMIC_ACQUIRE))
+    {
+      size_t i = 0;
+
+      while (i < server->active_count)
+	{
+	  conn_t * c = server->active[i];
+	  um_sched_stats_t stats;
+
+	  if ( ! c->parked && EOK == um_sched_get_stats (server->sched, c->id, &stats))
+	    {
+	      notified (server, c->id, stats.status);
+	    }
+
+	  // unless it was closed, and replaced by the last one
+	  if (i < server->active_count && c == server->active[i])
+	    {
+	      i++;
+	    }
+	}
+    }
+}
+
+static void expire_conns (server_t * server)
+{
+  const double t = now ();
+  size_t i = 0;
+
+  while (i < server->active_count)
+    {
+      conn_t * c = server->active[i];
+
+      if (t - c->last_activity >= server->idle_timeout)
+	{
+	  close_conn (server, c);
+	}
+      else
+	{
+	  i++;
+	}
+    }
+}
+
+static void report (server_t * server)
+{
+  const double t = now ();
+  unsigned long long instructions = server->closed_instructions;
+  unsigned long long heap = 0;
+  size_t i = 0;
+
+  for (i = 0; i < server->active_count; ++i)
+    {
+      um_sched_stats_t stats;
+
+      if (EOK == um_sched_get_stats (server->sched, server->active[i]->id, &stats))
+	{
+	  instructions += stats.instructions;
+	  heap += stats.heap_bytes;
+	}
+    }
+
+  fprintf (stderr
+	   , "%lu active sessions (%llu total), %.3f Minstr/s, heap %llu bytes, rss %ld kB\n"
+	   , (unsigned long) server->active_count
+	   , server->sessions
+	   , t > server->last_report
+	     ? (instructions - server->last_instructions) / (t - server->last_report) / 1e6
+	     : 0.0
+	   , heap
+	   , rss_kb ());
+
+  server->last_instructions = instructions;
+  server->last_report = t;
+}
+
+
+//////////////////////////////////////
+// setup
+//////////////////////////////////////
+
+/**
+ * Runs the program until it first waits for input, having consumed the
+ * boot input.
+ */
+static int boot (server_t * server, byte * image, size_t size, const byte * input, size_t input_size)
+{
+  um_session_t * session = NULL;
+  um_status_t status = UM_STATUS_RUNNING;
+  int err = um_load (&server->template, image, size);
+
+  if (EOK == err)
+    {
+      err = um_session_open (&session, &server->template, UM_ENGINE_DEFAULT, 4096);
+    }
+  if (EOK == err && 0 != input_size)
+    {
+      err = um_session_feed (session, input, input_size);
+    }
+  if (EOK != err)
+    {
+      return err;
+    }
+
+  while (UM_STATUS_NEEDS_INPUT != status)
+    {
+      byte chunk [4096];
+      size_t n = 0;
+
+      status = um_session_resume (session, ~0ULL);
+
+      while (0 != (n = um_session_drain (session, chunk, sizeof(chunk))))
+	{
+	  buffer_append (&server->banner, chunk, n);
+	}
+
+      if (UM_STATUS_HALTED == status || UM_STATUS_FAILED == status)
+	{
+	  um_session_close (session);
+	  return ECANCELED;
+	}
+    }
+
+  um_session_close (session);
+
+  return EOK;
+}
+
+static int listen_on (const char * path)
+{
+  struct sockaddr_un address;
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    {
+      return -1;
+    }
+
+  memset (&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  snprintf (address.sun_path, sizeof(address.sun_path), "%s", path);
+
+  unlink (path);
+
+  if (0 != bind (fd, (struct sockaddr *) &address, sizeof(address))
+      || 0 != listen (fd, 128))
+    {
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-s socket] [-w workers] [-q slice] [-o output-buffer] [-t idle-seconds]\n"
+	  "\t[-i stats-seconds] [-b boot-input] [-G] [program]\n"
+	  , name);
+}
+
+int main (int argc, char ** argv)
+{
+  const char * path = "../data/codex.umz";
+  const char * socket_path = "um.sock";
+  const char * boot_path = NULL;
+  unsigned int workers = 2;
+  unsigned long long slice = 100000;
+  double interval = 10;
+  server_t server;
+
+  memset (&server, 0, sizeof(server));
+  server.output_capacity = 4096;
+  server.idle_timeout = 600;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-s") && i + 1 < argc)
+	  {
+	    socket_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-w") && i + 1 < argc)
+	  {
+	    workers = atoi (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-q") && i + 1 < argc)
+	  {
+	    slice = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-o") && i + 1 < argc)
+	  {
+	    server.output_capacity = strtoul (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-t") && i + 1 < argc)
+	  {
+	    server.idle_timeout = atof (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-i") && i + 1 < argc)
+	  {
+	    interval = atof (argv[++i]);
+	  }
+	else if (0 == strcmp (argv[i], "-b") && i + 1 < argc)
+	  {
+	    boot_path = argv[++i];
+	  }
+	else if (0 == strcmp (argv[i], "-G"))
+	  {
+	    if (EOK != um_set_checking (&server.template, UM_CHECKING_GUARD_PAGES))
+	      {
+		printf ("Guard pages are not available\n");
+		return 1;
+	      }
+	  }
+	else if ('-' == argv[i][0])
+	  {
+	    usage (argv[0]);
+	    return 1;
+	  }
+	else
+	  {
+	    path = argv[i];
+	  }
+      }
+  }
+
+  if (0 == workers || 0 == slice || 0 == server.output_capacity || server.idle_timeout <= 0)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  {
+    byte * image = NULL;
+    size_t size = 0;
+    byte * input = NULL;
+    size_t input_size = 0;
+    double start = now ();
+    int err = um_load_image (path, &image, &size);
+
+    if (EOK != err)
+      {
+	printf ("Could not open the program %s: %d\n", path, err);
+	return 1;
+      }
+
+    if (NULL != boot_path && EOK != (err = um_load_image (boot_path, &input, &input_size)))
+      {
+	printf ("Could not open the boot input %s: %d\n", boot_path, err);
+	return 1;
+      }
+
+    err = boot (&server, image, size, input, input_size);
+    if (EOK != err)
+      {
+	printf ("The program did not wait for input: %d\n", err);
+	return 1;
+      }
+
+    fprintf (stderr, "booted %s in %.3fs, %llu instructions, %llu bytes of arrays\n"
+	     , path
+	     , now () - start
+	     , server.template.stats.instructions
+	     , server.template.stats.heap_bytes);
+
+    free (input);
+    free (image);
+  }
+
+  if (0 != pipe2 (server.notify_pipe, O_CLOEXEC | O_NONBLOCK))
+    {
+      printf ("Could not create the notification pipe: %d\n", errno);
+      return 1;
+    }
+
+  server.listener = listen_on (socket_path);
+  if (server.listener < 0)
+    {
+      printf ("Could not listen on %s: %d\n", socket_path, errno);
+      return 1;
+    }
+
+  server.epoll = epoll_create1 (EPOLL_CLOEXEC);
+
+  {
+    struct epoll_event event;
+
+    memset (&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &g_listener_tag;
+    epoll_ctl (server.epoll, EPOLL_CTL_ADD, server.listener, &event);
+
+    event.data.ptr = &g_notify_tag;
+    epoll_ctl (server.epoll, EPOLL_CTL_ADD, server.notify_pipe[0], &event);
+  }
+
+  if (EOK != um_sched_create (&server.sched, workers, slice))
+    {
+      printf ("Could not start the workers\n");
+      return 1;
+    }
+  um_sched_set_notify (server.sched, notify, &server);
+
+  server.last_report = now ();
+  fprintf (stderr, "listening on %s\n", socket_path);
+
+  while (1)
+    {
+      struct epoll_event events [64];
+      int count = epoll_wait (server.epoll, events, sizeof(events) / sizeof(events[0]), 1000);
+      int i = 0;
+
+      // a connection closed while handling the notifications could still
+      // have an event in this batch, they are handled last
+      for (i = 0; i < count; ++i)
+	{
+	  conn_t * c = (conn_t *) events[i].data.ptr;
+
+	  if (&g_listener_tag == events[i].data.ptr || &g_notify_tag == events[i].data.ptr)
+	    {
+	      continue;
+	    }
+
+	  if (events[i].events & EPOLLOUT)
+	    {
+	      if ( ! flush_conn (&server, c))
+		{
+		  continue;
+		}
+	      service (&server, c);
+	    }
+	  else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	    {
+	      read_conn (&server, c);
+	    }
+	}
+
+      for (i = 0; i < count; ++i)
+	{
+	  if (&g_listener_tag == events[i].data.ptr)
+	    {
+	      accept_conns (&server);
+	    }
+	  else if (&g_notify_tag == events[i].data.ptr)
+	    {
+	      read_notifications (&server);
+	    }
+	}
+
+      expire_conns (&server);
+
+      if (0 != interval && now () - server.last_report >= interval)
+	{
+	  report (&server);
+	}
+    }
+
+  return 0;
+}
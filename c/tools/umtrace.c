@@ -0,0 +1,115 @@
+// umtrace : renders a binary execution trace recorded with "icfp -t"
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../um_priv.h"
+#include "../trace.h"
+
+
+static void usage (const char * name)
+{
+  printf ("usage: %s [-n count] [-s] trace-file\n", name);
+  printf ("\t-n count: only renders the first count instructions\n");
+  printf ("\t-s: prints instruction statistics instead of the instructions\n");
+}
+
+int main (int argc, char ** argv)
+{
+  const char * path = NULL;
+  unsigned long long limit = ~0ULL;
+  int summary = 0;
+
+  {
+    int i = 0;
+    for (i = 1; i < argc; ++i)
+      {
+	if (0 == strcmp (argv[i], "-n") && i + 1 < argc)
+	  {
+	    limit = strtoull (argv[++i], NULL, 0);
+	  }
+	else if (0 == strcmp (argv[i], "-s"))
+	  {
+	    summary = 1;
+	  }
+	else
+	  {
+	    path = argv[i];
+	  }
+      }
+  }
+
+  if (NULL == path)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  {
+    um_trace_reader_t * reader = NULL;
+    um_trace_record_t record;
+    unsigned long long opcodes [16] = {0};
+    int err = um_trace_reader_open (&reader, path);
+
+    if (EOK != err)
+      {
+	printf ("Could not open the trace file: %d\n", err);
+	return 1;
+      }
+
+    while (um_trace_reader_count (reader) < limit
+	   && EOK == (err = um_trace_reader_next (reader, &record)))
+      {
+	if (summary)
+	  {
+	    opcodes [OPCODE_FROM_PLATTER (record.p)]++;
+	    continue;
+	  }
+
+	{
+	  char out [128] = {0};
+
+	  um_pp_instruction (out
+			     , sizeof(out) / sizeof(out[0])
+			     , um_trace_reader_machine (reader)
+			     , record.p);
+
+	  if (record.has_value)
+	    {
+	      printf ("0x%08X : %s => 0x%08X\n", record.ip, out, record.value);
+	    }
+	  else
+	    {
+	      printf ("0x%08X : %s\n", record.ip, out);
+	    }
+	}
+      }
+
+    if (EINVAL == err)
+      {
+	printf ("Corrupted trace after %llu instructions\n"
+		, um_trace_reader_count (reader));
+      }
+
+    if (summary)
+      {
+	size_t i = 0;
+
+	printf ("instructions: %llu\n", um_trace_reader_count (reader));
+	for (i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); ++i)
+	  {
+	    if (0 != opcodes[i])
+	      {
+		printf ("opcode %2u: %llu\n", (unsigned int) i, opcodes[i]);
+	      }
+	  }
+      }
+
+    um_trace_reader_close (reader);
+  }
+
+  return 0;
+}
@@ -0,0 +1,582 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "um_priv.h"
+#include "trace.h"
+
+
+typedef enum TRACE_CONSTANTS
+  {
+    TRACE_VERSION = 1,
+
+    // the file is extended and mapped by windows of that size
+    TRACE_WINDOW_SIZE = 64 * 1024 * 1024,
+
+    // upper bound of the size of one record (header + platter + value)
+    TRACE_MAX_RECORD_SIZE = 2 * 10 + 4,
+
+    // direct mapped cache of the platters already seen, indexed by ip
+    TRACE_CACHE_SIZE = 4096,
+
+  } TRACE_CONSTANTS;
+
+
+typedef struct trace_header_t
+{
+  char magic[4];
+  unsigned int version;
+
+  // filled when the trace is closed
+  unsigned long long count;
+  unsigned long long size;
+
+  // machine state when the trace was started
+  platter_t registers[UM_REGISTER_COUNT];
+  address_t ip;
+
+} trace_header_t;
+
+
+typedef struct trace_cache_entry_t
+{
+  address_t ip;
+  platter_t p;
+
+} trace_cache_entry_t;
+
+
+struct um_trace_t
+{
+  int fd;
+  struct um_t * machine;
+
+  // current mapped window of the file
+  byte * window;
+  size_t window_offset;
+  size_t pos;
+
+  address_t expected_ip;
+
+  // register whose value has to be appended to the last record, -1 if none
+  int pending;
+
+  unsigned long long count;
+
+  trace_cache_entry_t cache [TRACE_CACHE_SIZE];
+};
+
+
+struct um_trace_reader_t
+{
+  const byte * data;
+  size_t mapped_size;
+
+  const byte * cur;
+  const byte * end;
+
+  address_t expected_ip;
+
+  um_trace_record_t last;
+  int has_last;
+
+  unsigned long long count;
+
+  struct um_t machine;
+
+  trace_cache_entry_t cache [TRACE_CACHE_SIZE];
+};
+
+
+static const char TRACE_MAGIC [4] = { 'U', 'M', 'T', 'R' };
+
+
+/**
+ *
+ * @return the register written with a value that has to be saved in the
+ * trace, -1 if the instruction result can be recomputed
+ */
+static int trace_priv_value_register (platter_t p)
+{
+  switch (OPCODE_FROM_PLATTER (p))
+    {
+    case OP_ARRAY_INDEX:
+      return (p >> 6) & 0x7;
+    case OP_ALLOCATION:
+      return (p >> 3) & 0x7;
+    case OP_INPUT:
+    case OP_BULK_SCAN:
+      return p & 0x7;
+    default:
+      break;
+    }
+
+  return -1;
+}
+
+static int trace_priv_cache_lookup (trace_cache_entry_t * cache
+				    , address_t ip
+				    , platter_t p)
+{
+  trace_cache_entry_t * e = &cache [ip & (TRACE_CACHE_SIZE - 1)];
+
+  if (e->ip == ip && e->p == p)
+    {
+      return 1;
+    }
+
+  e->ip = ip;
+  e->p = p;
+
+  return 0;
+}
+
+static void trace_priv_cache_reset (trace_cache_entry_t * cache)
+{
+  // 0xFFFFFFFF can never be fetched with a valid platter (array 0 size
+  // is at most 0xFFFFFFFF platters)
+  memset (cache, 0xFF, TRACE_CACHE_SIZE * sizeof(trace_cache_entry_t));
+}
+
+
+//////////////////////////////////////
+// writer
+//////////////////////////////////////
+
+static int trace_priv_map_window (um_trace_t * trace, size_t offset)
+{
+  if (NULL != trace->window)
+    {
+      munmap (trace->window, TRACE_WINDOW_SIZE);
+      trace->window = NULL;
+    }
+
+  if (0 != ftruncate (trace->fd, offset + TRACE_WINDOW_SIZE))
+    {
+      return errno;
+    }
+
+  {
+    void * w = mmap (NULL
+		     , TRACE_WINDOW_SIZE
+		     , PROT_READ | PROT_WRITE
+		     , MAP_SHARED
+		     , trace->fd
+		     , offset);
+    if (MAP_FAILED == w)
+      {
+	return errno;
+      }
+
+    trace->window = (byte *) w;
+    trace->window_offset = offset;
+  }
+
+  return EOK;
+}
+
+static void trace_priv_reserve (um_trace_t * trace)
+{
+  if (trace->pos + TRACE_MAX_RECORD_SIZE <= TRACE_WINDOW_SIZE)
+    {
+      return;
+    }
+
+  {
+    const size_t page = (size_t) sysconf (_SC_PAGESIZE);
+    const size_t absolute = trace->window_offset + trace->pos;
+    const size_t offset = absolute & ~(page - 1);
+
+    if (EOK != trace_priv_map_window (trace, offset))
+      {
+	fprintf (stderr, "trace: could not extend the trace file\n");
+	exit (1);
+      }
+
+    trace->pos = absolute - offset;
+  }
+}
+
+static void trace_priv_flush_pending (um_trace_t * trace)
+{
+  if (trace->pending < 0)
+    {
+      return;
+    }
+
+  trace->pos += um_priv_put_varint (trace->window + trace->pos, trace->machine->registers[trace->pending]);
+  trace->pending = -1;
+}
+
+void um_trace_record (void * t
+		      , struct um_t * machine
+		      , address_t ip
+		      , platter_t p)
+{
+  um_trace_t * trace = (um_trace_t *) t;
+
+  trace_priv_reserve (trace);
+
+  // the value written by the previous instruction is now known
+  trace_priv_flush_pending (trace);
+
+  {
+    const int delta = (int) (ip - trace->expected_ip);
+    const unsigned long long zigzag = ((unsigned int) delta << 1) ^ (unsigned int) (delta >> 31);
+    const int hit = trace_priv_cache_lookup (trace->cache, ip, p);
+
+    // + 1 so that a record never starts with a 0 byte, which marks the
+    // end of a trace that was not closed
+    trace->pos += um_priv_put_varint (trace->window + trace->pos, ((zigzag << 1) | hit) + 1);
+
+    if ( ! hit)
+      {
+	memcpy (trace->window + trace->pos, &p, sizeof(p));
+	trace->pos += sizeof(p);
+      }
+  }
+
+  trace->pending = trace_priv_value_register (p);
+  trace->expected_ip = ip + 1;
+  trace->count++;
+}
+
+void um_trace_settle (void * t)
+{
+  um_trace_t * trace = (um_trace_t *) t;
+
+  trace_priv_reserve (trace);
+  trace_priv_flush_pending (trace);
+}
+
+int um_trace_open (um_trace_t ** trace
+		   , const char * path
+		   , struct um_t * machine)
+{
+  if (NULL == trace || NULL == path || NULL == machine)
+    {
+      return EINVAL;
+    }
+
+  {
+    um_trace_t * t = (um_trace_t *) calloc (1, sizeof (um_trace_t));
+    if (NULL == t)
+      {
+	return ENOMEM;
+      }
+
+    t->fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (t->fd < 0)
+      {
+	int err = errno;
+	free (t);
+	return err;
+      }
+
+    {
+      int err = trace_priv_map_window (t, 0);
+      if (EOK != err)
+	{
+	  close (t->fd);
+	  free (t);
+	  return err;
+	}
+    }
+
+    {
+      trace_header_t * h = (trace_header_t *) t->window;
+
+      memcpy (h->magic, TRACE_MAGIC, sizeof(h->magic));
+      h->version = TRACE_VERSION;
+      memcpy (h->registers, machine->registers, sizeof(h->registers));
+      h->ip = machine->ip;
+    }
+
+    t->pos = sizeof (trace_header_t);
+    t->machine = machine;
+    t->expected_ip = machine->ip;
+    t->pending = -1;
+    trace_priv_cache_reset (t->cache);
+
+    machine->trace = t;
+    *trace = t;
+  }
+
+  return EOK;
+}
+
+int um_trace_close (um_trace_t * trace)
+{
+  if (NULL == trace)
+    {
+      return EINVAL;
+    }
+
+  trace_priv_reserve (trace);
+  trace_priv_flush_pending (trace);
+
+  {
+    const size_t total = trace->window_offset + trace->pos;
+
+    munmap (trace->window, TRACE_WINDOW_SIZE);
+
+    if (0 != ftruncate (trace->fd, total))
+      {
+	fprintf (stderr, "trace: could not truncate the trace file\n");
+      }
+
+    {
+      trace_header_t h;
+
+      if (sizeof(h) == pread (trace->fd, &h, sizeof(h), 0))
+	{
+	  h.count = trace->count;
+	  h.size = total - sizeof(h);
+	  pwrite (trace->fd, &h, sizeof(h), 0);
+	}
+    }
+  }
+
+  close (trace->fd);
+
+  if (trace->machine->trace == trace)
+    {
+      trace->machine->trace = NULL;
+    }
+
+  free (trace);
+
+  return EOK;
+}
+
+
+//////////////////////////////////////
+// reader
+//////////////////////////////////////
+
+/**
+ * Replays the effect of an instruction on the registers of the reader
+ * machine.
+ */
+static void trace_priv_apply (struct um_t * machine
+			      , const um_trace_record_t * record)
+{
+  platter_t * r = machine->registers;
+  const platter_t p = record->p;
+  const byte a = (p >> 6) & 0x7;
+  const byte b = (p >> 3) & 0x7;
+  const byte c = p & 0x7;
+
+  switch (OPCODE_FROM_PLATTER (p))
+    {
+    case OP_COND_MOVE:
+      if (0 != r[c])
+	{
+	  r[a] = r[b];
+	}
+      break;
+    case OP_ADDITION:
+      r[a] = r[b] + r[c];
+      break;
+    case OP_MULTIPLICATION:
+      r[a] = r[b] * r[c];
+      break;
+    case OP_DIVISION:
+      // a division by 0 fails the machine, it is the last record
+      r[a] = 0 == r[c] ? 0 : r[b] / r[c];
+      break;
+    case OP_NOT_AND:
+      r[a] = ~r[b] | ~r[c];
+      break;
+    case OP_ORTHOGRAPHY:
+      r[(p >> 25) & 0x07] = p & 0x1FFFFFF;
+      break;
+    default:
+      if (record->has_value)
+	{
+	  r[trace_priv_value_register (p)] = record->value;
+	}
+      break;
+    }
+
+  machine->ip = record->ip + 1;
+}
+
+int um_trace_reader_open (um_trace_reader_t ** reader, const char * path)
+{
+  if (NULL == reader || NULL == path)
+    {
+      return EINVAL;
+    }
+
+  {
+    struct stat st;
+    int fd = open (path, O_RDONLY);
+    if (fd < 0)
+      {
+	return errno;
+      }
+
+    if (0 != fstat (fd, &st) || st.st_size < (off_t) sizeof(trace_header_t))
+      {
+	close (fd);
+	return EINVAL;
+      }
+
+    {
+      um_trace_reader_t * r = (um_trace_reader_t *) calloc (1, sizeof (um_trace_reader_t));
+      void * data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      close (fd);
+
+      if (NULL == r || MAP_FAILED == data)
+	{
+	  free (r);
+	  return ENOMEM;
+	}
+
+      r->data = (const byte *) data;
+      r->mapped_size = st.st_size;
+
+      {
+	const trace_header_t * h = (const trace_header_t *) r->data;
+
+	if (0 != memcmp (h->magic, TRACE_MAGIC, sizeof(h->magic))
+	    || TRACE_VERSION != h->version)
+	  {
+	    um_trace_reader_close (r);
+	    return EINVAL;
+	  }
+
+	r->cur = r->data + sizeof(trace_header_t);
+
+	// a trace that was not closed properly has no size, read all of it
+	r->end = (0 != h->size && h->size <= r->mapped_size - sizeof(trace_header_t))
+	  ? r->cur + h->size
+	  : r->data + r->mapped_size;
+
+	memcpy (r->machine.registers, h->registers, sizeof(h->registers));
+	r->machine.ip = h->ip;
+	r->expected_ip = h->ip;
+      }
+
+      trace_priv_cache_reset (r->cache);
+
+      *reader = r;
+    }
+  }
+
+  return EOK;
+}
+
+int um_trace_reader_next (um_trace_reader_t * reader
+			  , um_trace_record_t * record)
+{
+  if (NULL == reader || NULL == record)
+    {
+      return EINVAL;
+    }
+
+  if (reader->has_last)
+    {
+      trace_priv_apply (&reader->machine, &reader->last);
+      reader->has_last = 0;
+    }
+
+  if (reader->cur >= reader->end || 0 == *reader->cur)
+    {
+      return ENOENT;
+    }
+
+  {
+    unsigned long long h = 0;
+    um_trace_record_t r = { 0 };
+
+    if (EOK != um_priv_get_varint (&reader->cur, reader->end, &h))
+      {
+	return EINVAL;
+      }
+    
+    h--;
+
+    {
+      const unsigned int zigzag = (unsigned int) (h >> 1);
+      const int delta = (int) (zigzag >> 1) ^ -(int) (zigzag & 1);
+
+      r.ip = reader->expected_ip + delta;
+    }
+
+    if (h & 1)
+      {
+	const trace_cache_entry_t * e = &reader->cache [r.ip & (TRACE_CACHE_SIZE - 1)];
+	if (e->ip != r.ip)
+	  {
+	    return EINVAL;
+	  }
+	r.p = e->p;
+      }
+    else
+      {
+	if (reader->cur + sizeof(r.p) > reader->end)
+	  {
+	    return EINVAL;
+	  }
+
+	memcpy (&r.p, reader->cur, sizeof(r.p));
+	reader->cur += sizeof(r.p);
+
+	trace_priv_cache_lookup (reader->cache, r.ip, r.p);
+      }
+
+    if (trace_priv_value_register (r.p) >= 0)
+      {
+	unsigned long long v = 0;
+
+	// the value of the last record is missing when the trace was not
+	// closed
+	if (EOK == um_priv_get_varint (&reader->cur, reader->end, &v))
+	  {
+	    r.value = (platter_t) v;
+	    r.has_value = 1;
+	  }
+      }
+
+    reader->expected_ip = r.ip + 1;
+    reader->last = r;
+    reader->has_last = 1;
+    reader->count++;
+
+    *record = r;
+  }
+
+  return EOK;
+}
+
+struct um_t * um_trace_reader_machine (um_trace_reader_t * reader)
+{
+  return NULL == reader ? NULL : &reader->machine;
+}
+
+unsigned long long um_trace_reader_count (um_trace_reader_t * reader)
+{
+  return NULL == reader ? 0 : reader->count;
+}
+
+int um_trace_reader_close (um_trace_reader_t * reader)
+{
+  if (NULL == reader)
+    {
+      return EINVAL;
+    }
+
+  munmap ((void *) reader->data, reader->mapped_size);
+  free (reader);
+
+  return EOK;
+}
@@ -0,0 +1,89 @@
+#if ! defined (TRACE_H)
+#define TRACE_H
+
+#include "um.h"
+
+/**
+ * Binary execution trace.
+ *
+ * Every executed instruction is appended to a file mapped in memory as a
+ * small variable length record: the ip (as a delta from the previous
+ * instruction), the raw platter (omitted when it was already seen at that
+ * ip) and, for the instructions whose result cannot be recomputed from
+ * the registers (array index, allocation and input), the value that was
+ * written. Everything else is replayed by the reader from its own copy of
+ * the registers.
+ */
+
+typedef struct um_trace_t um_trace_t;
+
+/**
+ * Creates the trace file and attaches it to the machine. The current
+ * registers of the machine are saved as the initial state of the trace.
+ *
+ * @param trace
+ * @param path
+ * @param machine
+ */
+int um_trace_open (um_trace_t ** trace
+		   , const char * path
+		   , struct um_t * machine);
+
+/**
+ * Flushes, truncates the file to its final size and detaches the trace
+ * from its machine.
+ */
+int um_trace_close (um_trace_t * trace);
+
+/**
+ * Called by the VM before executing the instruction p at address ip. The
+ * input and output instructions are only recorded once their hook took
+ * the byte, so that a retry after UM_INPUT_WOULD_BLOCK or
+ * UM_OUTPUT_WOULD_BLOCK is recorded once.
+ */
+void um_trace_record (void * trace
+		      , struct um_t * machine
+		      , address_t ip
+		      , platter_t p);
+
+/**
+ * Called by the VM before executing an input or output instruction:
+ * saves the value written by the previous instruction, which the input
+ * may overwrite before it is recorded.
+ */
+void um_trace_settle (void * trace);
+
+
+typedef struct um_trace_reader_t um_trace_reader_t;
+
+typedef struct um_trace_record_t
+{
+  address_t ip;
+  platter_t p;
+  
+  // value written by the instruction when has_value is set
+  platter_t value;
+  int has_value;
+  
+} um_trace_record_t;
+
+int um_trace_reader_open (um_trace_reader_t ** reader, const char * path);
+
+/**
+ * Reads the next record. The effect of the previous record is applied to
+ * the machine returned by um_trace_reader_machine beforehand, so that the
+ * machine holds the registers as they were right before the instruction
+ * described by record was executed.
+ *
+ * @return EOK, ENOENT at the end of the trace or EINVAL if it is corrupted
+ */
+int um_trace_reader_next (um_trace_reader_t * reader
+			  , um_trace_record_t * record);
+
+struct um_t * um_trace_reader_machine (um_trace_reader_t * reader);
+
+unsigned long long um_trace_reader_count (um_trace_reader_t * reader);
+
+int um_trace_reader_close (um_trace_reader_t * reader);
+
+#endif // TRACE_H
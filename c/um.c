@@ -1,44 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
-
-#include "um.h"
-
-#if ! defined (EOK)
-#   define EOK 0
-#endif
-
-#if defined (OPCODE_FROM_PLATTER)
-#   error "Oops macro redefinition: OPCODE_FROM_PLATTER"
-#endif
-
-#define OPCODE_FROM_PLATTER(platter) (((platter) >> 28) & 0xF)
-
-
-typedef enum Register
-  {
-    REGISTER_A = 2,
-    REGISTER_B = 1,
-    REGISTER_C = 0,
-
-  } Register;
-
-
-typedef unsigned int ArrayCellId;
-typedef struct ArrayCell
-{
-  ArrayCellId id;
-  platter_t datasize; // in platter_t count
-  platter_t * data;
-  
-  struct ArrayCell * next;
-
-} ArrayCell;
-
-
-static ArrayCell * um_priv_new_array_cell (platter_t capacity);
-static ArrayCell * um_priv_add_array_cell (struct um_t * machine, ArrayCell * p);
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "um_priv.h"
+#include "trace.h"
+#include "intrinsic.h"
+#include "gc.h"
+#include "profile.h"
+#include "deferred.h"
+#include "kernels.h"
+#include "checkpoint.h"
+
+
+static ArrayCell * um_priv_new_array_cell (struct um_t * machine, platter_t capacity, int zeroed);
 static platter_t um_priv_read_platter_from (struct um_t * machine, address_t a);
 static int um_priv_initialize_machine (struct um_t * machine);
 static int um_priv_initialize_program_array_with (struct um_t * machine
@@ -47,35 +29,14 @@ static int um_priv_initialize_program_array_with (struct um_t * machine
 static byte decode_register_value_from_platter (platter_t p, Register r);
 static void fail (struct um_t * machine);
 static int um_priv_do_spin (struct um_t * machine);
-
-static int um_priv_do_one_spin (struct um_t * machine
-				, on_run_one_step_func f
-				);
+static struct um_t * um_priv_enter (struct um_t * machine);
+static void um_priv_leave (struct um_t * previous);
 
 
 /////////////////////////
 // operators / handlers
 /////////////////////////
 
-typedef enum OperatorCodes
-  {
-    OP_COND_MOVE,
-    OP_ARRAY_INDEX,
-    OP_ARRAY_AMEND,
-    OP_ADDITION,
-    OP_MULTIPLICATION,
-    OP_DIVISION,
-    OP_NOT_AND,
-    OP_HALT,
-    OP_ALLOCATION,
-    OP_ABANDONMENT,
-    OP_OUTPUT,
-    OP_INPUT,
-    OP_LOAD_PROGRAM,
-    OP_ORTHOGRAPHY,
-
-  } OperatorCodes;
-
 static int um_priv_handler_cond_mov  (struct um_t * machine, platter_t p, byte rega, byte regb, byte regc);
 static void um_priv_pp_cond_mov (char * out
 				 , size_t outsize
@@ -193,7 +154,6 @@ static void um_priv_pp_halt (char * out
 {
   snprintf (out
 	    , outsize
-	    , sizeof(out) / sizeof(out[0])
 	    , "HALT");
 }
 
@@ -247,8 +207,8 @@ static void um_priv_pp_input (char * out
 {
   snprintf (out
 	    , outsize
-	    , "IN"
-	    , machine->registers[d.regc]);
+	    , "IN REG[0x%02X]"
+	    , d.regc);
 }
 
 
@@ -280,6 +240,73 @@ static void um_priv_pp_orthogonality (char * out
 }
 
 
+static int um_priv_handler_bulk_store (struct um_t * machine, platter_t p, byte rega, byte regb, byte regc);
+static void um_priv_pp_bulk_store (char * out
+				   , size_t outsize
+				   , struct um_t * machine
+				   , pp_opcode_data_t d)
+{
+  const platter_t * r = machine->registers;
+  
+  if (BULK_COPY == BULK_OPERATION_FROM_PLATTER (d.p))
+    {
+      snprintf (out
+		, outsize
+		, "COPY ARRAY[0x%08X][0x%08X] = ARRAY[0x%08X][0x%08X] (0x%08X platters)"
+		, r[d.rega]
+		, r[(d.rega + 1) & 0x7]
+		, r[d.regb]
+		, r[(d.regb + 1) & 0x7]
+		, r[d.regc]);
+    }
+  else
+    {
+      snprintf (out
+		, outsize
+		, "FILL ARRAY[0x%08X][0x%08X] = REG[0x%02X] (0x%08X, 0x%08X platters)"
+		, r[d.rega]
+		, r[(d.rega + 1) & 0x7]
+		, d.regb
+		, r[d.regb]
+		, r[d.regc]);
+    }
+}
+
+
+static int um_priv_handler_bulk_scan (struct um_t * machine, platter_t p, byte rega, byte regb, byte regc);
+static void um_priv_pp_bulk_scan (char * out
+				  , size_t outsize
+				  , struct um_t * machine
+				  , pp_opcode_data_t d)
+{
+  const platter_t * r = machine->registers;
+  
+  if (BULK_COMPARE == BULK_OPERATION_FROM_PLATTER (d.p))
+    {
+      snprintf (out
+		, outsize
+		, "REG[0x%02X] = COMPARE ARRAY[0x%08X][0x%08X] ARRAY[0x%08X][0x%08X] (0x%08X platters)"
+		, d.regc
+		, r[d.rega]
+		, r[(d.rega + 1) & 0x7]
+		, r[d.regb]
+		, r[(d.regb + 1) & 0x7]
+		, r[d.regc]);
+    }
+  else
+    {
+      snprintf (out
+		, outsize
+		, "REG[0x%02X] = SEARCH ARRAY[0x%08X][0x%08X] FOR 0x%08X (0x%08X platters)"
+		, d.regc
+		, r[d.rega]
+		, r[(d.rega + 1) & 0x7]
+		, r[d.regb]
+		, r[d.regc]);
+    }
+}
+
+
 
 
 
@@ -370,6 +397,17 @@ static struct Operator
     , .pp_opcode = um_priv_pp_orthogonality
   },
 
+  [OP_BULK_STORE] = {
+    .code = OP_BULK_STORE
+    , .handler = um_priv_handler_bulk_store
+    , .pp_opcode = um_priv_pp_bulk_store
+  },
+  [OP_BULK_SCAN] = {
+    .code = OP_BULK_SCAN
+    , .handler = um_priv_handler_bulk_scan
+    , .pp_opcode = um_priv_pp_bulk_scan
+  },
+
 
 #if 0
   { OP_COND_MOVE, um_priv_handler_cond_mov },
@@ -392,210 +430,710 @@ static struct Operator
 };
 
 
+// g_operators without the bounds and division checks, for the machines
+// protected by guard pages (see um_set_checking)
+static struct Operator g_guarded_operators [sizeof(g_operators) / sizeof(g_operators[0])];
+
+// the interpreter loops do not check the opcodes
+_Static_assert (sizeof(g_operators) / sizeof(g_operators[0]) == 16
+		, "one operator per opcode");
+
+
 /////////////////////////
 // operator definitions
 /////////////////////////
 
-static ArrayCell * um_priv_get_last_array_cell (struct um_t * machine)
+/**
+ * Arrays of at least that many platters are mapped directly: the pages
+ * are zeroed lazily by the kernel, only cost memory once written to and
+ * go back to the system as soon as the array is abandoned.
+ */
+enum { UM_PRIV_MAPPED_ARRAY_THRESHOLD = 64 * 1024 };
+
+/**
+ * Any offset of a guarded array, up to 2^32 platters, falls in the
+ * inaccessible region that follows it.
+ */
+static const size_t UM_PRIV_GUARD_SIZE = (size_t) 1 << 34;
+
+static size_t um_priv_guarded_pages_size (platter_t count)
 {
-  ArrayCell * p = (ArrayCell *) machine->arrays;
-    
-  assert (NULL != p);
-    
-  while (NULL != p->next)
-    {
-      p = p->next;
-    }
-    
-  return p;
+  const size_t page = sysconf (_SC_PAGESIZE);
+  return ((size_t) count * sizeof(platter_t) + page - 1) & ~(page - 1);
 }
 
-static void um_priv_delete_array (ArrayCell * cell)
+/**
+ * Reserves the pages of the array followed by the guard region. The
+ * array is placed at the end of its pages, so that its first platter
+ * past the end is already inaccessible.
+ */
+static platter_t * um_priv_allocate_guarded_platters (platter_t count)
 {
-  if (NULL == cell)
+  const size_t pages = um_priv_guarded_pages_size (count);
+  byte * base = (byte *) mmap (NULL
+			       , pages + UM_PRIV_GUARD_SIZE
+			       , PROT_NONE
+			       , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+			       , -1
+			       , 0);
+  
+  if (MAP_FAILED == (void *) base)
     {
-      return;
+      return NULL;
     }
   
-  free (cell->data);
-  free (cell);
+  if (0 != pages && 0 != mprotect (base, pages, PROT_READ | PROT_WRITE))
+    {
+      munmap (base, pages + UM_PRIV_GUARD_SIZE);
+      return NULL;
+    }
+  
+  return (platter_t *) (base + pages - (size_t) count * sizeof(platter_t));
 }
 
-static ArrayCellId um_priv_get_next_cellid ()
+static byte * um_priv_guarded_region (const platter_t * data, platter_t count)
 {
-  // 0 is for the program
-  static ArrayCellId id = 0;
-  return id++;
+  return (byte *) (data + count) - um_priv_guarded_pages_size (count);
 }
 
-static ArrayCell * um_priv_new_array_cell (platter_t capacity)
+/**
+ * 
+ * @param zeroed the platters have to be 0 (always the case when mapped)
+ * @param guarded set when the array got a guard region
+ * @return NULL when out of memory
+ */
+static platter_t * um_priv_allocate_platters (struct um_t * machine
+					      , platter_t count
+					      , int zeroed
+					      , byte * guarded)
 {
-  ArrayCell * p = (ArrayCell *) malloc (sizeof (ArrayCell));
-
-  p->next = NULL;
-  p->data = (platter_t *) malloc (capacity * sizeof(platter_t));
-  p->datasize = capacity;
-  p->id = um_priv_get_next_cellid ();
+  *guarded = 0;
   
-  return p;
+  if (UM_CHECKING_GUARD_PAGES == machine->checking)
+    {
+      platter_t * data = um_priv_allocate_guarded_platters (count);
+      if (NULL != data)
+	{
+	  *guarded = 1;
+	  return data;
+	}
+      
+      // out of address space, the arrays allocated from now on have to
+      // be checked explicitly
+      machine->checking = UM_CHECKING_EXPLICIT;
+    }
+  
+  if (count >= UM_PRIV_MAPPED_ARRAY_THRESHOLD)
+    {
+      // the arrays that are not zeroed are copies, written entirely
+      // right away: their pages are faulted in by the same system call
+      void * p = mmap (NULL
+		       , (size_t) count * sizeof(platter_t)
+		       , PROT_READ | PROT_WRITE
+		       , MAP_PRIVATE | MAP_ANONYMOUS | (zeroed ? 0 : MAP_POPULATE)
+		       , -1
+		       , 0);
+      
+      return MAP_FAILED == p ? NULL : (platter_t *) p;
+    }
+  
+  // malloc (0) may return NULL
+  if (0 == count)
+    {
+      count = 1;
+    }
+  
+  return zeroed
+    ? (platter_t *) calloc (count, sizeof(platter_t))
+    : (platter_t *) malloc (count * sizeof(platter_t));
 }
 
-static ArrayCell * um_priv_new_array_cell_from_cell (ArrayCell * cell)
+/**
+ * Platters checked at once for zeros when a mapped array is copied, a
+ * page.
+ */
+enum { UM_PRIV_ZERO_CHUNK = 1024 };
+
+static int um_priv_is_zero (const platter_t * p, platter_t count)
 {
-  ArrayCell * p = (ArrayCell *) malloc (sizeof (ArrayCell));
+  return 0 == p[0] && 0 == memcmp (p, p + 1, (size_t) (count - 1) * sizeof(platter_t));
+}
 
-  p->next = NULL;
-  p->data = (platter_t *) malloc (cell->datasize * sizeof(platter_t));
-  
-  memcpy ((char *) p->data
-	  , (char *) cell->data
-	  , cell->datasize * sizeof(platter_t));
-  
-  p->datasize = cell->datasize;
+void um_priv_copy_nonzero (platter_t * to, const platter_t * from, platter_t count)
+{
+  platter_t i = 0;
   
-  return p;
+  for (i = 0; i < count; i += UM_PRIV_ZERO_CHUNK)
+    {
+      const platter_t n = count - i < UM_PRIV_ZERO_CHUNK ? count - i : UM_PRIV_ZERO_CHUNK;
+      
+      if ( ! um_priv_is_zero (from + i, n))
+	{
+	  memcpy (to + i, from + i, (size_t) n * sizeof(platter_t));
+	}
+    }
 }
 
-static ArrayCell * um_priv_search_for_cell_id (struct um_t * machine, ArrayCellId id)
+/**
+ * Allocates a copy of count platters. A mapped array with pages of
+ * zeros is copied sparsely: those pages are not written and keep
+ * mapping the zero page of the kernel, so that the copy only costs
+ * memory for what the original holds. A dense one is prefaulted and
+ * copied at once.
+ *
+ * @return NULL when out of memory
+ */
+static platter_t * um_priv_duplicate_platters (struct um_t * machine
+					       , const platter_t * from
+					       , platter_t count
+					       , byte * guarded)
 {
-  ArrayCell * p = (ArrayCell *) machine->arrays;
-  while (p != NULL)
+  platter_t * to = NULL;
+  int sparse = 0;
+  
+  if (count >= UM_PRIV_MAPPED_ARRAY_THRESHOLD)
     {
-      if (p->id == id)
+      platter_t i = 0;
+      
+      for (i = 0; i < count && ! sparse; i += UM_PRIV_ZERO_CHUNK)
 	{
-	  break;
+	  sparse = um_priv_is_zero (from + i, count - i < UM_PRIV_ZERO_CHUNK ? count - i : UM_PRIV_ZERO_CHUNK);
 	}
-      
-      p = p->next;
     }
   
-  return p;
+  to = um_priv_allocate_platters (machine, count, sparse, guarded);
+  if (NULL == to)
+    {
+      return NULL;
+    }
+  
+  if (sparse)
+    {
+      um_priv_copy_nonzero (to, from, count);
+    }
+  else
+    {
+      memcpy (to, from, (size_t) count * sizeof(platter_t));
+    }
+  
+  return to;
+}
+
+void um_priv_free_platters (platter_t * data, platter_t count, byte guarded)
+{
+  if (guarded)
+    {
+      munmap (um_priv_guarded_region (data, count)
+	      , um_priv_guarded_pages_size (count) + UM_PRIV_GUARD_SIZE);
+    }
+  else if (count >= UM_PRIV_MAPPED_ARRAY_THRESHOLD)
+    {
+      munmap (data, (size_t) count * sizeof(platter_t));
+    }
+  else
+    {
+      free (data);
+    }
 }
 
-static void um_priv_remove_array_cell (struct um_t * machine, ArrayCell * cell)
+static void um_priv_delete_array (struct um_t * machine, ArrayCell * cell)
 {
-  if (NULL == machine || NULL == cell || NULL == machine->arrays)
+  if (NULL == cell)
     {
       return;
     }
   
+  if (NULL == machine->deferred
+      || EOK != um_deferred_release (machine->deferred, cell->data, cell->datasize, cell->guarded))
+    {
+      um_priv_free_platters (cell->data, cell->datasize, cell->guarded);
+    }
+  free (cell->dirty_pages);
+  free (cell);
+}
+
+/**
+ * Ids the table of a machine starts with.
+ */
+enum { UM_PRIV_MIN_ARRAY_TABLE = 64 };
+
+/**
+ * Makes room in the table for the ids below count, allocating it the
+ * first time.
+ */
+static int um_priv_reserve_array_ids (struct um_t * machine, platter_t count)
+{
+  ArrayTable * t = (ArrayTable *) machine->arrays;
+  platter_t capacity = 0;
+  
+  if (NULL == t)
+    {
+      t = (ArrayTable *) calloc (1, sizeof (ArrayTable));
+      if (NULL == t)
+	{
+	  return ENOMEM;
+	}
+      machine->arrays = t;
+    }
+  
+  if (count <= t->capacity)
+    {
+      return EOK;
+    }
+  
+  capacity = t->capacity < UM_PRIV_MIN_ARRAY_TABLE ? UM_PRIV_MIN_ARRAY_TABLE : t->capacity;
+  while (capacity < count && capacity <= ~(platter_t) 0 / 2)
+    {
+      capacity *= 2;
+    }
+  if (capacity < count)
+    {
+      capacity = count;
+    }
+  
   {
-    ArrayCell *
-      cur = (ArrayCell *) machine->arrays;
-    
-    if (cur == cell)
-      {
-	machine->arrays = NULL;
-	return;
-      }
+    ArraySlot * slots = (ArraySlot *) realloc (t->slots, (size_t) capacity * sizeof(ArraySlot));
+    ArrayCell ** cells = NULL;
     
-    while (cur != NULL)
+    if (NULL == slots)
       {
-	if (cur->next == cell)
-	  {
-	    break;
-	  }
-	cur = cur->next;
+	return ENOMEM;
       }
+    t->slots = slots;
     
-    if (cur != NULL)
+    cells = (ArrayCell **) realloc (t->cells, (size_t) capacity * sizeof(ArrayCell *));
+    if (NULL == cells)
       {
-	assert (NULL != cur->next);
-	
-	cur->next = cur->next->next;
+	return ENOMEM;
       }
+    t->cells = cells;
   }
+  
+  memset (t->slots + t->capacity, 0, (size_t) (capacity - t->capacity) * sizeof(ArraySlot));
+  memset (t->cells + t->capacity, 0, (size_t) (capacity - t->capacity) * sizeof(ArrayCell *));
+  t->capacity = capacity;
+  
+  return EOK;
 }
 
-static ArrayCell * um_priv_add_array_cell (struct um_t * machine, ArrayCell * p)
+static ArrayCellId um_priv_get_next_cellid (struct um_t * machine)
 {
-  assert (NULL != p);
+  ArrayTable * t = (ArrayTable *) machine->arrays;
   
-  {
-    ArrayCell * last = um_priv_get_last_array_cell (machine);
-    assert (NULL != last);
-    last->next = p;
-  }
+  // the last released first, 0 being the program
+  if (NULL != t && 0 != t->free_ids)
+    {
+      const ArrayCellId id = t->free_ids;
+      
+      t->free_ids = t->slots[id].next_free;
+      t->slots[id].next_free = 0;
+      
+      return id;
+    }
   
-  return p;
+  return machine->next_array_id++;
 }
 
-platter_t um_priv_swap_platter_bytes (platter_t p)
+static ArrayCell * um_priv_new_array_cell (struct um_t * machine, platter_t capacity, int zeroed)
 {
-  platter_t r = 0;
+  ArrayCell * p = (ArrayCell *) malloc (sizeof (ArrayCell));
   
-  {
-    r |= (p & 0xFF) << 24;
-    r |= (p & 0xFF00) << 8;
-    r |= (p & 0xFF0000) >> 8;
-    r |= (p & 0xFF000000) >> 24;
-  }
+  if (NULL == p)
+    {
+      fail (machine);
+    }
   
-  return r;
+  p->data = um_priv_allocate_platters (machine, capacity, zeroed, &p->guarded);
+  if (NULL == p->data)
+    {
+      free (p);
+      fail (machine);
+    }
+  
+  p->datasize = capacity;
+  p->id = um_priv_get_next_cellid (machine);
+  p->gc_mark = 0;
+  p->dirty = DIRTY_ALL;
+  p->dirty_pages = NULL;
+  p->checkpointed = 0;
+  
+  return p;
 }
 
-/**
- * 
- * @param a is a platter address, not byte address
- */
-static platter_t um_priv_read_platter_from (struct um_t * machine
-                                            , address_t a)
+static ArrayCell * um_priv_new_array_cell_from_cell (struct um_t * machine, ArrayCell * cell)
 {
-#define VALIDATE_ADDRESS(address,array) if ((address) >= (array)->datasize) fail(machine)
+  ArrayCell * p = (ArrayCell *) malloc (sizeof (ArrayCell));
   
-  ArrayCell *
-    cell = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+  if (NULL == p)
+    {
+      fail (machine);
+    }
   
-  if (NULL == cell)
+  p->data = um_priv_duplicate_platters (machine, cell->data, cell->datasize, &p->guarded);
+  if (NULL == p->data)
     {
+      free (p);
       fail (machine);
     }
   
-  VALIDATE_ADDRESS (a, cell);
+  p->datasize = cell->datasize;
+  p->gc_mark = 0;
+  p->dirty = DIRTY_ALL;
+  p->dirty_pages = NULL;
+  p->checkpointed = 0;
   
-  return um_priv_swap_platter_bytes (cell->data[a]);
+  return p;
 }
 
-static int um_priv_initialize_machine (struct um_t * machine)
+ArrayCell * um_priv_search_for_cell_id (struct um_t * machine, ArrayCellId id)
 {
-  if (NULL == machine)
+  const ArrayTable * t = (const ArrayTable *) machine->arrays;
+  
+  if (NULL == t || id >= t->capacity)
     {
-      return EINVAL;
+      return NULL;
     }
   
-  // assume memset eq value 0
-  memset ((void *) &machine->registers[0], 0, sizeof(machine->registers));
+  return t->cells[id];
+}
+
+ArrayCell * um_priv_cell_from (struct um_t * machine, ArrayCellId id)
+{
+  const ArrayTable * t = (const ArrayTable *) machine->arrays;
+  platter_t i = id;
   
-  machine->ip = 0;
+  for (; NULL != t && i < t->capacity; ++i)
+    {
+      if (NULL != t->slots[i].data)
+	{
+	  return t->cells[i];
+	}
+    }
   
-  // allocate one for the special case of the program array
-  machine->arrays = NULL;
+  return NULL;
+}
+
+int um_priv_insert_array_cell (struct um_t * machine, ArrayCell * cell)
+{
+  ArrayTable * t = NULL;
+  
+  assert (NULL != cell && NULL != cell->data);
+  
+  if ((platter_t) (cell->id + 1) < cell->id
+      || EOK != um_priv_reserve_array_ids (machine, cell->id + 1))
+    {
+      return ENOMEM;
+    }
+  
+  t = (ArrayTable *) machine->arrays;
+  
+  assert (NULL == t->cells[cell->id]);
+  
+  t->slots[cell->id].data = cell->data;
+  t->slots[cell->id].size = cell->datasize;
+  t->slots[cell->id].next_free = 0;
+  t->cells[cell->id] = cell;
   
   return EOK;
 }
 
-static int um_priv_initialize_program_array_with (struct um_t * machine
-						  , byte * data
-						  , size_t size)
+void um_priv_remove_array_cell (struct um_t * machine, ArrayCell * cell)
 {
-  // check if already exists
-  ArrayCell * cell = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
-  if (NULL != cell)
+  ArrayTable * t = (ArrayTable *) machine->arrays;
+  
+  if (NULL == t || NULL == cell || cell->id >= t->capacity || cell != t->cells[cell->id])
     {
-      fail (machine);
+      return;
     }
   
-  if (0 != (size % sizeof(platter_t)))
+  t->slots[cell->id].data = NULL;
+  t->slots[cell->id].size = 0;
+  t->cells[cell->id] = NULL;
+  
+  // the program array is replaced, its id is never given
+  if (UM_PROGRAM_ARRAY_ID != cell->id)
     {
-      fail (machine);
+      t->slots[cell->id].next_free = t->free_ids;
+      t->free_ids = cell->id;
     }
+}
+
+int um_priv_release_array_id (struct um_t * machine, ArrayCellId id)
+{
+  ArrayTable * t = NULL;
   
-  {
-    size_t number_of_platters_to_allocate = size / sizeof(platter_t);
-    
-    cell = um_priv_new_array_cell (number_of_platters_to_allocate);
-    
-    // should be the first allocation
+  if (UM_PROGRAM_ARRAY_ID == id
+      || id >= machine->next_array_id
+      || EOK != um_priv_reserve_array_ids (machine, id + 1))
+    {
+      return EINVAL;
+    }
+  
+  t = (ArrayTable *) machine->arrays;
+  
+  if (NULL != t->slots[id].data)
+    {
+      return EINVAL;
+    }
+  
+  t->slots[id].next_free = t->free_ids;
+  t->free_ids = id;
+  
+  return EOK;
+}
+
+/**
+ * Inserts a new array, the machine fails when the table cannot grow.
+ */
+static void um_priv_add_array_cell (struct um_t * machine, ArrayCell * cell)
+{
+  if (EOK != um_priv_insert_array_cell (machine, cell))
+    {
+      um_priv_delete_array (machine, cell);
+      fail (machine);
+    }
+}
+
+static void um_priv_account_new_array (struct um_t * machine, ArrayCell * cell)
+{
+  if (NULL != machine->profile)
+    {
+      um_profile_allocated (machine->profile, machine, cell->id, cell->datasize);
+    }
+  
+  machine->stats.live_arrays++;
+  machine->stats.heap_bytes += (unsigned long long) cell->datasize * sizeof(platter_t);
+  
+  if (machine->stats.heap_bytes > machine->stats.peak_heap_bytes)
+    {
+      machine->stats.peak_heap_bytes = machine->stats.heap_bytes;
+    }
+}
+
+static void um_priv_account_deleted_array (struct um_t * machine, ArrayCell * cell)
+{
+  if (NULL != machine->profile)
+    {
+      um_profile_released (machine->profile, machine, cell->id, cell->datasize);
+    }
+  
+  // the arrays created since the last checkpoint are not in the log
+  if (NULL != machine->checkpoint && cell->checkpointed)
+    {
+      um_checkpoint_released (machine->checkpoint, machine, cell->id);
+    }
+  
+  machine->stats.live_arrays--;
+  machine->stats.heap_bytes -= (unsigned long long) cell->datasize * sizeof(platter_t);
+}
+
+void um_priv_release_array_cell (struct um_t * machine, ArrayCell * cell)
+{
+  um_priv_account_deleted_array (machine, cell);
+  um_priv_delete_array (machine, cell);
+}
+
+ArrayCell * um_priv_create_array_cell (struct um_t * machine
+				       , ArrayCellId id
+				       , platter_t count)
+{
+  ArrayCell * cell = (ArrayCell *) calloc (1, sizeof (ArrayCell));
+  
+  if (NULL != cell)
+    {
+      cell->data = um_priv_allocate_platters (machine, count, 1, &cell->guarded);
+    }
+  
+  if (NULL == cell || NULL == cell->data)
+    {
+      free (cell);
+      return NULL;
+    }
+  
+  cell->id = id;
+  cell->datasize = count;
+  cell->dirty = DIRTY_ALL;
+  
+  um_priv_account_new_array (machine, cell);
+  
+  return cell;
+}
+
+void um_priv_mark_dirty (ArrayCell * cell, platter_t offset, platter_t count)
+{
+  if (DIRTY_ALL == cell->dirty || 0 == count)
+    {
+      return;
+    }
+  
+  if (NULL == cell->dirty_pages)
+    {
+      cell->dirty = DIRTY_ALL;
+      return;
+    }
+  
+  {
+    platter_t page = offset >> DIRTY_PAGE_SHIFT;
+    const platter_t last = (offset + count - 1) >> DIRTY_PAGE_SHIFT;
+    
+    for (; page <= last; ++page)
+      {
+	cell->dirty_pages [page >> 3] |= 1 << (page & 7);
+      }
+  }
+  
+  cell->dirty = DIRTY_PAGES;
+}
+
+platter_t um_priv_swap_platter_bytes (platter_t p)
+{
+  platter_t r = 0;
+  
+  {
+    r |= (p & 0xFF) << 24;
+    r |= (p & 0xFF00) << 8;
+    r |= (p & 0xFF0000) >> 8;
+    r |= (p & 0xFF000000) >> 24;
+  }
+  
+  return r;
+}
+
+size_t um_priv_put_varint (byte * out, unsigned long long v)
+{
+  size_t n = 0;
+  
+  while (v >= 0x80)
+    {
+      out[n++] = (byte) (v | 0x80);
+      v >>= 7;
+    }
+  out[n++] = (byte) v;
+  
+  return n;
+}
+
+int um_priv_get_varint (const byte ** in, const byte * end, unsigned long long * v)
+{
+  const byte * p = *in;
+  unsigned long long value = 0;
+  unsigned int shift = 0;
+  
+  while (p < end && shift < 64)
+    {
+      const byte b = *p++;
+      
+      value |= ((unsigned long long) (b & 0x7F)) << shift;
+      
+      if (0 == (b & 0x80))
+	{
+	  *v = value;
+	  *in = p;
+	  return EOK;
+	}
+      
+      shift += 7;
+    }
+  
+  return EINVAL;
+}
+
+unsigned long long um_priv_fnv1a (unsigned long long h, const void * data, size_t size)
+{
+  const byte * p = (const byte *) data;
+  const byte * end = p + size;
+  
+  for (; p < end; ++p)
+    {
+      h = (h ^ *p) * 0x100000001b3ULL;
+    }
+  
+  return h;
+}
+
+/**
+ * 
+ * @param a is a platter address, not byte address
+ */
+static platter_t um_priv_read_platter_from (struct um_t * machine
+                                            , address_t a)
+{
+#define VALIDATE_ADDRESS(address,array) if ((address) >= (array)->size) fail(machine)
+  
+  const ArraySlot *
+    slot = ((const ArrayTable *) machine->arrays)->slots + UM_PROGRAM_ARRAY_ID;
+  
+  if (NULL == slot->data)
+    {
+      fail (machine);
+    }
+  
+  VALIDATE_ADDRESS (a, slot);
+  
+  return um_priv_swap_platter_bytes (slot->data[a]);
+}
+
+/**
+ * Same as um_priv_read_platter_from for a guarded program array, which
+ * always exists.
+ */
+static platter_t um_priv_read_guarded_platter_from (struct um_t * machine
+						    , address_t a)
+{
+  const ArraySlot *
+    slot = ((const ArrayTable *) machine->arrays)->slots + UM_PROGRAM_ARRAY_ID;
+  
+  assert (NULL != slot->data);
+  
+  return um_priv_swap_platter_bytes (slot->data[a]);
+}
+
+static int um_priv_initialize_machine (struct um_t * machine)
+{
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+  
+  // assume memset eq value 0
+  memset ((void *) &machine->registers[0], 0, sizeof(machine->registers));
+  
+  machine->ip = 0;
+  
+  // allocate one for the special case of the program array
+  machine->arrays = NULL;
+  machine->next_array_id = UM_PROGRAM_ARRAY_ID;
+  
+  machine->status = UM_STATUS_RUNNING;
+  machine->failure = NULL;
+  
+  memset ((void *) &machine->stats, 0, sizeof(machine->stats));
+  
+  return EOK;
+}
+
+static int um_priv_initialize_program_array_with (struct um_t * machine
+						  , byte * data
+						  , size_t size)
+{
+  // check if already exists
+  ArrayCell * cell = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
+  if (NULL != cell)
+    {
+      fail (machine);
+    }
+  
+  if (0 != (size % sizeof(platter_t)))
+    {
+      fail (machine);
+    }
+  
+  {
+    size_t number_of_platters_to_allocate = size / sizeof(platter_t);
+    
+    cell = um_priv_new_array_cell (machine, number_of_platters_to_allocate, 0);
+    
+    // should be the first allocation
     if (NULL == cell || cell->id != UM_PROGRAM_ARRAY_ID)
       {
 	fail (machine);
@@ -605,7 +1143,9 @@ static int um_priv_initialize_program_array_with (struct um_t * machine
     
     memcpy (cell->data, data, size);
     
-    machine->arrays = cell;
+    um_priv_add_array_cell (machine, cell);
+    
+    um_priv_account_new_array (machine, cell);
   }
   
   return EOK;
@@ -623,70 +1163,223 @@ static byte decode_register_value_from_platter (platter_t p, Register r)
 
 static void fail (struct um_t * machine)
 {
+  machine->status = UM_STATUS_FAILED;
+  
+  // the caller asked to get the failure back (see um_run_for)
+  if (NULL != machine->failure)
+    {
+      longjmp (* (jmp_buf *) machine->failure, 1);
+    }
+  
   assert(0);
   fprintf (stderr, "fail: invalid operation\n");
   exit (1);
 }
 
-#include <setjmp.h>
-static jmp_buf jmp_env;
-
-static int um_priv_do_one_spin (struct um_t * machine
-				, on_run_one_step_func onestep
-				)
-{
-#define VALIDATE_OPCODE(opcode)\
-  if (opcode >= (sizeof(g_operators) / sizeof(g_operators[0])))\
-    fail (machine)
-  
-  platter_t op = um_priv_read_platter_from (machine, machine->ip);
-  
-  machine->ip++;
-  
-  VALIDATE_OPCODE ( OPCODE_FROM_PLATTER(op));
-  
-  assert (g_operators [OPCODE_FROM_PLATTER (op)].code == OPCODE_FROM_PLATTER(op));
-  
+/**
+ * Features an interpreter loop is generated with (UM_PRIV_DEFINE_RUN).
+ */
+enum
   {
-    byte rega = decode_register_value_from_platter (op, REGISTER_A);
-    byte regb = decode_register_value_from_platter (op, REGISTER_B);
-    byte regc = decode_register_value_from_platter (op, REGISTER_C);
+    // guard pages instead of the explicit checks (see um_set_checking)
+    UM_PRIV_RUN_GUARDED = 1 << 0,
     
-    if (NULL != onestep)
-      {
-	pp_opcode_data_t d = { .p = op, .rega = rega, .regb = regb, .regc = regc };
-	
-	onestep (machine
-		 , g_operators [OPCODE_FROM_PLATTER (op)].pp_opcode
-		 , d);
-      }
+    UM_PRIV_RUN_TRACED = 1 << 1,
+    UM_PRIV_RUN_PROFILED = 1 << 2,
+    
+    // the on_run_one_step_func of the debugger, its should_be_stopped_func
+    UM_PRIV_RUN_STEPPED = 1 << 3,
+    UM_PRIV_RUN_WATCHED = 1 << 4,
     
-    g_operators [OPCODE_FROM_PLATTER (op)].handler (machine
-						    , op
-						    , rega
-						    , regb
-						    , regc
-						    );
+    UM_PRIV_RUN_ALL = (1 << 5) - 1,
+  };
+
+typedef int (* um_priv_run_func) (struct um_t * machine
+				   , unsigned long long end
+				   , on_run_one_step_func onestep
+				   , should_be_stopped_func should_be_stopped
+				   , void * args);
+
+/**
+ * Defines um_priv_run_<name>, which runs the machine while it is running
+ * and has executed less than end instructions, and with
+ * UM_PRIV_RUN_WATCHED until should_be_stopped says so. features is a
+ * constant: a variant only tests for the features it has.
+ *
+ * The guarded variants return EAGAIN as soon as the machine falls back
+ * to the explicit checks (see um_priv_allocate_platters): the arrays
+ * allocated from then on have no guard region, the loop has to be
+ * selected again.
+ */
+#define UM_PRIV_DEFINE_RUN(name,features)				\
+  static int um_priv_run_##name (struct um_t * machine		\
+				  , unsigned long long end		\
+				  , on_run_one_step_func onestep	\
+				  , should_be_stopped_func should_be_stopped \
+				  , void * args)			\
+  {									\
+    const int guarded = ((features) & UM_PRIV_RUN_GUARDED)		\
+      && UM_CHECKING_GUARD_PAGES == machine->checking;			\
+									\
+    const struct Operator *						\
+      operators = guarded ? g_guarded_operators : g_operators;		\
+									\
+    while (UM_STATUS_RUNNING == machine->status			\
+	   && machine->stats.instructions < end)			\
+      {									\
+	const address_t at = machine->ip;				\
+									\
+	const platter_t op = guarded					\
+	  ? um_priv_read_guarded_platter_from (machine, at)		\
+	  : um_priv_read_platter_from (machine, at);			\
+									\
+	const byte rega = decode_register_value_from_platter (op, REGISTER_A); \
+	const byte regb = decode_register_value_from_platter (op, REGISTER_B); \
+	const byte regc = decode_register_value_from_platter (op, REGISTER_C); \
+									\
+	/* recorded once the hook took the byte */			\
+	const int io_traced = ((features) & UM_PRIV_RUN_TRACED)	\
+	  && NULL != machine->trace					\
+	  && (OP_INPUT == OPCODE_FROM_PLATTER (op)			\
+	      || OP_OUTPUT == OPCODE_FROM_PLATTER (op));		\
+									\
+	machine->ip++;							\
+	machine->stats.instructions++;					\
+									\
+	if (((features) & UM_PRIV_RUN_STEPPED) && NULL != onestep)	\
+	  {								\
+	    pp_opcode_data_t d = { .p = op, .rega = rega, .regb = regb, .regc = regc }; \
+									\
+	    onestep (machine						\
+		     , operators [OPCODE_FROM_PLATTER (op)].pp_opcode	\
+		     , d);						\
+	  }								\
+									\
+	if (io_traced)							\
+	  {								\
+	    um_trace_settle (machine->trace);				\
+	  }								\
+	else if (((features) & UM_PRIV_RUN_TRACED) && NULL != machine->trace) \
+	  {								\
+	    um_trace_record (machine->trace, machine, at, op);		\
+	  }								\
+									\
+	if (((features) & UM_PRIV_RUN_PROFILED) && NULL != machine->profile) \
+	  {								\
+	    um_profile_instruction (machine->profile, machine);	\
+	  }								\
+									\
+	operators [OPCODE_FROM_PLATTER (op)].handler (machine		\
+						      , op		\
+						      , rega		\
+						      , regb		\
+						      , regc		\
+						      );		\
+									\
+	if (io_traced							\
+	    && UM_STATUS_NEEDS_INPUT != machine->status		\
+	    && UM_STATUS_HAS_OUTPUT != machine->status)		\
+	  {								\
+	    um_trace_record (machine->trace, machine, at, op);		\
+	  }								\
+									\
+	if (((features) & UM_PRIV_RUN_WATCHED) && NULL != should_be_stopped \
+	    && should_be_stopped (machine, 0, args))			\
+	  {								\
+	    break;							\
+	  }								\
+									\
+	if (guarded && UM_CHECKING_GUARD_PAGES != machine->checking)	\
+	  {								\
+	    return EAGAIN;						\
+	  }								\
+      }									\
+									\
+    return EOK;								\
   }
-  
-#undef VALIDATE_OPCODE
-  
-  return EOK;
-}
 
-static int um_priv_do_spin (struct um_t * machine)
+UM_PRIV_DEFINE_RUN (release, 0)
+UM_PRIV_DEFINE_RUN (guarded, UM_PRIV_RUN_GUARDED)
+UM_PRIV_DEFINE_RUN (traced, UM_PRIV_RUN_TRACED)
+UM_PRIV_DEFINE_RUN (profiled, UM_PRIV_RUN_PROFILED)
+UM_PRIV_DEFINE_RUN (stepped, UM_PRIV_RUN_STEPPED)
+UM_PRIV_DEFINE_RUN (watched, UM_PRIV_RUN_STEPPED | UM_PRIV_RUN_WATCHED)
+UM_PRIV_DEFINE_RUN (generic, UM_PRIV_RUN_ALL)
+
+#undef UM_PRIV_DEFINE_RUN
+
+/**
+ * @return the loop for the features the machine and the caller use, the
+ * generic one for the combinations without a variant of their own
+ */
+static um_priv_run_func um_priv_select_run (struct um_t * machine
+					    , on_run_one_step_func onestep
+					    , should_be_stopped_func should_be_stopped)
 {
-  if ( ! setjmp (jmp_env))
+  static const um_priv_run_func runs [UM_PRIV_RUN_ALL + 1] = {
+    [0] = um_priv_run_release,
+    [UM_PRIV_RUN_GUARDED] = um_priv_run_guarded,
+    [UM_PRIV_RUN_TRACED] = um_priv_run_traced,
+    [UM_PRIV_RUN_PROFILED] = um_priv_run_profiled,
+    [UM_PRIV_RUN_STEPPED] = um_priv_run_stepped,
+    [UM_PRIV_RUN_WATCHED] = um_priv_run_watched,
+    [UM_PRIV_RUN_STEPPED | UM_PRIV_RUN_WATCHED] = um_priv_run_watched,
+  };
+  
+  int features = 0;
+  
+  if (UM_CHECKING_GUARD_PAGES == machine->checking)
     {
-      while (1)
-        {
-	  um_priv_do_one_spin (machine, NULL);
-	}
+      features |= UM_PRIV_RUN_GUARDED;
     }
-  else
+  if (NULL != machine->trace)
+    {
+      features |= UM_PRIV_RUN_TRACED;
+    }
+  if (NULL != machine->profile)
+    {
+      features |= UM_PRIV_RUN_PROFILED;
+    }
+  if (NULL != onestep)
+    {
+      features |= UM_PRIV_RUN_STEPPED;
+    }
+  if (NULL != should_be_stopped)
+    {
+      features |= UM_PRIV_RUN_WATCHED;
+    }
+  
+  return NULL != runs [features] ? runs [features] : um_priv_run_generic;
+}
+
+/**
+ * Runs the machine with the loop for its features (see
+ * UM_PRIV_DEFINE_RUN), selected again when they change.
+ */
+static void um_priv_run (struct um_t * machine
+			 , unsigned long long end
+			 , on_run_one_step_func onestep
+			 , should_be_stopped_func should_be_stopped
+			 , void * args)
+{
+  while (EAGAIN == um_priv_select_run (machine, onestep, should_be_stopped) (machine
+									     , end
+									     , onestep
+									     , should_be_stopped
+									     , args))
     {
-      printf ("Processor halted\n");
     }
+}
+
+static int um_priv_do_spin (struct um_t * machine)
+{
+  struct um_t * previous = um_priv_enter (machine);
+  
+  um_priv_run (machine, ~0ULL, NULL, NULL, NULL);
+  
+  um_priv_leave (previous);
+  
+  printf ("Processor halted\n");
   
   return EOK;
 }
@@ -696,8 +1389,9 @@ static int um_priv_do_spin (struct um_t * machine)
 // operator handler definitions
 //////////////////////////////////////////////////
 
-#define VALIDATE_OFFSET(offset,array) if ((offset) >= (array)->datasize) fail(machine)
-#define VALIDATE_REGISTER_INDEX(r) if ((r) >= UM_REGISTER_COUNT) fail(machine)
+#define VALIDATE_OFFSET(offset,slot) if ((offset) >= (slot)->size) fail(machine)
+// the register fields are 3 bits wide, they cannot be out of range
+#define VALIDATE_REGISTER_INDEX(r) assert ((r) < UM_REGISTER_COUNT)
 #define VALIDATE_REGISTERS(func)        /* printf (#func " ip: %d, rega: %d, regb, %d, regc %d\n", machine->ip, rega, regb, regc);*/ VALIDATE_REGISTER_INDEX(rega); VALIDATE_REGISTER_INDEX(regb); VALIDATE_REGISTER_INDEX(regc)
     
 
@@ -730,18 +1424,21 @@ static int um_priv_handler_array_idx (struct um_t * machine
   VALIDATE_REGISTERS (um_priv_handler_array_idx);
   
   {
+    const ArrayTable * t = (const ArrayTable *) machine->arrays;
     platter_t array_idx = machine->registers[regb];
     platter_t array_offset = machine->registers[regc];
+    const ArraySlot * slot = NULL;
     
-    ArrayCell * cell = um_priv_search_for_cell_id (machine, array_idx);
-    if (NULL == cell)
+    if (array_idx >= t->capacity)
       {
 	fail (machine);
       }
     
-    VALIDATE_OFFSET(array_offset,cell);
+    // a free id has no platter
+    slot = t->slots + array_idx;
+    VALIDATE_OFFSET(array_offset,slot);
     
-    machine->registers[rega] = um_priv_swap_platter_bytes (cell->data[array_offset]);
+    machine->registers[rega] = um_priv_swap_platter_bytes (slot->data[array_offset]);
   }
     
   return EOK;
@@ -757,19 +1454,30 @@ static int um_priv_handler_array_amend (struct um_t * machine
   VALIDATE_REGISTERS (um_priv_handler_array_amend);
     
   {
+    const ArrayTable * t = (const ArrayTable *) machine->arrays;
     platter_t array_idx = machine->registers[rega];
     platter_t array_offset = machine->registers[regb];
+    const ArraySlot * slot = NULL;
     
-    ArrayCell *
-      cell = um_priv_search_for_cell_id (machine, array_idx);
-    if (NULL == cell)
+    if (array_idx >= t->capacity)
       {
 	fail (machine);
       }
     
-    VALIDATE_OFFSET(array_offset,cell);
+    slot = t->slots + array_idx;
+    VALIDATE_OFFSET(array_offset,slot);
+    
+    slot->data[array_offset] = um_priv_swap_platter_bytes (machine->registers[regc]);
     
-    cell->data[array_offset] = um_priv_swap_platter_bytes (machine->registers[regc]);
+    if (NULL != machine->checkpoint)
+      {
+	um_priv_mark_dirty (t->cells[array_idx], array_offset, 1);
+      }
+    
+    if (UM_PROGRAM_ARRAY_ID == array_idx && NULL != machine->intrinsics)
+      {
+	um_intrinsics_amend (machine->intrinsics, array_offset);
+      }
   }
   
   return EOK;
@@ -851,13 +1559,19 @@ static int um_priv_handler_allocation (struct um_t * machine
   
   {
     ArrayCell *
-      cell = um_priv_new_array_cell (machine->registers[regc]);
-    
-    memset (cell->data, 0, cell->datasize * sizeof(platter_t));
+      cell = um_priv_new_array_cell (machine, machine->registers[regc], 1);
     
-    machine->registers[rega] = cell->id;
+    machine->registers[regb] = cell->id;
     
     um_priv_add_array_cell (machine, cell);
+    
+    machine->stats.allocations++;
+    um_priv_account_new_array (machine, cell);
+    
+    if (NULL != machine->gc)
+      {
+	um_gc_allocated (machine->gc, machine);
+      }
   }
   
   return EOK;
@@ -889,8 +1603,11 @@ static int um_priv_handler_abandonment (struct um_t * machine
       }
     else
       {
+	machine->stats.abandonments++;
+	um_priv_account_deleted_array (machine, cell);
+	
 	um_priv_remove_array_cell (machine, cell);
-	um_priv_delete_array (cell);
+	um_priv_delete_array (machine, cell);
       }
   }
   
@@ -912,7 +1629,21 @@ static int um_priv_handler_output (struct um_t * machine
 	fail (machine);
       }
     
-    printf ("%c", machine->registers[regc]);
+    if (NULL != machine->io.output)
+      {
+	if (UM_OUTPUT_WOULD_BLOCK
+	    == machine->io.output (machine->io.context, (byte) machine->registers[regc]))
+	  {
+	    // not executed, um_run_for runs it again
+	    machine->ip--;
+	    machine->stats.instructions--;
+	    machine->status = UM_STATUS_HAS_OUTPUT;
+	  }
+      }
+    else
+      {
+	printf ("%c", machine->registers[regc]);
+      }
   }
   
   return EOK;
@@ -928,10 +1659,20 @@ static int um_priv_handler_input (struct um_t * machine
   VALIDATE_REGISTERS (um_priv_handler_input);
   
   {
-    int c = fgetc (stdin);
-    if (EOF == c)
+    int c = NULL != machine->io.input
+      ? machine->io.input (machine->io.context)
+      : fgetc (stdin);
+    
+    if (UM_INPUT_WOULD_BLOCK == c)
       {
-	machine->registers[regc] = 0xFFFFFFFF;
+	// not executed, um_run_for runs it again
+	machine->ip--;
+	machine->stats.instructions--;
+	machine->status = UM_STATUS_NEEDS_INPUT;
+      }
+    else if (EOF == c)
+      {
+	machine->registers[regc] = 0xFFFFFFFF;
       }
     else
       {
@@ -963,19 +1704,25 @@ static int um_priv_handler_load_program (struct um_t * machine
       
       {
         ArrayCell *
-          newcell = um_priv_new_array_cell_from_cell (cell);
+          newcell = um_priv_new_array_cell_from_cell (machine, cell);
 	
         ArrayCell *
 	  zeroc = um_priv_search_for_cell_id (machine, UM_PROGRAM_ARRAY_ID);
         if (NULL != zeroc)
 	  {
+	    um_priv_account_deleted_array (machine, zeroc);
 	    um_priv_remove_array_cell (machine, zeroc);
-	    um_priv_delete_array (zeroc);
+	    um_priv_delete_array (machine, zeroc);
 	  }
 	
 	newcell->id = UM_PROGRAM_ARRAY_ID;
-	
 	um_priv_add_array_cell (machine, newcell);
+	um_priv_account_new_array (machine, newcell);
+	
+	if (NULL != machine->intrinsics)
+	  {
+	    um_intrinsics_reload (machine->intrinsics);
+	  }
       }
     }
   
@@ -984,6 +1731,12 @@ static int um_priv_handler_load_program (struct um_t * machine
     machine->ip = offset;
   }
   
+  // a trace has to see every instruction
+  if (NULL != machine->intrinsics && NULL == machine->trace)
+    {
+      um_intrinsics_jump (machine->intrinsics, machine);
+    }
+  
   return EOK;
 }
 
@@ -994,7 +1747,7 @@ static int um_priv_handler_halt (struct um_t * machine
 				 , byte regc
 				 )
 {
-  longjmp (jmp_env, 1);
+  machine->status = UM_STATUS_HALTED;
   
   return EOK;
 }
@@ -1018,22 +1771,916 @@ static int um_priv_handler_orthography (struct um_t * machine
   return EOK;
 }
 
+/**
+ * @return the count platters of the array from offset, fails the
+ * machine if they do not fit in it
+ */
+static platter_t * um_priv_bulk_range (struct um_t * machine
+				       , platter_t array_idx
+				       , platter_t array_offset
+				       , platter_t count)
+{
+  ArrayCell * cell = um_priv_search_for_cell_id (machine, array_idx);
+  
+  if (NULL == cell
+      || (unsigned long long) array_offset + count > cell->datasize)
+    {
+      fail (machine);
+    }
+  
+  return cell->data + array_offset;
+}
+
+static int um_priv_handler_bulk_store (struct um_t * machine
+				       , platter_t p
+				       , byte rega
+				       , byte regb
+				       , byte regc
+				       )
+{
+  const platter_t * r = machine->registers;
+  const platter_t count = r[regc];
+  platter_t * to = NULL;
+  
+  if (! machine->extensions)
+    {
+      fail (machine);
+    }
+  
+  switch (BULK_OPERATION_FROM_PLATTER (p))
+    {
+    case BULK_COPY:
+      {
+	const platter_t * from = um_priv_bulk_range (machine, r[regb], r[(regb + 1) & 0x7], count);
+	
+	to = um_priv_bulk_range (machine, r[rega], r[(rega + 1) & 0x7], count);
+	
+	// the arrays are stored big endian both
+	memmove (to, from, (size_t) count * sizeof(platter_t));
+      }
+      break;
+      
+    case BULK_FILL:
+      {
+	const platter_t value = um_priv_swap_platter_bytes (r[regb]);
+	platter_t filled = 1;
+	
+	to = um_priv_bulk_range (machine, r[rega], r[(rega + 1) & 0x7], count);
+	
+	if ((value & 0xFF) * 0x01010101U == value)
+	  {
+	    memset (to, value & 0xFF, (size_t) count * sizeof(platter_t));
+	  }
+	else if (0 != count)
+	  {
+	    // the filled part is doubled until it covers the range
+	    to[0] = value;
+	    while (filled < count)
+	      {
+		const platter_t n = count - filled < filled ? count - filled : filled;
+		memcpy (to + filled, to, (size_t) n * sizeof(platter_t));
+		filled += n;
+	      }
+	  }
+      }
+      break;
+      
+    default:
+      fail (machine);
+    }
+  
+  if (NULL != machine->checkpoint)
+    {
+      um_priv_mark_dirty (um_priv_search_for_cell_id (machine, r[rega]), r[(rega + 1) & 0x7], count);
+    }
+  
+  if (UM_PROGRAM_ARRAY_ID == r[rega] && 0 != count && NULL != machine->intrinsics)
+    {
+      um_intrinsics_reload (machine->intrinsics);
+    }
+  
+  return EOK;
+}
+
+/**
+ * Platters compared / searched at once before the first difference /
+ * match is looked for.
+ */
+enum { UM_PRIV_BULK_COMPARE_BLOCK = 256 };
+
+static int um_priv_handler_bulk_scan (struct um_t * machine
+				      , platter_t p
+				      , byte rega
+				      , byte regb
+				      , byte regc
+				      )
+{
+  platter_t * r = machine->registers;
+  const platter_t count = r[regc];
+  const platter_t * a = NULL;
+  platter_t found = 0xFFFFFFFF;
+  platter_t i = 0;
+  
+  if (! machine->extensions)
+    {
+      fail (machine);
+    }
+  
+  a = um_priv_bulk_range (machine, r[rega], r[(rega + 1) & 0x7], count);
+  
+  switch (BULK_OPERATION_FROM_PLATTER (p))
+    {
+    case BULK_COMPARE:
+      {
+	const platter_t * b = um_priv_bulk_range (machine, r[regb], r[(regb + 1) & 0x7], count);
+	
+	// whole blocks first, only the block that differs is walked
+	while (i < count)
+	  {
+	    const platter_t n = count - i < UM_PRIV_BULK_COMPARE_BLOCK
+	      ? count - i
+	      : UM_PRIV_BULK_COMPARE_BLOCK;
+	    
+	    if (0 != memcmp (a + i, b + i, (size_t) n * sizeof(platter_t)))
+	      {
+		while (a[i] == b[i])
+		  {
+		    i++;
+		  }
+		found = i;
+		break;
+	      }
+	    
+	    i += n;
+	  }
+      }
+      break;
+      
+    case BULK_SEARCH:
+      {
+	const platter_t value = um_priv_swap_platter_bytes (r[regb]);
+	
+	// the whole blocks are checked without branches, only the block
+	// that holds the value and the last partial one are walked
+	while (i < count)
+	  {
+	    if (count - i >= UM_PRIV_BULK_COMPARE_BLOCK)
+	      {
+		const platter_t * block = a + i;
+		platter_t hit = 0;
+		size_t j = 0;
+		
+		for (j = 0; j < UM_PRIV_BULK_COMPARE_BLOCK; ++j)
+		  {
+		    hit |= value == block[j];
+		  }
+		
+		if (0 == hit)
+		  {
+		    i += UM_PRIV_BULK_COMPARE_BLOCK;
+		    continue;
+		  }
+		
+		while (value != a[i])
+		  {
+		    i++;
+		  }
+	      }
+	    
+	    if (value == a[i])
+	      {
+		found = i;
+		break;
+	      }
+	    i++;
+	  }
+      }
+      break;
+      
+    default:
+      fail (machine);
+    }
+  
+  r[regc] = found;
+  
+  return EOK;
+}
+
+
+static int um_priv_handler_guarded_array_idx (struct um_t * machine
+					      , platter_t p
+					      , byte rega
+					      , byte regb
+					      , byte regc
+					      )
+{
+  VALIDATE_REGISTERS (um_priv_handler_guarded_array_idx);
+  
+  {
+    const ArrayTable * t = (const ArrayTable *) machine->arrays;
+    const platter_t array_idx = machine->registers[regb];
+    
+    if (array_idx >= t->capacity || NULL == t->slots[array_idx].data)
+      {
+	fail (machine);
+      }
+    
+    // past the end is caught by the guard region
+    machine->registers[rega] = um_priv_swap_platter_bytes (t->slots[array_idx].data[machine->registers[regc]]);
+  }
+  
+  return EOK;
+}
+
+static int um_priv_handler_guarded_array_amend (struct um_t * machine
+						, platter_t p
+						, byte rega
+						, byte regb
+						, byte regc
+						)
+{
+  VALIDATE_REGISTERS (um_priv_handler_guarded_array_amend);
+  
+  {
+    const ArrayTable * t = (const ArrayTable *) machine->arrays;
+    const platter_t array_idx = machine->registers[rega];
+    
+    if (array_idx >= t->capacity || NULL == t->slots[array_idx].data)
+      {
+	fail (machine);
+      }
+    
+    t->slots[array_idx].data[machine->registers[regb]] = um_priv_swap_platter_bytes (machine->registers[regc]);
+    
+    if (NULL != machine->checkpoint)
+      {
+	um_priv_mark_dirty (t->cells[array_idx], machine->registers[regb], 1);
+      }
+    
+    if (UM_PROGRAM_ARRAY_ID == machine->registers[rega] && NULL != machine->intrinsics)
+      {
+	um_intrinsics_amend (machine->intrinsics, machine->registers[regb]);
+      }
+  }
+  
+  return EOK;
+}
+
+static int um_priv_handler_guarded_division (struct um_t * machine
+					     , platter_t p
+					     , byte rega
+					     , byte regb
+					     , byte regc
+					     )
+{
+  VALIDATE_REGISTERS (um_priv_handler_guarded_division);
+  
+  // a division by zero raises SIGFPE
+  machine->registers[rega] = (machine->registers[regb] / machine->registers[regc]);
+  
+  return EOK;
+}
+
 
 #undef VALIDATE_REGISTERS
 #undef VALIDATE_REGISTER_INDEX
 #undef VALIDATE_OFFSET
 
 
+//////////////////////////////////////
+// guard pages
+//////////////////////////////////////
+
+// machine run by this thread in UM_CHECKING_GUARD_PAGES mode
+static __thread struct um_t * um_priv_guarded_machine = NULL;
+
+static int um_priv_is_guard_fault (struct um_t * machine, const void * address)
+{
+  const ArrayCell * p = um_priv_cell_from (machine, 0);
+  
+  for (; NULL != p; p = um_priv_cell_from (machine, p->id + 1))
+    {
+      if (p->guarded)
+	{
+	  const byte * region = um_priv_guarded_region (p->data, p->datasize);
+	  const size_t size = um_priv_guarded_pages_size (p->datasize) + UM_PRIV_GUARD_SIZE;
+	  
+	  if ((const byte *) address >= region && (const byte *) address < region + size)
+	    {
+	      return 1;
+	    }
+	}
+    }
+  
+  return 0;
+}
+
+static void um_priv_on_fault (int sig, siginfo_t * info, void * context)
+{
+  struct um_t * machine = um_priv_guarded_machine;
+  
+  if (NULL != machine
+      && (SIGFPE == sig || um_priv_is_guard_fault (machine, info->si_addr)))
+    {
+      // does not return
+      fail (machine);
+    }
+  
+  // not caused by the program, the faulting instruction is restarted
+  // with the default action
+  signal (sig, SIG_DFL);
+}
+
+static int um_priv_install_fault_handlers (void)
+{
+  static int installed = 0;
+  
+  if ( ! installed)
+    {
+      struct sigaction action;
+      
+      memcpy (g_guarded_operators, g_operators, sizeof(g_operators));
+      g_guarded_operators [OP_ARRAY_INDEX].handler = um_priv_handler_guarded_array_idx;
+      g_guarded_operators [OP_ARRAY_AMEND].handler = um_priv_handler_guarded_array_amend;
+      g_guarded_operators [OP_DIVISION].handler = um_priv_handler_guarded_division;
+      
+      // the handler leaves with longjmp, the signal must not stay blocked
+      memset (&action, 0, sizeof(action));
+      action.sa_sigaction = um_priv_on_fault;
+      action.sa_flags = SA_SIGINFO | SA_NODEFER;
+      sigemptyset (&action.sa_mask);
+      
+      if (0 != sigaction (SIGSEGV, &action, NULL)
+	  || 0 != sigaction (SIGFPE, &action, NULL))
+	{
+	  return errno;
+	}
+      
+      installed = 1;
+    }
+  
+  return EOK;
+}
+
+static struct um_t * um_priv_enter (struct um_t * machine)
+{
+  struct um_t * previous = um_priv_guarded_machine;
+  
+  um_priv_guarded_machine = UM_CHECKING_GUARD_PAGES == machine->checking ? machine : NULL;
+  
+  return previous;
+}
+
+static void um_priv_leave (struct um_t * previous)
+{
+  um_priv_guarded_machine = previous;
+}
+
+
 //////////////////////////////////////
 // public functions
 //////////////////////////////////////
 
+int um_pp_instruction (char * out
+		       , size_t outsize
+		       , struct um_t * machine
+		       , platter_t p)
+{
+  if (NULL == out || NULL == machine)
+    {
+      return EINVAL;
+    }
+  
+  if (OPCODE_FROM_PLATTER (p) >= (sizeof(g_operators) / sizeof(g_operators[0])))
+    {
+      snprintf (out, outsize, "INVALID (0x%08X)", p);
+      return EINVAL;
+    }
+  
+  {
+    pp_opcode_data_t d = {
+      .p = p
+      , .rega = decode_register_value_from_platter (p, REGISTER_A)
+      , .regb = decode_register_value_from_platter (p, REGISTER_B)
+      , .regc = decode_register_value_from_platter (p, REGISTER_C)
+    };
+    
+    g_operators [OPCODE_FROM_PLATTER (p)].pp_opcode (out, outsize, machine, d);
+  }
+  
+  return EOK;
+}
+
+int um_load_image (const char * path
+		   , byte ** data
+		   , size_t * size)
+{
+  if (NULL == path || NULL == data || NULL == size)
+    {
+      return EINVAL;
+    }
+  
+  {
+    FILE * f = fopen (path, "rb");
+    long fs = 0;
+    byte * content = NULL;
+    
+    if ( ! f)
+      {
+	return errno;
+      }
+    
+    fseek (f, 0, SEEK_END);
+    fs = ftell (f);
+    fseek (f, 0, SEEK_SET);
+    
+    content = (byte *) malloc (fs > 0 ? fs : 1);
+    if (NULL == content)
+      {
+	fclose (f);
+	return ENOMEM;
+      }
+    
+    if ((size_t) fs != fread (content, 1, fs, f))
+      {
+	free (content);
+	fclose (f);
+	return EIO;
+      }
+    
+    fclose (f);
+    
+    *data = content;
+    *size = fs;
+  }
+  
+  return EOK;
+}
+
 int um_run (struct um_t * machine, byte * codex, size_t codex_size)
 {
+  return um_run_with_engine (machine, UM_ENGINE_DEFAULT, codex, codex_size);
+}
+
+int um_release (struct um_t * machine)
+{
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+  
+  {
+    ArrayTable * t = (ArrayTable *) machine->arrays;
+    platter_t i = 0;
+    
+    for (; NULL != t && i < t->capacity; ++i)
+      {
+	if (NULL != t->cells[i])
+	  {
+	    um_priv_delete_array (machine, t->cells[i]);
+	  }
+      }
+    
+    if (NULL != t)
+      {
+	free (t->slots);
+	free (t->cells);
+	free (t);
+      }
+  }
+  
+  machine->arrays = NULL;
+  machine->stats.live_arrays = 0;
+  machine->stats.heap_bytes = 0;
+  
+  return EOK;
+}
+
+int um_clone (struct um_t * clone
+	      , struct um_t * machine)
+{
+  const ArrayTable * t = (const ArrayTable *) machine->arrays;
+  ArrayTable * ct = NULL;
+  platter_t i = 0;
+  
+  if (NULL == clone || NULL == machine || NULL == machine->arrays || clone == machine)
+    {
+      return EINVAL;
+    }
+  
+  if (NULL != clone->arrays)
+    {
+      return EBUSY;
+    }
+  
+  um_priv_initialize_machine (clone);
+  
+  memcpy (clone->registers, machine->registers, sizeof(clone->registers));
+  clone->ip = machine->ip;
+  clone->next_array_id = machine->next_array_id;
+  clone->status = machine->status;
+  clone->checking = machine->checking;
+  clone->bypass = machine->bypass;
+  clone->extensions = machine->extensions;
+  
+  if (EOK != um_priv_reserve_array_ids (clone, t->capacity))
+    {
+      um_release (clone);
+      return ENOMEM;
+    }
+  ct = (ArrayTable *) clone->arrays;
+  
+  // same ids, and the free ones given in the same order
+  for (i = 0; i < t->capacity; ++i)
+    {
+      const ArrayCell * p = t->cells[i];
+      ArrayCell * cell = NULL;
+      
+      ct->slots[i].next_free = t->slots[i].next_free;
+      
+      if (NULL == p)
+	{
+	  continue;
+	}
+      
+      cell = (ArrayCell *) calloc (1, sizeof (ArrayCell));
+      if (NULL != cell)
+	{
+	  cell->data = um_priv_duplicate_platters (clone, p->data, p->datasize, &cell->guarded);
+	}
+      
+      if (NULL == cell || NULL == cell->data)
+	{
+	  free (cell);
+	  um_release (clone);
+	  return ENOMEM;
+	}
+      
+      cell->id = p->id;
+      cell->datasize = p->datasize;
+      
+      um_priv_insert_array_cell (clone, cell);
+      um_priv_account_new_array (clone, cell);
+    }
+  ct->free_ids = t->free_ids;
+  
+  return EOK;
+}
+
+const char * um_engine_name (um_engine_t engine)
+{
+  static const char * const names [] = {
+    [UM_ENGINE_INTERPRETER] = "interpreter",
+  };
+  
+  if (engine < 0 || engine >= UM_ENGINE_COUNT)
+    {
+      return NULL;
+    }
+  
+  return names [engine];
+}
+
+int um_run_with_engine (struct um_t * machine
+			, um_engine_t engine
+			, byte * codex
+			, size_t codex_size)
+{
+  if (NULL == machine || NULL == um_engine_name (engine))
+    {
+      return EINVAL;
+    }
+  
+  um_load (machine, codex, codex_size);
+  
+  return um_priv_do_spin (machine);
+}
+
+// data/um.um: 256 platters, then the program it interprets
+static const size_t UM_SELF_INTERPRETER_SIZE = 256 * sizeof(platter_t);
+static const unsigned long long UM_SELF_INTERPRETER_HASH = 0xd8f8f3ad99ae9437ULL;
+
+static int um_priv_is_self_interpreter (const byte * codex, size_t codex_size)
+{
+  return codex_size > UM_SELF_INTERPRETER_SIZE
+    && UM_SELF_INTERPRETER_HASH == um_priv_fnv1a (UM_PRIV_FNV1A_BASIS, codex, UM_SELF_INTERPRETER_SIZE);
+}
+
+int um_load (struct um_t * machine, byte * codex, size_t codex_size)
+{
+  if (NULL == machine || NULL == codex)
+    {
+      return EINVAL;
+    }
+  
   um_priv_initialize_machine (machine);
+  
+  while (machine->bypass && um_priv_is_self_interpreter (codex, codex_size))
+    {
+      codex += UM_SELF_INTERPRETER_SIZE;
+      codex_size -= UM_SELF_INTERPRETER_SIZE;
+      machine->stats.bypassed_interpreters++;
+    }
   um_priv_initialize_program_array_with (machine, codex, codex_size);
   
-  return um_priv_do_spin (machine);
+  if (NULL != machine->intrinsics)
+    {
+      um_intrinsics_reload (machine->intrinsics);
+    }
+  
+  return EOK;
+}
+
+/**
+ * Maps the image file as the program array, copy on write: the pages are
+ * shared with the page cache and the ones the program never modifies are
+ * never copied.
+ *
+ * @return NULL when the image cannot be mapped as it is, to be read
+ */
+static ArrayCell * um_priv_map_program_file (struct um_t * machine
+					     , int fd
+					     , size_t size)
+{
+  ArrayCell * cell = NULL;
+  void * p = NULL;
+  byte prefix [256 * sizeof(platter_t)];
+  
+  if (0 != (size % sizeof(platter_t))
+      || size / sizeof(platter_t) < UM_PRIV_MAPPED_ARRAY_THRESHOLD
+      || size / sizeof(platter_t) > 0xFFFFFFFFULL
+      || UM_CHECKING_GUARD_PAGES == machine->checking)
+    {
+      return NULL;
+    }
+  
+  // the program after a skipped interpreter is not page aligned
+  if (machine->bypass
+      && (ssize_t) sizeof(prefix) == pread (fd, prefix, sizeof(prefix), 0)
+      && um_priv_is_self_interpreter (prefix, size))
+    {
+      return NULL;
+    }
+  
+  cell = (ArrayCell *) calloc (1, sizeof (ArrayCell));
+  if (NULL == cell)
+    {
+      return NULL;
+    }
+  
+  p = mmap (NULL
+	    , size
+	    , PROT_READ | PROT_WRITE
+	    , MAP_PRIVATE
+	    , fd
+	    , 0);
+  if (MAP_FAILED == p)
+    {
+      free (cell);
+      return NULL;
+    }
+  
+  // released by um_priv_free_platters as any other mapped array
+  cell->data = (platter_t *) p;
+  cell->datasize = size / sizeof(platter_t);
+  cell->id = um_priv_get_next_cellid (machine);
+  
+  return cell;
+}
+
+int um_load_file (struct um_t * machine, const char * path)
+{
+  struct stat st;
+  int fd = -1;
+  
+  if (NULL == machine || NULL == path)
+    {
+      return EINVAL;
+    }
+  
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return errno;
+    }
+  
+  if (0 != fstat (fd, &st))
+    {
+      int err = errno;
+      close (fd);
+      return err;
+    }
+  
+  {
+    ArrayCell * cell = NULL;
+    
+    um_priv_initialize_machine (machine);
+    
+    cell = um_priv_map_program_file (machine, fd, (size_t) st.st_size);
+    close (fd);
+    
+    if (NULL == cell)
+      {
+	byte * image = NULL;
+	size_t size = 0;
+	int err = um_load_image (path, &image, &size);
+	
+	if (EOK == err)
+	  {
+	    err = um_load (machine, image, size);
+	    free (image);
+	  }
+	
+	return err;
+      }
+    
+    if (EOK != um_priv_insert_array_cell (machine, cell))
+      {
+	um_priv_delete_array (machine, cell);
+	um_release (machine);
+	return ENOMEM;
+      }
+    um_priv_account_new_array (machine, cell);
+  }
+  
+  if (NULL != machine->intrinsics)
+    {
+      um_intrinsics_reload (machine->intrinsics);
+    }
+  
+  return EOK;
+}
+
+int um_set_bypass (struct um_t * machine
+		   , int enable)
+{
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+  
+  if (NULL != machine->arrays)
+    {
+      return EBUSY;
+    }
+  
+  machine->bypass = 0 != enable;
+  
+  return EOK;
+}
+
+int um_set_extensions (struct um_t * machine
+		       , int enable)
+{
+  if (NULL == machine)
+    {
+      return EINVAL;
+    }
+  
+  machine->extensions = 0 != enable;
+  
+  return EOK;
+}
+
+int um_set_checking (struct um_t * machine
+		     , um_checking_t checking)
+{
+  if (NULL == machine
+      || (UM_CHECKING_EXPLICIT != checking && UM_CHECKING_GUARD_PAGES != checking))
+    {
+      return EINVAL;
+    }
+  
+  if (NULL != machine->arrays)
+    {
+      return EBUSY;
+    }
+  
+  if (UM_CHECKING_GUARD_PAGES == checking && EOK != um_priv_install_fault_handlers ())
+    {
+      return ENOTSUP;
+    }
+  
+  machine->checking = checking;
+  
+  return EOK;
+}
+
+um_status_t um_run_for (struct um_t * machine
+			, um_engine_t engine
+			, unsigned long long budget)
+{
+  jmp_buf failure;
+  struct um_t * previous = NULL;
+  
+  if (NULL == machine || NULL == machine->arrays || NULL == um_engine_name (engine))
+    {
+      return UM_STATUS_FAILED;
+    }
+  
+  if (UM_STATUS_NEEDS_INPUT == machine->status
+      || UM_STATUS_HAS_OUTPUT == machine->status)
+    {
+      machine->status = UM_STATUS_RUNNING;
+    }
+  
+  previous = um_priv_enter (machine);
+  machine->failure = &failure;
+  
+  if (0 == setjmp (failure))
+    {
+      // no limit when that would overflow
+      const unsigned long long end = budget > ~0ULL - machine->stats.instructions
+	? ~0ULL
+	: machine->stats.instructions + budget;
+      
+      um_priv_run (machine, end, NULL, NULL, NULL);
+    }
+  
+  machine->failure = NULL;
+  um_priv_leave (previous);
+  
+  return machine->status;
+}
+
+int um_array_ids (struct um_t * machine
+		  , platter_t * ids
+		  , size_t capacity
+		  , size_t * count)
+{
+  if (NULL == machine || NULL == count)
+    {
+      return EINVAL;
+    }
+  
+  {
+    const ArrayCell * p = um_priv_cell_from (machine, 0);
+    size_t n = 0;
+    
+    for (; NULL != p; p = um_priv_cell_from (machine, p->id + 1), ++n)
+      {
+	if (n < capacity && NULL != ids)
+	  {
+	    ids[n] = p->id;
+	  }
+      }
+    
+    *count = n;
+    
+    return n <= capacity ? EOK : ENOSPC;
+  }
+}
+
+int um_array_size (struct um_t * machine
+		   , platter_t id
+		   , platter_t * size)
+{
+  if (NULL == machine || NULL == size)
+    {
+      return EINVAL;
+    }
+  
+  {
+    const ArrayCell * cell = um_priv_search_for_cell_id (machine, id);
+    if (NULL == cell)
+      {
+	return ENOENT;
+      }
+    
+    *size = cell->datasize;
+  }
+  
+  return EOK;
+}
+
+int um_array_read (struct um_t * machine
+		   , platter_t id
+		   , platter_t offset
+		   , platter_t count
+		   , platter_t * out)
+{
+  if (NULL == machine || (NULL == out && 0 != count))
+    {
+      return EINVAL;
+    }
+  
+  {
+    const ArrayCell * cell = um_priv_search_for_cell_id (machine, id);
+    
+    if (NULL == cell)
+      {
+	return ENOENT;
+      }
+    
+    if (offset > cell->datasize || count > cell->datasize - offset)
+      {
+	return ERANGE;
+      }
+    
+    um_kernels_swap_platters (out, cell->data + offset, count);
+  }
+  
+  return EOK;
 }
 
 int um_run_one_step (struct um_t * machine
@@ -1044,14 +2691,25 @@ int um_run_one_step (struct um_t * machine
 {
   if ( ! machine->arrays)
     {
-      um_priv_initialize_machine (machine);
-      um_priv_initialize_program_array_with (machine, codex, codex_size);
+      um_load (machine, codex, codex_size);
     }
   
-  return um_priv_do_one_spin (machine, on_one_step);
+  if (UM_STATUS_RUNNING != machine->status)
+    {
+      return machine->status;
+    }
+  
+  {
+    struct um_t * previous = um_priv_enter (machine);
+    
+    um_priv_run (machine, machine->stats.instructions + 1, on_one_step, NULL, NULL);
+    um_priv_leave (previous);
+    
+    return EOK;
+  }
 }
 
-int um_run_until (struct um_t * machine
+um_status_t um_run_until (struct um_t * machine
 		  , byte * codex
 		  , size_t codex_size
 		  , on_run_one_step_func on_run_one_step
@@ -1060,24 +2718,17 @@ int um_run_until (struct um_t * machine
 {
   if ( ! machine->arrays)
     {
-      um_priv_initialize_machine (machine);
-      um_priv_initialize_program_array_with (machine
-					     , codex
-					     , codex_size);
+      um_load (machine, codex, codex_size);
     }
   
-  while (1)
-    {
-      if (EOK != um_priv_do_one_spin (machine
-				      , on_run_one_step))
-	{
-	  break;
-	}
-      
-      if (should_be_stopped (machine, 0, args))
-	{
-	  break;
-	}
-    }
+  {
+    struct um_t * previous = um_priv_enter (machine);
+    
+    um_priv_run (machine, ~0ULL, on_run_one_step, should_be_stopped, args);
+    
+    um_priv_leave (previous);
+  }
+  
+  return machine->status;
 }
 
@@ -1,6 +1,8 @@
 #if ! defined (UC_H)
 #define UC_H
 
+#include <stddef.h>
+
 // should be more precise ... 
 typedef unsigned char byte;
 typedef unsigned int platter_t;
@@ -19,6 +21,95 @@ typedef enum UM_CONSTANTS
   } UM_CONSTANTS;
 
 
+#define UM_INPUT_WOULD_BLOCK (-2)
+#define UM_OUTPUT_WOULD_BLOCK (-2)
+
+
+typedef enum um_status_t
+  {
+    UM_STATUS_RUNNING,
+    UM_STATUS_HALTED,
+    UM_STATUS_FAILED,
+    
+    // the input hook had no byte yet (UM_INPUT_WOULD_BLOCK), the input
+    // instruction is executed again by the next um_run_for
+    UM_STATUS_NEEDS_INPUT,
+    
+    // same for the output hook (UM_OUTPUT_WOULD_BLOCK) and the output
+    // instruction
+    UM_STATUS_HAS_OUTPUT,
+    
+  } um_status_t;
+
+
+/**
+ * How the out of bounds accesses and divisions by zero are detected.
+ *
+ * UM_CHECKING_GUARD_PAGES places every array right before a 16GB
+ * inaccessible region, which any 32 bit offset past its end falls into,
+ * and turns the resulting SIGSEGV (and SIGFPE for divisions) into a
+ * machine failure, so that the array and division operators do not test
+ * anything. The machine goes back to the explicit checks when the
+ * address space is exhausted.
+ */
+typedef enum um_checking_t
+  {
+    UM_CHECKING_EXPLICIT,
+    UM_CHECKING_GUARD_PAGES,
+    
+  } um_checking_t;
+
+
+/**
+ * Where the output and input operators send and get their bytes. Both
+ * default to stdout / stdin when NULL.
+ */
+typedef struct um_io_t
+{
+  // @return 0, UM_OUTPUT_WOULD_BLOCK when the byte cannot be taken yet
+  // (um_run_for then returns UM_STATUS_HAS_OUTPUT)
+  int (* output) (void * context, byte c);
+  
+  // @return the next input byte, EOF at the end of the input,
+  // UM_INPUT_WOULD_BLOCK when no byte is available yet (um_run_for
+  // then returns UM_STATUS_NEEDS_INPUT)
+  int (* input) (void * context);
+  
+  void * context;
+  
+} um_io_t;
+
+
+/**
+ * Counters maintained by the VM while it runs.
+ */
+typedef struct um_stats_t
+{
+  unsigned long long instructions;
+  
+  unsigned long long allocations;
+  unsigned long long abandonments;
+  
+  // arrays currently alive, program array included
+  unsigned long long live_arrays;
+  
+  // bytes of platters held by the live arrays
+  unsigned long long heap_bytes;
+  unsigned long long peak_heap_bytes;
+  
+  // garbage collector (see gc.h), pauses in nanoseconds
+  unsigned long long gc_collections;
+  unsigned long long gc_reclaimed_arrays;
+  unsigned long long gc_reclaimed_bytes;
+  unsigned long long gc_pause_ns;
+  unsigned long long gc_max_pause_ns;
+  
+  // data/um.um layers skipped by um_load (see um_set_bypass)
+  unsigned long long bypassed_interpreters;
+  
+} um_stats_t;
+
+
 /**
  * 
  * 
@@ -31,7 +122,47 @@ typedef struct um_t
   // basic runtime structures
   address_t ip;
     
+  // arrays by id (ArrayTable, see um_priv.h), NULL until loaded
   void * arrays;
+  platter_t next_array_id;
+  
+  // binary execution trace (see trace.h), NULL when not tracing
+  void * trace;
+  
+  // garbage collector (see gc.h), NULL when disabled
+  void * gc;
+  
+  // allocation profiler (see profile.h), NULL when not profiling
+  void * profile;
+  
+  // deferred free service (see deferred.h), NULL to release the arrays
+  // synchronously
+  void * deferred;
+  
+  // native replacements of guest routines (see intrinsic.h), NULL when
+  // disabled
+  void * intrinsics;
+  
+  // incremental checkpoints (see checkpoint.h), NULL when not logging
+  void * checkpoint;
+  
+  um_stats_t stats;
+  
+  um_status_t status;
+  
+  um_io_t io;
+  
+  um_checking_t checking;
+  
+  // guests of the UM self interpreter run directly (see um_set_bypass)
+  int bypass;
+  
+  // operators 14 and 15 are accepted (see um_set_extensions)
+  int extensions;
+  
+  // jmp_buf * armed by the functions that return the failures to their
+  // caller, NULL to abort the process on failure
+  void * failure;
 
 } um_t;
 
@@ -44,6 +175,165 @@ int um_run (struct um_t *
 	    , byte *
 	    , size_t);
 
+
+/**
+ * Initializes the machine with the program, without running it. The
+ * io and trace members are left untouched.
+ */
+int um_load (struct um_t * machine
+	     , byte * codex
+	     , size_t codex_size);
+
+/**
+ * Same as um_load with the image file at path. A large image is mapped
+ * copy on write as the program array instead of being read and copied,
+ * so that launching the same program again costs no more than mapping
+ * pages already in the page cache.
+ *
+ * The program array then shares the pages it has not written with the
+ * file, which must not change while the machine runs: a write to the
+ * file shows in the program, and a truncation kills the process with
+ * SIGBUS on the next access past the new end. Use um_load_image and
+ * um_load for a file that may change.
+ *
+ * @return EOK or the errno of the failed file operation
+ */
+int um_load_file (struct um_t * machine
+		  , const char * path);
+
+/**
+ * Selects how the machine detects the invalid accesses, before um_load.
+ *
+ * @return EBUSY if a program is already loaded, ENOTSUP if the guard
+ * pages cannot be used
+ */
+int um_set_checking (struct um_t * machine
+		     , um_checking_t checking);
+
+/**
+ * When enabled, um_load recognizes the UM self interpreter (data/um.um,
+ * identified by the hash of its 256 platters) followed by the program it
+ * interprets, and loads that program instead: the interpreter runs it in
+ * place, as the program array, and maps its I/O and arrays one to one, so
+ * the output is the same for a fraction of the instructions. Nested
+ * interpreters are all skipped. The ids of the arrays may differ from the
+ * ones given by the interpreter when the guest loads another program.
+ */
+int um_set_bypass (struct um_t * machine
+		   , int enable);
+
+/**
+ * Enables the bulk array operators, that a strict ICFP machine fails on
+ * (the default). Both take an array and an offset in a pair of registers,
+ * REG[x] and REG[(x + 1) % 8], bits 9 to 11 select the operation:
+ *
+ * 14 (store), 0 copy: the REG[C] platters of array REG[B] from offset
+ *    REG[B + 1] are copied to array REG[A] from offset REG[A + 1], the
+ *    ranges may overlap
+ * 14 (store), 1 fill: REG[C] platters of array REG[A] from offset
+ *    REG[A + 1] are set to REG[B]
+ * 15 (scan), 0 compare: REG[C] is set to the index, from the offsets, of
+ *    the first platter that differs in the REG[C] platters of arrays
+ *    REG[A] and REG[B], 0xFFFFFFFF if there is none
+ * 15 (scan), 1 search: REG[C] is set to the index, from REG[A + 1], of
+ *    the first of the REG[C] platters of array REG[A] equal to REG[B],
+ *    0xFFFFFFFF if there is none
+ *
+ * The machine fails if a range does not fit in its array.
+ */
+int um_set_extensions (struct um_t * machine
+		       , int enable);
+
+/**
+ * Frees the arrays of a machine once it is not run anymore. The registers
+ * and the counters are kept.
+ */
+int um_release (struct um_t * machine);
+
+/**
+ * Initializes clone with a copy of the arrays, registers and state of a
+ * loaded machine that is not running, so that many sessions can start
+ * from a machine booted once. The hooks (io, trace, gc, profile,
+ * deferred) of clone are left as they are.
+ */
+int um_clone (struct um_t * clone
+	      , struct um_t * machine);
+
+
+/**
+ * Reads a whole program image (.um / .umz file) in memory.
+ *
+ * @param path
+ * @param data receives a buffer allocated with malloc
+ * @param size receives the size of the image in bytes
+ */
+int um_load_image (const char * path
+		   , byte ** data
+		   , size_t * size);
+
+
+/**
+ * Execution engines available to run a program. um_run uses the
+ * default one.
+ */
+typedef enum um_engine_t
+  {
+    UM_ENGINE_INTERPRETER,
+    
+    UM_ENGINE_COUNT,
+    UM_ENGINE_DEFAULT = UM_ENGINE_INTERPRETER,
+    
+  } um_engine_t;
+
+/**
+ * @return the name of the engine, NULL if it does not exist
+ */
+const char * um_engine_name (um_engine_t engine);
+
+/**
+ * Same as um_run but with an explicit engine.
+ */
+int um_run_with_engine (struct um_t * machine
+			, um_engine_t engine
+			, byte * codex
+			, size_t codex_size);
+
+/**
+ * Runs a machine initialized by um_load until it halts, fails, waits for
+ * input or output or has executed at least budget more instructions. A
+ * failure is returned instead of aborting the process. A machine that
+ * waited for input or output retries its input or output instruction.
+ *
+ * @return the status of the machine
+ */
+um_status_t um_run_for (struct um_t * machine
+			, um_engine_t engine
+			, unsigned long long budget);
+
+
+/**
+ * Inspection of the arrays of a machine, values are returned in host
+ * order.
+ *
+ * @param ids receives the ids of up to capacity live arrays
+ * @param count receives the number of live arrays
+ * @return ENOSPC when there are more than capacity arrays
+ */
+int um_array_ids (struct um_t * machine
+		  , platter_t * ids
+		  , size_t capacity
+		  , size_t * count);
+
+int um_array_size (struct um_t * machine
+		   , platter_t id
+		   , platter_t * size);
+
+int um_array_read (struct um_t * machine
+		   , platter_t id
+		   , platter_t offset
+		   , platter_t count
+		   , platter_t * out);
+
 /**
  * 
  * @param on_one_step
@@ -73,6 +363,20 @@ int um_run_one_step (struct um_t * machine
 		     , on_run_one_step_func f
 		     );
 
+/**
+ * Pretty prints the instruction p the same way the debugger does, using
+ * the current register values of machine.
+ *
+ * @param out
+ * @param outsize
+ * @param machine
+ * @param p the raw instruction platter
+ */
+int um_pp_instruction (char * out
+		       , size_t outsize
+		       , struct um_t * machine
+		       , platter_t p);
+
 typedef int (* should_be_stopped_func) (struct um_t * machine
 					, platter_t instruction
 					, void * args);
@@ -86,7 +390,7 @@ typedef int (* should_be_stopped_func) (struct um_t * machine
  * @param args arguments that are passed to the should_be_stopped function
  *
  */
-int um_run_until (struct um_t * machine
+um_status_t um_run_until (struct um_t * machine
 		  , byte * codex
 		  , size_t codex_size
 		  , on_run_one_step_func onestep
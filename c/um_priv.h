@@ -0,0 +1,242 @@
+#if ! defined (UM_PRIV_H)
+#define UM_PRIV_H
+
+// definitions shared between the VM core (um.c) and the modules that need
+// to look inside a machine (tracing, ...). Not part of the public API.
+
+#include "um.h"
+
+#if ! defined (EOK)
+#   define EOK 0
+#endif
+
+#if defined (OPCODE_FROM_PLATTER)
+#   error "Oops macro redefinition: OPCODE_FROM_PLATTER"
+#endif
+
+#define OPCODE_FROM_PLATTER(platter) (((platter) >> 28) & 0xF)
+
+
+typedef enum Register
+  {
+    REGISTER_A = 2,
+    REGISTER_B = 1,
+    REGISTER_C = 0,
+
+  } Register;
+
+
+typedef enum OperatorCodes
+  {
+    OP_COND_MOVE,
+    OP_ARRAY_INDEX,
+    OP_ARRAY_AMEND,
+    OP_ADDITION,
+    OP_MULTIPLICATION,
+    OP_DIVISION,
+    OP_NOT_AND,
+    OP_HALT,
+    OP_ALLOCATION,
+    OP_ABANDONMENT,
+    OP_OUTPUT,
+    OP_INPUT,
+    OP_LOAD_PROGRAM,
+    OP_ORTHOGRAPHY,
+
+    // extension operators, rejected unless enabled (see um_set_extensions)
+    OP_BULK_STORE,
+    OP_BULK_SCAN,
+
+  } OperatorCodes;
+
+
+/**
+ * Operation of an extension operator, in bits 9 to 11 of the platter.
+ */
+typedef enum BulkOperations
+  {
+    // OP_BULK_STORE
+    BULK_COPY = 0,
+    BULK_FILL = 1,
+
+    // OP_BULK_SCAN
+    BULK_COMPARE = 0,
+    BULK_SEARCH = 1,
+
+  } BulkOperations;
+
+#define BULK_OPERATION_FROM_PLATTER(platter) (((platter) >> 9) & 0x7)
+
+
+/**
+ * Changes of an array since the last checkpoint (see checkpoint.h).
+ */
+typedef enum DirtyStates
+  {
+    DIRTY_NONE,
+
+    // the pages whose bit is set in dirty_pages
+    DIRTY_PAGES,
+
+    // the whole array: created since, or written without dirty_pages
+    DIRTY_ALL,
+
+  } DirtyStates;
+
+// platters per page of dirty_pages
+#define DIRTY_PAGE_SHIFT 10
+
+
+typedef unsigned int ArrayCellId;
+typedef struct ArrayCell
+{
+  ArrayCellId id;
+  platter_t datasize; // in platter_t count
+  platter_t * data;
+  
+  // data is followed by a guard region (see um_set_checking)
+  byte guarded;
+  
+  // garbage collector state (see gc.c)
+  byte gc_mark;
+  platter_t gc_scan;
+  
+  // checkpoint state (see checkpoint.c), dirty_pages is a bit per page
+  // that only the large arrays get
+  byte dirty;
+  byte * dirty_pages;
+  
+  // written in a checkpoint of the log: its release has to be logged
+  byte checkpointed;
+
+} ArrayCell;
+
+
+/**
+ * What the array operators read of an array: 16 bytes, 4 slots per cache
+ * line.
+ */
+typedef struct ArraySlot
+{
+  // NULL when the id is free
+  platter_t * data;
+  platter_t size;
+
+  // next free id when the slot is, 0 ending the list
+  ArrayCellId next_free;
+
+} ArraySlot;
+
+/**
+ * Arrays of a machine (um_t::arrays) indexed by id: the hot slots apart
+ * from the cells, only looked at by the allocations, the releases and
+ * the modules. The ids of the released arrays are given again, the last
+ * released first, so that the table stays about as large as the peak of
+ * live arrays.
+ */
+typedef struct ArrayTable
+{
+  ArraySlot * slots;
+  ArrayCell ** cells;
+  platter_t capacity;
+
+  // first free id below um_t::next_array_id, 0 for none
+  ArrayCellId free_ids;
+
+} ArrayTable;
+
+
+/**
+ * @return the array of the machine with that id, NULL if there is none
+ */
+ArrayCell * um_priv_search_for_cell_id (struct um_t * machine, ArrayCellId id);
+
+/**
+ * @return the array with the lowest id from id on, NULL if there is none:
+ *
+ *   for (cell = um_priv_cell_from (machine, 0); NULL != cell; cell = um_priv_cell_from (machine, cell->id + 1))
+ */
+ArrayCell * um_priv_cell_from (struct um_t * machine, ArrayCellId id);
+
+/**
+ * Adds an array to the table of the machine, at its id.
+ *
+ * @return ENOMEM when the table cannot grow
+ */
+int um_priv_insert_array_cell (struct um_t * machine, ArrayCell * cell);
+
+/**
+ * Removes an array from the table of the machine, its id is free again.
+ */
+void um_priv_remove_array_cell (struct um_t * machine, ArrayCell * cell);
+
+/**
+ * Gives back an id without array below next_array_id, the next one
+ * allocated (restoring the free ids of a checkpoint).
+ */
+int um_priv_release_array_id (struct um_t * machine, ArrayCellId id);
+
+/**
+ * Arrays are stored big endian, as in the program image.
+ */
+platter_t um_priv_swap_platter_bytes (platter_t p);
+
+/**
+ * Releases an array already removed from the table of the machine.
+ */
+void um_priv_release_array_cell (struct um_t * machine, ArrayCell * cell);
+
+/**
+ * Releases the platters of an array (free or munmap).
+ */
+void um_priv_free_platters (platter_t * data, platter_t count, byte guarded);
+
+/**
+ * Creates a zeroed array with that id, accounted for but not inserted in
+ * the table of the machine.
+ *
+ * @return NULL when out of memory
+ */
+ArrayCell * um_priv_create_array_cell (struct um_t * machine
+				       , ArrayCellId id
+				       , platter_t count);
+
+/**
+ * Copies count platters to zeroed ones, page by page, skipping the pages
+ * of zeros so that a mapped destination does not get memory for them.
+ */
+void um_priv_copy_nonzero (platter_t * to, const platter_t * from, platter_t count);
+
+/**
+ * Records that count platters from offset were written, called by the
+ * write paths while a checkpoint log is attached.
+ */
+void um_priv_mark_dirty (ArrayCell * cell, platter_t offset, platter_t count);
+
+// bytes of the longest varint
+#define UM_PRIV_VARINT_MAX_SIZE 10
+
+/**
+ * Writes v as an unsigned LEB128 varint (the trace, profile and replay
+ * logs).
+ *
+ * @return the number of bytes written
+ */
+size_t um_priv_put_varint (byte * out, unsigned long long v);
+
+/**
+ * Reads the varint at *in, before end, and moves *in past it.
+ *
+ * @return EOK, or EINVAL when it is truncated
+ */
+int um_priv_get_varint (const byte ** in, const byte * end, unsigned long long * v);
+
+#define UM_PRIV_FNV1A_BASIS 0xcbf29ce484222325ULL
+
+/**
+ * FNV-1a of size bytes, going on from h (UM_PRIV_FNV1A_BASIS for the
+ * first ones).
+ */
+unsigned long long um_priv_fnv1a (unsigned long long h, const void * data, size_t size);
+
+#endif // UM_PRIV_H
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "umasm.h"
+
+
+enum
+  {
+    UMASM_ORTHO_MAX = 0x1FFFFFF,
+  };
+
+
+int umasm_init (umasm_t * a)
+{
+  if (NULL == a)
+    {
+      return EINVAL;
+    }
+  
+  memset (a, 0, sizeof(*a));
+  
+  return EOK;
+}
+
+void umasm_free (umasm_t * a)
+{
+  if (NULL != a)
+    {
+      free (a->code);
+      memset (a, 0, sizeof(*a));
+    }
+}
+
+address_t umasm_here (umasm_t * a)
+{
+  return (address_t) a->size;
+}
+
+address_t umasm_emit (umasm_t * a, platter_t p)
+{
+  if (a->size == a->capacity)
+    {
+      size_t capacity = 0 == a->capacity ? 256 : a->capacity * 2;
+      platter_t * code = (platter_t *) realloc (a->code, capacity * sizeof(platter_t));
+      
+      assert (NULL != code);
+      
+      a->code = code;
+      a->capacity = capacity;
+    }
+  
+  a->code[a->size] = p;
+  
+  return (address_t) a->size++;
+}
+
+void umasm_patch (umasm_t * a, address_t at, platter_t p)
+{
+  assert (at < a->size);
+  
+  a->code[at] = p;
+}
+
+void umasm_pad (umasm_t * a, size_t size)
+{
+  while (a->size < size)
+    {
+      umasm_emit (a, 0);
+    }
+}
+
+platter_t umasm_op (OperatorCodes code, byte rega, byte regb, byte regc)
+{
+  return ((platter_t) code << 28)
+    | ((platter_t) (rega & 0x7) << 6)
+    | ((platter_t) (regb & 0x7) << 3)
+    | (platter_t) (regc & 0x7);
+}
+
+platter_t umasm_bulk (OperatorCodes code, BulkOperations operation, byte rega, byte regb, byte regc)
+{
+  assert (OP_BULK_STORE == code || OP_BULK_SCAN == code);
+  
+  return umasm_op (code, rega, regb, regc) | ((platter_t) (operation & 0x7) << 9);
+}
+
+platter_t umasm_ortho (byte rega, platter_t value)
+{
+  assert (value <= UMASM_ORTHO_MAX);
+  
+  return ((platter_t) OP_ORTHOGRAPHY << 28)
+    | ((platter_t) (rega & 0x7) << 25)
+    | (value & UMASM_ORTHO_MAX);
+}
+
+void umasm_load_constant (umasm_t * a, byte rega, byte scratch, platter_t value)
+{
+  if (value <= UMASM_ORTHO_MAX)
+    {
+      umasm_emit (a, umasm_ortho (rega, value));
+      return;
+    }
+  
+  assert (rega != scratch);
+  
+  // rega = (value >> 16) * 0x10000 + (value & 0xFFFF)
+  umasm_emit (a, umasm_ortho (rega, value >> 16));
+  umasm_emit (a, umasm_ortho (scratch, 0x10000));
+  umasm_emit (a, umasm_op (OP_MULTIPLICATION, rega, rega, scratch));
+  umasm_emit (a, umasm_ortho (scratch, value & 0xFFFF));
+  umasm_emit (a, umasm_op (OP_ADDITION, rega, rega, scratch));
+}
+
+byte * umasm_image (umasm_t * a, size_t * size)
+{
+  byte * image = (byte *) malloc (a->size * sizeof(platter_t) + 1);
+  size_t i = 0;
+  
+  if (NULL == image)
+    {
+      return NULL;
+    }
+  
+  for (i = 0; i < a->size; ++i)
+    {
+      const platter_t p = a->code[i];
+      
+      image[4 * i + 0] = (byte) (p >> 24);
+      image[4 * i + 1] = (byte) (p >> 16);
+      image[4 * i + 2] = (byte) (p >> 8);
+      image[4 * i + 3] = (byte) p;
+    }
+  
+  *size = a->size * sizeof(platter_t);
+  
+  return image;
+}
@@ -0,0 +1,58 @@
+#if ! defined (UMASM_H)
+#define UMASM_H
+
+#include "um_priv.h"
+
+/**
+ * Minimal in memory assembler, used to generate the synthetic UM
+ * programs of the benchmarks and tools.
+ */
+typedef struct umasm_t
+{
+  platter_t * code;
+  size_t size;
+  size_t capacity;
+  
+} umasm_t;
+
+int umasm_init (umasm_t * a);
+void umasm_free (umasm_t * a);
+
+/**
+ * @return the address of the next emitted instruction
+ */
+address_t umasm_here (umasm_t * a);
+
+address_t umasm_emit (umasm_t * a, platter_t p);
+
+void umasm_patch (umasm_t * a, address_t at, platter_t p);
+
+/**
+ * Pads the program with 0 platters up to size platters.
+ */
+void umasm_pad (umasm_t * a, size_t size);
+
+platter_t umasm_op (OperatorCodes code, byte rega, byte regb, byte regc);
+
+platter_t umasm_ortho (byte rega, platter_t value);
+
+/**
+ * @return an extension operator (see um_set_extensions)
+ */
+platter_t umasm_bulk (OperatorCodes code, BulkOperations operation, byte rega, byte regb, byte regc);
+
+/**
+ * Emits the instructions that load any 32 bits value in rega.
+ *
+ * @param scratch register overwritten when value does not fit in an
+ * orthography instruction
+ */
+void umasm_load_constant (umasm_t * a, byte rega, byte scratch, platter_t value);
+
+/**
+ * @return the program as a big endian image suitable for um_run, to be
+ * released with free
+ */
+byte * umasm_image (umasm_t * a, size_t * size);
+
+#endif // UMASM_H